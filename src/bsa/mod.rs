@@ -1,5 +1,7 @@
 pub mod parser;
 pub mod types;
+pub mod writer;
 
 pub use parser::BsaArchive;
 pub use types::{BsaHeader, BsaFile, CompressionType};
+pub use writer::BsaWriter;
@@ -46,6 +46,17 @@ pub const ARCHIVE_PREFIX_FULLFILENAMES: u32 = 0x0100;
 /// File flags
 pub const FILE_COMPRESSED: u32 = 0x40000000;
 
+/// Content flags (the header's file_flags)
+pub const CONTENT_TEXTURES: u32 = 0x0002;
+
+/// Record sizes in an SSE archive
+pub const HEADER_SIZE: u64 = 36;
+pub const FOLDER_RECORD_SIZE: u64 = 24;
+pub const FILE_RECORD_SIZE: u64 = 16;
+
+/// Largest archive the game reads reliably (data offsets are 32-bit and read as signed)
+pub const MAX_ARCHIVE_SIZE: u64 = 0x7FFF_FFFF;
+
 /// BSA magic number "BSA\0"
 pub const BSA_MAGIC: u32 = 0x00415342;
 pub const SSE_VERSION: u32 = 105;
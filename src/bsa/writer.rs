@@ -0,0 +1,517 @@
+//! Packs optimized textures into SSE (v105) BSA archives instead of loose files
+//! Finished outputs are read, and optionally LZ4-compressed, on a small background pool
+//! and appended in completion order to one spool file by a single writer thread.
+//! `finish` lays the archives out and copies the spool into them sequentially.
+
+use super::types::*;
+use anyhow::{Context, Result};
+use crossbeam_channel::{Receiver, Sender};
+use log::{debug, info, warn};
+use rayon::{ThreadPool, ThreadPoolBuilder};
+use std::collections::btree_map::Entry;
+use std::collections::BTreeMap;
+use std::fs::{self, File};
+use std::io::{self, BufWriter, Read, Seek, SeekFrom, Write};
+use std::path::{Path, PathBuf};
+use std::thread::JoinHandle;
+use walkdir::WalkDir;
+
+/// One texture's data in the spool, stored under the name of each of `files`
+struct Packed {
+    /// Loose file and its duplicates, removed once the archives are written
+    files: Vec<PathBuf>,
+    /// Archive path of each of `files` (lowercase, backslash-separated)
+    names: Vec<String>,
+    /// Offset in the spool
+    offset: u64,
+    /// Stored size, including the original-size prefix when compressed
+    size: u32,
+    compressed: bool,
+}
+
+/// A pack job's output, on its way to the writer thread
+struct Blob {
+    files: Vec<PathBuf>,
+    names: Vec<String>,
+    data: Vec<u8>,
+    compressed: bool,
+}
+
+/// Streams finished textures under an output mod directory into BSA archives
+/// Each archive gets an empty plugin of the same name, which is what makes the game
+/// load it. Until `finish` succeeds the loose files stay in place, so an interrupted
+/// run still leaves a usable (loose) output.
+pub struct BsaWriter {
+    root: PathBuf,
+    name: String,
+    compress: bool,
+    pool: ThreadPool,
+    sender: Sender<Blob>,
+    spool_path: PathBuf,
+    spooler: JoinHandle<io::Result<Vec<Packed>>>,
+}
+
+impl BsaWriter {
+    /// Pack textures under `root` into "`name` - Textures.bsa" (and "`name` 2 - Textures.bsa"
+    /// and so on once an archive reaches `MAX_ARCHIVE_SIZE`)
+    pub fn new(root: &Path, name: &str, compress: bool) -> Result<Self> {
+        fs::create_dir_all(root)?;
+        let spool_path = root.join(format!("{}.bsa.spool", name));
+        let spool = File::create(&spool_path)
+            .with_context(|| format!("Failed to create BSA spool {:?}", spool_path))?;
+
+        // Reads are cheap next to encoding; compression gets a share of the CPUs
+        let threads = if compress { (num_cpus::get() / 2).max(1) } else { 2 };
+        let pool = ThreadPoolBuilder::new().num_threads(threads).build()?;
+        // Bounded, so a slow disk holds the readers back instead of filling memory
+        let (sender, receiver) = crossbeam_channel::bounded(threads * 4);
+        let spooler = std::thread::spawn(move || spool_blobs(spool, receiver));
+
+        Ok(Self {
+            root: root.to_path_buf(),
+            name: name.to_string(),
+            compress,
+            pool,
+            sender,
+            spool_path,
+            spooler,
+        })
+    }
+
+    /// Queue a finished texture, and the duplicates linked to it, for packing
+    /// The duplicates share the texture's data in the archive. A file that can't be
+    /// read or named in the archive is left loose.
+    pub fn add(&self, file: &Path, duplicates: &[PathBuf]) {
+        let mut files = Vec::with_capacity(1 + duplicates.len());
+        files.push(file.to_path_buf());
+        files.extend_from_slice(duplicates);
+        let Some(names) = files.iter().map(|f| self.archive_name(f)).collect::<Option<Vec<_>>>() else {
+            warn!("Not packing {:?}: not in a folder under {:?}", file, self.root);
+            return;
+        };
+
+        let sender = self.sender.clone();
+        let compress = self.compress;
+        self.pool.spawn(move || match pack(&files[0], compress) {
+            Ok((data, compressed)) => {
+                // A closed channel means the spool failed; finish reports that
+                let _ = sender.send(Blob { files, names, data, compressed });
+            }
+            Err(e) => warn!("Leaving {:?} loose: {}", files[0], e),
+        });
+    }
+
+    /// Archive path of `file`: its path under the root, lowercase with backslashes
+    fn archive_name(&self, file: &Path) -> Option<String> {
+        let relative = file.strip_prefix(&self.root).ok()?;
+        let name = relative.to_string_lossy().to_lowercase().replace('/', "\\");
+        name.contains('\\').then_some(name)
+    }
+
+    /// Wait for queued textures, write the archives and their plugins, and remove the
+    /// packed loose files
+    /// Returns the archives written.
+    pub fn finish(self) -> Result<Vec<PathBuf>> {
+        let Self { root, name, compress, pool, sender, spool_path, spooler } = self;
+        // The spooler stops once the last pack job drops its sender
+        drop(sender);
+        drop(pool);
+        let spooled = spooler
+            .join()
+            .unwrap_or_else(|_| Err(io::Error::new(io::ErrorKind::Other, "spool writer panicked")));
+        let result = spooled
+            .context("Failed to write the BSA spool")
+            .and_then(|packed| write_archives(&root, &name, compress, &packed, &spool_path));
+        let _ = fs::remove_file(&spool_path);
+        result
+    }
+}
+
+/// Read `file` for the archive, LZ4-compressed when that makes it smaller
+/// Compressed data is prefixed with its original size, as the game expects.
+fn pack(file: &Path, compress: bool) -> io::Result<(Vec<u8>, bool)> {
+    let data = fs::read(file)?;
+    let (data, compressed) = if compress {
+        let mut encoder = lz4::EncoderBuilder::new().build(Vec::with_capacity(data.len() + 4))?;
+        encoder.write_all(&data)?;
+        let (frame, result) = encoder.finish();
+        result?;
+        if frame.len() + 4 < data.len() {
+            let mut stored = Vec::with_capacity(frame.len() + 4);
+            stored.extend_from_slice(&(data.len() as u32).to_le_bytes());
+            stored.extend_from_slice(&frame);
+            (stored, true)
+        } else {
+            (data, false)
+        }
+    } else {
+        (data, false)
+    };
+    // The top bits of a record's size are flags
+    if data.len() as u64 >= FILE_COMPRESSED as u64 {
+        return Err(io::Error::new(io::ErrorKind::InvalidData, "too large for a BSA record"));
+    }
+    Ok((data, compressed))
+}
+
+/// Append blobs to the spool in arrival order until every sender is gone
+fn spool_blobs(spool: File, receiver: Receiver<Blob>) -> io::Result<Vec<Packed>> {
+    let mut out = BufWriter::with_capacity(8 << 20, spool);
+    let mut offset = 0;
+    let mut packed = Vec::new();
+    while let Ok(blob) = receiver.recv() {
+        out.write_all(&blob.data)?;
+        packed.push(Packed {
+            files: blob.files,
+            names: blob.names,
+            offset,
+            size: blob.data.len() as u32,
+            compressed: blob.compressed,
+        });
+        offset += blob.data.len() as u64;
+    }
+    out.flush()?;
+    Ok(packed)
+}
+
+/// Split the spool into archives under `MAX_ARCHIVE_SIZE`, write them, and remove the
+/// loose files now in an archive
+fn write_archives(root: &Path, name: &str, compress: bool, packed: &[Packed], spool_path: &Path) -> Result<Vec<PathBuf>> {
+    if packed.is_empty() {
+        return Ok(Vec::new());
+    }
+    let mut spool = File::open(spool_path)?;
+    let mut archives = Vec::new();
+    let mut loose = Vec::new();
+    for (i, entries) in split_archives(packed).into_iter().enumerate() {
+        let base = if i == 0 { name.to_string() } else { format!("{} {}", name, i + 1) };
+        let path = root.join(format!("{} - Textures.bsa", base));
+        loose.extend(
+            write_archive(&path, entries, compress, &mut spool)
+                .with_context(|| format!("Failed to write {:?}", path))?,
+        );
+        write_plugin(&root.join(format!("{}.esp", base)))?;
+        archives.push(path);
+    }
+
+    // Loose copies only go once every archive is on disk
+    let mut removed = 0;
+    for file in packed.iter().flat_map(|p| &p.files) {
+        if !loose.contains(file) && fs::remove_file(file).is_ok() {
+            removed += 1;
+        }
+    }
+    for dir in WalkDir::new(root.join("textures")).contents_first(true).into_iter().flatten() {
+        if dir.file_type().is_dir() {
+            // Fails, as intended, on folders that still hold loose files
+            let _ = fs::remove_dir(dir.path());
+        }
+    }
+    info!(
+        "Packed {} textures into {} archive(s), {} left loose",
+        removed,
+        archives.len(),
+        loose.len()
+    );
+    Ok(archives)
+}
+
+/// Consecutive runs of the spool, each small enough for one archive
+fn split_archives(packed: &[Packed]) -> Vec<&[Packed]> {
+    let mut archives = Vec::new();
+    let mut start = 0;
+    let mut size = HEADER_SIZE;
+    for (i, entry) in packed.iter().enumerate() {
+        // Bounded above by a folder of its own for every name
+        let records: u64 = entry
+            .names
+            .iter()
+            .map(|n| FOLDER_RECORD_SIZE + FILE_RECORD_SIZE + 2 * (n.len() as u64 + 2))
+            .sum();
+        let cost = entry.size as u64 + records;
+        if i > start && size + cost > MAX_ARCHIVE_SIZE {
+            archives.push(&packed[start..i]);
+            start = i;
+            size = HEADER_SIZE;
+        }
+        size += cost;
+    }
+    archives.push(&packed[start..]);
+    archives
+}
+
+/// Write one archive holding `entries`, whose data is one contiguous run of the spool
+/// Names the archive can't hold (a hash colliding with another name, or a folder name
+/// too long for its length byte) are returned so their files stay loose.
+fn write_archive(path: &Path, entries: &[Packed], compress: bool, spool: &mut File) -> Result<Vec<PathBuf>> {
+    // Folders and the files in each, ordered by hash as the game binary-searches them
+    let mut folders: BTreeMap<u64, (&str, BTreeMap<u64, (&str, &Packed)>)> = BTreeMap::new();
+    let mut loose = Vec::new();
+    for entry in entries {
+        for (name, file) in entry.names.iter().zip(&entry.files) {
+            let (folder, file_name) = name.rsplit_once('\\').unwrap();
+            // Checked before inserting, so a folder that can't be stored gets no record
+            if folder.len() >= 255 {
+                warn!("Leaving {:?} loose: folder {} can't be stored", file, folder);
+                loose.push(file.clone());
+                continue;
+            }
+            let (folder_name, files) = folders.entry(hash_folder(folder)).or_insert((folder, BTreeMap::new()));
+            if *folder_name != folder {
+                warn!("Leaving {:?} loose: folder {} can't be stored", file, folder);
+                loose.push(file.clone());
+                continue;
+            }
+            match files.entry(hash_file(file_name)) {
+                Entry::Vacant(slot) => {
+                    slot.insert((file_name, entry));
+                }
+                Entry::Occupied(slot) => {
+                    warn!("Leaving {:?} loose: BSA hash collides with {}", file, slot.get().0);
+                    loose.push(file.clone());
+                }
+            }
+        }
+    }
+
+    let file_count: usize = folders.values().map(|(_, files)| files.len()).sum();
+    let folder_names: u64 = folders.values().map(|(name, _)| name.len() as u64 + 1).sum();
+    let file_names: u64 = folders
+        .values()
+        .flat_map(|(_, files)| files.values())
+        .map(|(name, _)| name.len() as u64 + 1)
+        .sum();
+    let records_start = HEADER_SIZE + FOLDER_RECORD_SIZE * folders.len() as u64;
+    let data_start = records_start
+        + folders.len() as u64
+        + folder_names
+        + FILE_RECORD_SIZE * file_count as u64
+        + file_names;
+    let spool_start = entries[0].offset;
+    let last = &entries[entries.len() - 1];
+    let data_len = last.offset + last.size as u64 - spool_start;
+
+    let mut archive_flags = ARCHIVE_INCLUDE_DIR_NAMES | ARCHIVE_INCLUDE_FILE_NAMES;
+    if compress {
+        archive_flags |= ARCHIVE_COMPRESSED;
+    }
+
+    let temp = path.with_extension("bsa.tmp");
+    let mut out = BufWriter::with_capacity(8 << 20, File::create(&temp)?);
+    for value in [
+        BSA_MAGIC,
+        SSE_VERSION,
+        HEADER_SIZE as u32,
+        archive_flags,
+        folders.len() as u32,
+        file_count as u32,
+        folder_names as u32,
+        file_names as u32,
+        CONTENT_TEXTURES,
+    ] {
+        out.write_all(&value.to_le_bytes())?;
+    }
+
+    // A folder record points at its file records, offset by the file name block's size
+    let mut block = records_start;
+    for (hash, (name, files)) in &folders {
+        out.write_all(&hash.to_le_bytes())?;
+        out.write_all(&(files.len() as u32).to_le_bytes())?;
+        out.write_all(&0u32.to_le_bytes())?;
+        out.write_all(&(block + file_names).to_le_bytes())?;
+        block += 1 + name.len() as u64 + 1 + FILE_RECORD_SIZE * files.len() as u64;
+    }
+
+    for (name, files) in folders.values() {
+        out.write_all(&[name.len() as u8 + 1])?;
+        out.write_all(name.as_bytes())?;
+        out.write_all(&[0])?;
+        for (hash, (_, entry)) in files {
+            let mut size = entry.size;
+            if entry.compressed != compress {
+                size |= FILE_COMPRESSED;
+            }
+            let offset = u32::try_from(data_start + entry.offset - spool_start)
+                .context("Archive data past the 32-bit offset range")?;
+            out.write_all(&hash.to_le_bytes())?;
+            out.write_all(&size.to_le_bytes())?;
+            out.write_all(&offset.to_le_bytes())?;
+        }
+    }
+
+    for (_, files) in folders.values() {
+        for (name, _) in files.values() {
+            out.write_all(name.as_bytes())?;
+            out.write_all(&[0])?;
+        }
+    }
+
+    spool.seek(SeekFrom::Start(spool_start))?;
+    let copied = io::copy(&mut spool.take(data_len), &mut out)?;
+    if copied != data_len {
+        anyhow::bail!("BSA spool ended early: {} of {} bytes", copied, data_len);
+    }
+    out.flush()?;
+    drop(out);
+    fs::rename(&temp, path)?;
+    debug!("Wrote {:?}: {} folders, {} files, {} bytes of data", path, folders.len(), file_count, data_len);
+    Ok(loose)
+}
+
+/// Empty ESL-flagged plugin, so the game loads "<plugin> - Textures.bsa" without
+/// taking a load order slot
+fn write_plugin(path: &Path) -> io::Result<()> {
+    const ESL_FLAG: u32 = 0x200;
+    let mut plugin = Vec::with_capacity(42);
+    plugin.extend_from_slice(b"TES4");
+    plugin.extend_from_slice(&18u32.to_le_bytes()); // HEDR subrecord, with its header
+    plugin.extend_from_slice(&ESL_FLAG.to_le_bytes());
+    plugin.extend_from_slice(&0u32.to_le_bytes()); // form ID
+    plugin.extend_from_slice(&0u32.to_le_bytes()); // version control
+    plugin.extend_from_slice(&44u16.to_le_bytes()); // form version
+    plugin.extend_from_slice(&0u16.to_le_bytes());
+    plugin.extend_from_slice(b"HEDR");
+    plugin.extend_from_slice(&12u16.to_le_bytes());
+    plugin.extend_from_slice(&1.71f32.to_le_bytes());
+    plugin.extend_from_slice(&0u32.to_le_bytes()); // record count
+    plugin.extend_from_slice(&0x800u32.to_le_bytes()); // next object ID
+    fs::write(path, plugin)
+}
+
+/// Hash of a folder path (lowercase, backslash-separated)
+pub fn hash_folder(path: &str) -> u64 {
+    hash_name(path.as_bytes(), b"")
+}
+
+/// Hash of a file name within its folder (lowercase)
+pub fn hash_file(name: &str) -> u64 {
+    match name.rfind('.') {
+        Some(dot) => hash_name(name[..dot].as_bytes(), name[dot..].as_bytes()),
+        None => hash_name(name.as_bytes(), b""),
+    }
+}
+
+/// TES4 name hash: the stem's first, last two and length in the low half, rolling hashes
+/// of the rest of the stem and of the extension (with its dot) in the high half
+fn hash_name(stem: &[u8], extension: &[u8]) -> u64 {
+    let rolling = |bytes: &[u8]| {
+        bytes.iter().fold(0u32, |hash, &c| hash.wrapping_mul(0x1003F).wrapping_add(c as u32))
+    };
+    let len = stem.len();
+    if len == 0 {
+        return 0;
+    }
+    let mut hash = stem[len - 1] as u64 | (len as u64) << 16 | (stem[0] as u64) << 24;
+    if len > 2 {
+        hash |= (stem[len - 2] as u64) << 8;
+    }
+    if len > 3 {
+        hash = hash.wrapping_add((rolling(&stem[1..len - 2]) as u64) << 32);
+    }
+    hash |= match extension {
+        b".kf" => 0x80,
+        b".nif" => 0x8000,
+        b".dds" => 0x8080,
+        b".wav" => 0x8000_0000,
+        _ => 0,
+    };
+    hash.wrapping_add((rolling(extension) as u64) << 32)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn u32_at(bytes: &[u8], at: u64) -> u32 {
+        u32::from_le_bytes(bytes[at as usize..at as usize + 4].try_into().unwrap())
+    }
+
+    #[test]
+    fn test_hash_name() {
+        assert_eq!(hash_file("a.dds") as u32, b'a' as u32 | 1 << 16 | (b'a' as u32) << 24 | 0x8080);
+        // Same stem: low halves differ only in the extension's flag bits
+        let (dds, nif) = (hash_file("abcd.dds"), hash_file("abcd.nif"));
+        assert_eq!(dds as u32 & !0x8080, nif as u32 & !0x8000);
+        assert_eq!(dds as u32 & 0xFFFF, b'd' as u32 | (b'c' as u32) << 8 | 0x8080);
+        assert_ne!(dds >> 32, nif >> 32);
+        assert_eq!(hash_folder("textures\\a"), hash_name(b"textures\\a", b""));
+    }
+
+    #[test]
+    fn test_write_archive_layout() {
+        let dir = tempfile::tempdir().unwrap();
+        let root = dir.path();
+        let body = root.join("textures/actors/body.dds");
+        let copy = root.join("textures/actors/body_copy.dds");
+        let sword = root.join("textures/weapons/sword.dds");
+        fs::create_dir_all(body.parent().unwrap()).unwrap();
+        fs::create_dir_all(sword.parent().unwrap()).unwrap();
+        fs::write(&body, vec![7u8; 300]).unwrap();
+        fs::write(&copy, vec![7u8; 300]).unwrap();
+        fs::write(&sword, b"sword").unwrap();
+
+        let writer = BsaWriter::new(root, "Test", false).unwrap();
+        writer.add(&body, &[copy.clone()]);
+        writer.add(&sword, &[]);
+        let archives = writer.finish().unwrap();
+        assert_eq!(archives, vec![root.join("Test - Textures.bsa")]);
+        assert!(root.join("Test.esp").exists());
+        assert!(!body.exists() && !copy.exists() && !root.join("textures").exists());
+
+        let bytes = fs::read(&archives[0]).unwrap();
+        assert_eq!(u32_at(&bytes, 0), BSA_MAGIC);
+        assert_eq!(u32_at(&bytes, 4), SSE_VERSION);
+        assert_eq!((u32_at(&bytes, 16), u32_at(&bytes, 20)), (2, 3));
+        let file_names = u32_at(&bytes, 28) as u64;
+
+        // Every record leads to its folder name and its file's data
+        let mut found = Vec::new();
+        let mut data_start = bytes.len();
+        for folder in 0..2 {
+            let record = HEADER_SIZE + FOLDER_RECORD_SIZE * folder;
+            let count = u32_at(&bytes, record + 8) as u64;
+            let block = u32_at(&bytes, record + 16) as u64 - file_names;
+            let name_len = bytes[block as usize] as u64;
+            let name = String::from_utf8(bytes[block as usize + 1..(block + name_len) as usize].to_vec()).unwrap();
+            for file in 0..count {
+                let at = block + 1 + name_len + FILE_RECORD_SIZE * file;
+                let size = u32_at(&bytes, at + 8) as usize;
+                let offset = u32_at(&bytes, at + 12) as usize;
+                data_start = data_start.min(offset);
+                found.push((name.clone(), bytes[offset..offset + size].to_vec()));
+            }
+        }
+        found.sort();
+        assert_eq!(found, vec![
+            ("textures\\actors".to_string(), vec![7u8; 300]),
+            ("textures\\actors".to_string(), vec![7u8; 300]),
+            ("textures\\weapons".to_string(), b"sword".to_vec()),
+        ]);
+        // The duplicate shares the original's data
+        assert_eq!(bytes.len() - data_start, 300 + 5);
+    }
+
+    #[test]
+    fn test_long_folder_stays_loose() {
+        let dir = tempfile::tempdir().unwrap();
+        let root = dir.path();
+        let sword = root.join("textures/weapons/sword.dds");
+        let deep = (0..5).fold(root.join("textures"), |path, _| path.join("d".repeat(60)));
+        let long = deep.join("long.dds");
+        fs::create_dir_all(sword.parent().unwrap()).unwrap();
+        fs::create_dir_all(&deep).unwrap();
+        fs::write(&sword, b"sword").unwrap();
+        fs::write(&long, b"long").unwrap();
+
+        let writer = BsaWriter::new(root, "Test", false).unwrap();
+        writer.add(&sword, &[]);
+        writer.add(&long, &[]);
+        let archives = writer.finish().unwrap();
+        assert!(long.exists() && !sword.exists());
+
+        // Only the folder that fits gets a record, and the names hold only its name
+        let bytes = fs::read(&archives[0]).unwrap();
+        assert_eq!((u32_at(&bytes, 16), u32_at(&bytes, 20)), (1, 1));
+        assert_eq!(u32_at(&bytes, 24) as usize, "textures\\weapons".len() + 1);
+    }
+}
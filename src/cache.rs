@@ -0,0 +1,328 @@
+/// Content-addressed cache of optimized textures
+/// Entries are keyed by a hash of the source bytes and every setting that shapes the
+/// encoded output, so textures that didn't change since the last run are copied back
+/// instead of going through the encoder again
+
+use anyhow::Result;
+use log::{debug, info, warn};
+use std::fs::{self, File};
+use std::io::Read;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::time::SystemTime;
+use xxhash_rust::xxh3::Xxh3;
+
+/// Bump when the key layout changes, so old entries are never served
+const CACHE_VERSION: u32 = 2;
+
+/// Default size bound for the cache directory
+pub const DEFAULT_CACHE_SIZE_MB: u64 = 20 * 1024;
+
+/// Suffix of finished entries; anything else in the cache is a leftover temp file
+const ENTRY_EXTENSION: &str = "dds";
+
+/// Settings besides the source bytes that determine an encoded output
+#[derive(Debug, Clone)]
+pub struct EncodeParams<'a> {
+    /// Backend and tool build, see `CompressionTools::fingerprint`
+    pub tool: &'a str,
+    /// Target format as passed to the encoder (None = keep the source format)
+    pub format: Option<&'a str>,
+    pub target_width: u32,
+    pub target_height: u32,
+    pub srgb_hint: bool,
+    pub quality: &'a str,
+    /// Tangent-space normal map, whose mips the NVTT3 server renormalizes
+    pub normal_map: bool,
+}
+
+/// 128-bit content hash identifying one encoded output
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct CacheKey(u128);
+
+impl CacheKey {
+    /// Key for `source` encoded with `params`
+    pub fn from_bytes(source: &[u8], params: &EncodeParams) -> Self {
+        let mut hasher = Self::hasher(params);
+        hasher.update(source);
+        CacheKey(hasher.digest128())
+    }
+
+    /// Key for a source file, hashed in chunks instead of read whole
+    pub fn from_file(path: &Path, params: &EncodeParams) -> Result<Self> {
+        let mut hasher = Self::hasher(params);
+        let mut file = File::open(path)?;
+        let mut buf = vec![0u8; 1 << 20];
+        loop {
+            let n = file.read(&mut buf)?;
+            if n == 0 {
+                break;
+            }
+            hasher.update(&buf[..n]);
+        }
+        Ok(CacheKey(hasher.digest128()))
+    }
+
+    fn hasher(params: &EncodeParams) -> Xxh3 {
+        let mut hasher = Xxh3::new();
+        hasher.update(&CACHE_VERSION.to_le_bytes());
+        // Strings are length-prefixed so adjacent fields can't run together
+        for field in [params.tool, params.format.unwrap_or(""), params.quality] {
+            hasher.update(&(field.len() as u32).to_le_bytes());
+            hasher.update(field.as_bytes());
+        }
+        hasher.update(&params.target_width.to_le_bytes());
+        hasher.update(&params.target_height.to_le_bytes());
+        hasher.update(&[params.srgb_hint as u8, params.normal_map as u8]);
+        hasher
+    }
+
+    fn hex(&self) -> String {
+        format!("{:032x}", self.0)
+    }
+}
+
+/// Persistent store of encoded textures, bounded in size by evicting the least
+/// recently used entries
+/// Entries live at `<root>/<first 2 hex digits>/<key>.dds`; a hit refreshes the
+/// entry's mtime, which is what eviction orders by.
+pub struct OutputCache {
+    root: PathBuf,
+    max_bytes: u64,
+    size: AtomicU64,
+    hits: AtomicUsize,
+    stored: AtomicUsize,
+    temp_counter: AtomicU64,
+}
+
+impl OutputCache {
+    /// Per-user cache location (~/.cache/radium-textures/outputs on Linux)
+    pub fn default_dir() -> PathBuf {
+        dirs::cache_dir()
+            .unwrap_or_else(|| PathBuf::from("."))
+            .join("radium-textures")
+            .join("outputs")
+    }
+
+    /// Open (creating if needed) the cache at `root`, trimming it to `max_bytes`
+    pub fn open(root: &Path, max_bytes: u64) -> Result<Self> {
+        fs::create_dir_all(root)?;
+        let cache = Self {
+            root: root.to_path_buf(),
+            max_bytes,
+            size: AtomicU64::new(0),
+            hits: AtomicUsize::new(0),
+            stored: AtomicUsize::new(0),
+            temp_counter: AtomicU64::new(0),
+        };
+        let size = cache.entries()?.iter().map(|(_, len, _)| len).sum();
+        cache.size.store(size, Ordering::Relaxed);
+        cache.evict()?;
+
+        info!(
+            "Output cache: {:?} ({} MB of {} MB)",
+            root,
+            cache.size.load(Ordering::Relaxed) >> 20,
+            max_bytes >> 20
+        );
+        Ok(cache)
+    }
+
+    fn entry_path(&self, key: &CacheKey) -> PathBuf {
+        let hex = key.hex();
+        self.root
+            .join(&hex[..2])
+            .join(format!("{}.{}", hex, ENTRY_EXTENSION))
+    }
+
+    /// Temp file next to `path`, unique across threads and processes
+    fn temp_path(&self, path: &Path) -> PathBuf {
+        let n = self.temp_counter.fetch_add(1, Ordering::Relaxed);
+        path.with_extension(format!("{}-{}.tmp", std::process::id(), n))
+    }
+
+    /// Copy the entry for `key` to `dest`. Returns false on a miss.
+    pub fn fetch(&self, key: &CacheKey, dest: &Path) -> bool {
+        let entry = self.entry_path(key);
+        if !entry.exists() {
+            return false;
+        }
+
+        // Copy via temp + rename so an interrupted run never leaves a truncated output
+        let temp = self.temp_path(dest);
+        let copied = dest
+            .parent()
+            .map_or(Ok(()), fs::create_dir_all)
+            .and_then(|_| fs::copy(&entry, &temp))
+            .and_then(|_| fs::rename(&temp, dest));
+        if let Err(e) = copied {
+            debug!("Output cache: failed to restore {:?}: {}", dest, e);
+            let _ = fs::remove_file(&temp);
+            return false;
+        }
+
+        // Mark as recently used
+        let _ = File::options()
+            .append(true)
+            .open(&entry)
+            .and_then(|f| f.set_modified(SystemTime::now()));
+        self.hits.fetch_add(1, Ordering::Relaxed);
+        true
+    }
+
+    /// Add the encoded `output` under `key`
+    pub fn store(&self, key: &CacheKey, output: &Path) -> Result<()> {
+        let entry = self.entry_path(key);
+        if entry.exists() {
+            return Ok(());
+        }
+        if let Some(parent) = entry.parent() {
+            fs::create_dir_all(parent)?;
+        }
+
+        let temp = self.temp_path(&entry);
+        let bytes = match fs::copy(output, &temp).and_then(|n| fs::rename(&temp, &entry).map(|_| n)) {
+            Ok(n) => n,
+            Err(e) => {
+                let _ = fs::remove_file(&temp);
+                return Err(e.into());
+            }
+        };
+        self.size.fetch_add(bytes, Ordering::Relaxed);
+        self.stored.fetch_add(1, Ordering::Relaxed);
+        Ok(())
+    }
+
+    /// Every file in the cache as (path, size, mtime)
+    fn entries(&self) -> Result<Vec<(PathBuf, u64, SystemTime)>> {
+        let mut entries = Vec::new();
+        for shard in fs::read_dir(&self.root)? {
+            let shard = shard?.path();
+            if !shard.is_dir() {
+                continue;
+            }
+            for file in fs::read_dir(&shard)? {
+                let file = file?;
+                let meta = file.metadata()?;
+                if meta.is_file() {
+                    let mtime = meta.modified().unwrap_or(SystemTime::UNIX_EPOCH);
+                    entries.push((file.path(), meta.len(), mtime));
+                }
+            }
+        }
+        Ok(entries)
+    }
+
+    /// Delete least recently used entries until the cache fits its size bound
+    /// Temp files left by interrupted runs go first.
+    /// Returns (entries removed, bytes freed)
+    pub fn evict(&self) -> Result<(usize, u64)> {
+        if self.size.load(Ordering::Relaxed) <= self.max_bytes {
+            return Ok((0, 0));
+        }
+
+        let mut entries = self.entries()?;
+        let is_entry = |path: &Path| path.extension().map_or(false, |e| e == ENTRY_EXTENSION);
+        entries.sort_by_key(|(path, _, mtime)| (is_entry(path), *mtime));
+
+        let mut size: u64 = entries.iter().map(|(_, len, _)| len).sum();
+        let mut removed = 0;
+        let mut freed = 0;
+        for (path, len, _) in entries {
+            if size <= self.max_bytes {
+                break;
+            }
+            match fs::remove_file(&path) {
+                Ok(()) => {
+                    size -= len;
+                    freed += len;
+                    removed += 1;
+                }
+                Err(e) => warn!("Output cache: failed to evict {:?}: {}", path, e),
+            }
+        }
+        self.size.store(size, Ordering::Relaxed);
+
+        if removed > 0 {
+            info!("Output cache: evicted {} entries ({} MB)", removed, freed >> 20);
+        }
+        Ok((removed, freed))
+    }
+
+    /// Outputs served from the cache so far
+    pub fn hits(&self) -> usize {
+        self.hits.load(Ordering::Relaxed)
+    }
+
+    /// Outputs added to the cache so far
+    pub fn stored(&self) -> usize {
+        self.stored.load(Ordering::Relaxed)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::time::Duration;
+
+    fn params(target: u32) -> EncodeParams<'static> {
+        EncodeParams {
+            tool: "test",
+            format: Some("bc7"),
+            target_width: target,
+            target_height: target,
+            srgb_hint: false,
+            quality: "normal",
+            normal_map: false,
+        }
+    }
+
+    #[test]
+    fn test_key_covers_params() {
+        let source = b"DDS source bytes";
+        let key = CacheKey::from_bytes(source, &params(1024));
+        assert_eq!(key, CacheKey::from_bytes(source, &params(1024)));
+        assert_ne!(key, CacheKey::from_bytes(source, &params(2048)));
+        assert_ne!(key, CacheKey::from_bytes(b"DDS other bytes", &params(1024)));
+        let normal = EncodeParams { normal_map: true, ..params(1024) };
+        assert_ne!(key, CacheKey::from_bytes(source, &normal));
+
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("source.dds");
+        fs::write(&path, source).unwrap();
+        assert_eq!(key, CacheKey::from_file(&path, &params(1024)).unwrap());
+    }
+
+    #[test]
+    fn test_store_fetch_evict() {
+        let dir = tempfile::tempdir().unwrap();
+        let cache = OutputCache::open(&dir.path().join("cache"), 250).unwrap();
+
+        let output = dir.path().join("out.dds");
+        let dest = dir.path().join("restored/out.dds");
+        let old = CacheKey::from_bytes(b"old", &params(512));
+        let new = CacheKey::from_bytes(b"new", &params(512));
+
+        assert!(!cache.fetch(&old, &dest));
+        fs::write(&output, [1u8; 100]).unwrap();
+        cache.store(&old, &output).unwrap();
+        assert!(cache.fetch(&old, &dest));
+        assert_eq!(fs::read(&dest).unwrap(), [1u8; 100]);
+
+        // Age the first entry so it's the one evicted
+        let past = SystemTime::now() - Duration::from_secs(3600);
+        File::options()
+            .append(true)
+            .open(cache.entry_path(&old))
+            .unwrap()
+            .set_modified(past)
+            .unwrap();
+
+        fs::write(&output, [2u8; 200]).unwrap();
+        cache.store(&new, &output).unwrap();
+        assert_eq!(cache.evict().unwrap(), (1, 100));
+        assert!(!cache.fetch(&old, &dest));
+        assert!(cache.fetch(&new, &dest));
+        assert_eq!((cache.hits(), cache.stored()), (2, 2));
+    }
+}
@@ -1,35 +1,69 @@
-use super::TextureRecord;
+use super::{intern, TextureRecord};
 use crate::bsa::BsaArchive;
 use crate::dds;
 use crate::mo2::VirtualFileSystem;
 use anyhow::Result;
 use ba2::Reader; // For BSA file extraction
 use log::{debug, info, warn};
+use rayon::prelude::*;
 use std::collections::HashMap;
 use std::fs::File;
 use std::io::Write;
 use std::path::Path;
+use std::sync::Arc;
 
 /// Service for discovering all textures from mods (loose files and BSAs)
 /// Uses in-memory HashMap for fast lookups (like sky-tex-opti)
 pub struct TextureDiscoveryService;
 
+/// Why a BSA texture's DDS header couldn't be read, counted separately in the summary
+enum HeaderFailure {
+    TooSmall(String),
+    Parse(String),
+    Decompress(String),
+}
+
 impl TextureDiscoveryService {
-    /// Try LZ4 decompression as fallback when deflate fails
-    /// BSA files may use LZ4 compression that ba2's deflate decoder can't handle
-    fn try_lz4_decompress(compressed_data: &[u8]) -> Result<Vec<u8>> {
+    /// Decompress only the first `len` bytes of a compressed BSA entry
+    /// Tries deflate first, then LZ4, which many Skyrim BSAs use and ba2's deflate
+    /// decoder can't handle. Both are streamed, so only the leading block is decoded.
+    fn decompress_prefix(compressed_data: &[u8], len: usize) -> Result<Vec<u8>> {
         use std::io::Read;
 
-        // Try LZ4 decompression
-        let mut decoder = lz4::Decoder::new(compressed_data)?;
-        let mut decompressed = Vec::new();
-        decoder.read_to_end(&mut decompressed)?;
-        Ok(decompressed)
+        let read_prefix = |mut decoder: Box<dyn Read + '_>| -> std::io::Result<Vec<u8>> {
+            let mut prefix = Vec::with_capacity(len);
+            decoder.by_ref().take(len as u64).read_to_end(&mut prefix)?;
+            Ok(prefix)
+        };
+
+        let deflate = flate2::read::ZlibDecoder::new(compressed_data);
+        match read_prefix(Box::new(deflate)) {
+            Ok(prefix) if !prefix.is_empty() => Ok(prefix),
+            _ => Ok(read_prefix(Box::new(lz4::Decoder::new(compressed_data)?))?),
+        }
+    }
+
+    /// Parse the DDS header of a BSA entry, reading no more of it than the header
+    fn read_bsa_header(file: &ba2::tes4::File) -> std::result::Result<dds::DDSHeader, HeaderFailure> {
+        let bytes = if file.is_decompressed() {
+            let bytes = file.as_bytes();
+            bytes[..bytes.len().min(dds::MAX_HEADER_SIZE)].to_vec()
+        } else {
+            Self::decompress_prefix(file.as_bytes(), dds::MAX_HEADER_SIZE).map_err(|e| {
+                HeaderFailure::Decompress(format!("both deflate and LZ4 decompression failed: {}", e))
+            })?
+        };
+
+        if bytes.len() < 128 {
+            return Err(HeaderFailure::TooSmall(format!("too small: {} bytes", bytes.len())));
+        }
+        dds::parse_dds_header(&mut std::io::Cursor::new(bytes))
+            .map_err(|e| HeaderFailure::Parse(format!("DDS parse error: {}", e)))
     }
 
     /// Classify texture type based on filename suffix
     /// Skyrim uses specific naming conventions for different texture types
-    fn classify_texture(path: &str) -> Option<String> {
+    fn classify_texture(path: &str) -> Option<&'static str> {
         let lower = path.to_lowercase();
 
         // Remove .dds extension
@@ -37,28 +71,28 @@ impl TextureDiscoveryService {
 
         // Check for common Skyrim suffixes
         if without_ext.ends_with("_n") {
-            Some("Normal".to_string())
+            Some("Normal")
         } else if without_ext.ends_with("_s") {
-            Some("Specular".to_string())
+            Some("Specular")
         } else if without_ext.ends_with("_m") || without_ext.ends_with("_p") {
             // _p = parallax/heightmap, _m = mask/metallic OR male variant
             // Actual format (BC4 vs BC7) is resolved in grouping stage based on
             // source DDS format — multi-channel sources → Diffuse (BC7),
             // single-channel sources → Parallax (BC4).
-            Some("Parallax".to_string())
+            Some("Parallax")
         } else if without_ext.ends_with("_sk") {
-            Some("Subsurface".to_string())
+            Some("Subsurface")
         } else if without_ext.ends_with("_msn") {
-            Some("Multi-layer".to_string())
+            Some("Multi-layer")
         } else if without_ext.ends_with("_e") || without_ext.ends_with("_g") {
-            Some("Emissive".to_string())
+            Some("Emissive")
         } else if without_ext.ends_with("_em") {
-            Some("Emissive Mask".to_string())
+            Some("Emissive Mask")
         } else if without_ext.ends_with("_envmap") || without_ext.ends_with("_env") {
-            Some("Environment".to_string())
+            Some("Environment")
         } else {
             // No recognized suffix = Diffuse/Albedo
-            Some("Diffuse".to_string())
+            Some("Diffuse")
         }
     }
 
@@ -72,29 +106,35 @@ impl TextureDiscoveryService {
         let start_time = std::time::Instant::now();
 
         // Scan all texture files from VFS (loose files only for now)
-        for (internal_path, source) in vfs.get_texture_files() {
-            if let Some(file_path) = source.physical_path() {
-                if file_path.exists() {
-                    // Get file size
-                    let file_size = match std::fs::metadata(file_path) {
-                        Ok(meta) => meta.len(),
-                        Err(_) => continue,
-                    };
-
-                    // Create record
-                    let mut record = TextureRecord::from_loose_file(
-                        internal_path.clone(),
-                        file_path.to_path_buf(),
-                        file_size,
-                    );
+        // Sizes, and headers read on an earlier run, come from the VFS index; every
+        // texture is stat'ed again so one rewritten in place isn't taken from stale data
+        let loose: Vec<(&String, &Path)> = vfs
+            .get_texture_files()
+            .filter_map(|(internal_path, source)| Some((internal_path, source.physical_path()?)))
+            .collect();
+        let paths: Vec<&Path> = loose.iter().map(|(_, file_path)| *file_path).collect();
+
+        for ((internal_path, file_path), indexed) in loose.iter().zip(vfs.indexed_files(&paths)) {
+            let Some(indexed) = indexed else {
+                continue;
+            };
 
-                    // Classify texture type
-                    record.texture_type = Self::classify_texture(&internal_path);
+            // Create record
+            let mut record = TextureRecord::from_loose_file(
+                (*internal_path).clone(),
+                file_path.to_path_buf(),
+                indexed.size,
+            );
 
-                    // Insert with case-insensitive key
-                    textures.insert(internal_path.clone(), record);
-                }
+            if let Some(header) = &indexed.header {
+                record.set_header(header);
             }
+
+            // Classify texture type
+            record.texture_type = Self::classify_texture(internal_path);
+
+            // Insert with case-insensitive key
+            textures.insert((*internal_path).clone(), record);
         }
 
         let elapsed = start_time.elapsed();
@@ -109,7 +149,8 @@ impl TextureDiscoveryService {
 
     /// Discover textures from BSA archives
     /// Integrates with existing texture map (loose files take priority)
-    /// Now parses DDS headers during discovery!
+    /// Now parses DDS headers during discovery, in parallel, decompressing only as much
+    /// of each entry as its header needs
     pub fn discover_from_bsas(
         bsa_paths: &[(std::path::PathBuf, String, usize)],
         textures: &mut HashMap<String, TextureRecord>,
@@ -136,13 +177,18 @@ impl TextureDiscoveryService {
             match ba2::tes4::Archive::read(bsa_path.as_path()) {
                 Ok((archive, _options)) => {
                     bsa_count += 1;
-                    let bsa_name = bsa_path
-                        .file_name()
-                        .and_then(|n| n.to_str())
-                        .unwrap_or("unknown.bsa")
-                        .to_string();
+                    // Shared by every record from this archive
+                    let bsa_name = intern(
+                        bsa_path
+                            .file_name()
+                            .and_then(|n| n.to_str())
+                            .unwrap_or("unknown.bsa"),
+                    );
+                    let shared_bsa_path: Arc<Path> = Arc::from(bsa_path.as_path());
 
-                    // Iterate through all directories and files
+                    // Collect this archive's new textures, then read their headers in
+                    // parallel; records go into the map in order so priority holds
+                    let mut candidates = Vec::new();
                     for (dir_key, directory) in archive.iter() {
                         let dir_name = dir_key.name();
 
@@ -163,117 +209,61 @@ impl TextureDiscoveryService {
                             }
 
                             // Only add if not already present (loose files win)
-                            if !textures.contains_key(&normalized_path) {
-                                texture_count += 1;
-
-                                let mut record = TextureRecord::from_bsa_file(
-                                    normalized_path.clone(),
-                                    bsa_path.clone(),
-                                    bsa_name.clone(),
-                                    file.len() as u64,
-                                );
-
-                                // Classify texture type
-                                record.texture_type = Self::classify_texture(&normalized_path);
-
-                                // Extract and parse DDS header
-                                // Files in SSE BSAs are typically already decompressed
-                                let mut parse_failed_reason = None;
-
-                                if file.is_decompressed() {
-                                    let bytes = file.as_bytes();
-                                    if bytes.len() < 128 {
-                                        too_small += 1;
-                                        parse_failed_reason = Some(format!("too small: {} bytes", bytes.len()));
-                                    } else {
-                                        let mut cursor = std::io::Cursor::new(bytes);
-                                        match dds::parse_dds_header(&mut cursor) {
-                                            Ok(header) => {
-                                                record.width = Some(header.width);
-                                                record.height = Some(header.height);
-                                                record.format = Some(header.format);
-                                                headers_parsed += 1;
-                                            }
-                                            Err(e) => {
-                                                parse_failed += 1;
-                                                parse_failed_reason = Some(format!("DDS parse error: {}", e));
-                                            }
-                                        }
-                                    }
-                                } else {
-                                    // Try decompressing if it's compressed
-                                    match file.decompress(&Default::default()) {
-                                        Ok(decompressed) => {
-                                            let bytes = decompressed.as_bytes();
-                                            if bytes.len() < 128 {
-                                                too_small += 1;
-                                                parse_failed_reason = Some(format!("decompressed too small: {} bytes", bytes.len()));
-                                            } else {
-                                                let mut cursor = std::io::Cursor::new(bytes);
-                                                match dds::parse_dds_header(&mut cursor) {
-                                                    Ok(header) => {
-                                                        record.width = Some(header.width);
-                                                        record.height = Some(header.height);
-                                                        record.format = Some(header.format);
-                                                        headers_parsed += 1;
-                                                    }
-                                                    Err(e) => {
-                                                        parse_failed += 1;
-                                                        parse_failed_reason = Some(format!("DDS parse error after decompress: {}", e));
-                                                    }
-                                                }
-                                            }
-                                        }
-                                        Err(_e) => {
-                                            // Deflate decompression failed - try LZ4
-                                            // Many Skyrim BSAs use LZ4 compression
-                                            let compressed_bytes = file.as_bytes();
-                                            match Self::try_lz4_decompress(compressed_bytes) {
-                                                Ok(lz4_data) => {
-                                                    if lz4_data.len() < 128 {
-                                                        too_small += 1;
-                                                        parse_failed_reason = Some(format!("LZ4 decompressed file too small"));
-                                                    } else {
-                                                        let mut cursor = std::io::Cursor::new(&lz4_data);
-                                                        match dds::parse_dds_header(&mut cursor) {
-                                                            Ok(header) => {
-                                                                record.width = Some(header.width);
-                                                                record.height = Some(header.height);
-                                                                record.format = Some(header.format);
-                                                                headers_parsed += 1;
-                                                                // Successfully parsed via LZ4 decompression
-                                                            }
-                                                            Err(e) => {
-                                                                parse_failed += 1;
-                                                                parse_failed_reason = Some(format!("LZ4 decompressed but DDS parse failed: {}", e));
-                                                            }
-                                                        }
-                                                    }
-                                                }
-                                                Err(e) => {
-                                                    decompress_failed += 1;
-                                                    parse_failed_reason = Some(format!("both deflate and LZ4 decompression failed: {}", e));
-                                                }
-                                            }
-                                        }
-                                    }
-                                }
-
-                                if let Some(reason) = parse_failed_reason {
-                                    debug!("Failed to parse BSA texture {} from {}: {}", normalized_path, bsa_name, reason);
-                                    if sample_errors.len() < 10 {
-                                        sample_errors.push((format!("{} ({})", normalized_path, bsa_name), reason));
-                                    }
-                                }
-
-                                textures.insert(normalized_path, record);
-                            } else {
+                            if let Some(existing) = textures.get_mut(&normalized_path) {
                                 // Increment conflict count
-                                if let Some(existing) = textures.get_mut(&normalized_path) {
-                                    existing.conflict_count += 1;
-                                }
+                                existing.conflict_count += 1;
+                            } else {
+                                candidates.push((normalized_path, file));
+                            }
+                        }
+                    }
+
+                    let headers: Vec<_> = candidates
+                        .par_iter()
+                        .map(|(_, file)| Self::read_bsa_header(file))
+                        .collect();
+
+                    for ((normalized_path, file), header) in candidates.into_iter().zip(headers) {
+                        texture_count += 1;
+
+                        let mut record = TextureRecord::from_bsa_file(
+                            normalized_path.clone(),
+                            Arc::clone(&shared_bsa_path),
+                            Arc::clone(&bsa_name),
+                            file.len() as u64,
+                        );
+
+                        // Classify texture type
+                        record.texture_type = Self::classify_texture(&normalized_path);
+
+                        let parse_failed_reason = match header {
+                            Ok(header) => {
+                                record.set_header(&header);
+                                headers_parsed += 1;
+                                None
+                            }
+                            Err(HeaderFailure::TooSmall(reason)) => {
+                                too_small += 1;
+                                Some(reason)
+                            }
+                            Err(HeaderFailure::Parse(reason)) => {
+                                parse_failed += 1;
+                                Some(reason)
+                            }
+                            Err(HeaderFailure::Decompress(reason)) => {
+                                decompress_failed += 1;
+                                Some(reason)
+                            }
+                        };
+
+                        if let Some(reason) = parse_failed_reason {
+                            debug!("Failed to parse BSA texture {} from {}: {}", normalized_path, bsa_name, reason);
+                            if sample_errors.len() < 10 {
+                                sample_errors.push((format!("{} ({})", normalized_path, bsa_name), reason));
                             }
                         }
+
+                        textures.insert(normalized_path, record);
                     }
                 }
                 Err(e) => {
@@ -314,40 +304,51 @@ impl TextureDiscoveryService {
 
     /// Parse DDS headers for all textures
     /// Updates width, height, and format fields
-    pub fn parse_dds_headers(textures: &mut HashMap<String, TextureRecord>) -> Result<()> {
+    /// Loose files are read in parallel, first header bytes only, unless the VFS index
+    /// already has their header; new headers are saved to it. BSA textures already got
+    /// theirs in `discover_from_bsas`.
+    pub fn parse_dds_headers(
+        vfs: &VirtualFileSystem,
+        textures: &mut HashMap<String, TextureRecord>,
+    ) -> Result<()> {
         info!("Parsing DDS headers for {} textures...", textures.len());
         let start_time = std::time::Instant::now();
 
-        let mut parsed = 0;
-        let mut failed = 0;
-
-        for record in textures.values_mut() {
-            // Only parse loose files for now (BSA streaming comes later)
-            if record.source == "loose" {
-                if let Ok(mut file) = File::open(&record.actual_path) {
-                    match dds::parse_dds_header(&mut file) {
-                        Ok(header) => {
-                            record.width = Some(header.width);
-                            record.height = Some(header.height);
-                            record.format = Some(header.format);
-                            parsed += 1;
-                        }
-                        Err(e) => {
-                            debug!(
-                                "Failed to parse DDS header for {}: {}",
-                                record.internal_path, e
-                            );
-                            failed += 1;
-                        }
+        let loose = textures.values().filter(|record| record.is_loose()).count();
+        let results: Vec<(&Path, Option<dds::DDSHeader>)> = textures
+            .par_iter_mut()
+            .filter(|(_, record)| record.is_loose() && !record.has_header_info())
+            .filter_map(|(_, record)| {
+                let mut file = File::open(&record.actual_path).ok()?;
+                match dds::parse_dds_header(&mut file) {
+                    Ok(header) => {
+                        record.set_header(&header);
+                        Some((&*record.actual_path, Some(header)))
+                    }
+                    Err(e) => {
+                        debug!(
+                            "Failed to parse DDS header for {}: {}",
+                            record.internal_path, e
+                        );
+                        Some((&*record.actual_path, None))
                     }
                 }
-            }
-        }
+            })
+            .collect();
+
+        let parsed = results.iter().filter(|(_, header)| header.is_some()).count();
+        let failed = results.len() - parsed;
+        let cached = loose - results.len();
+        vfs.store_headers(
+            results
+                .iter()
+                .filter_map(|(path, header)| header.as_ref().map(|header| (*path, header))),
+        );
 
         let elapsed = start_time.elapsed();
         info!(
-            "Parsed {} DDS headers ({} failed) in {:.2?}",
-            parsed, failed, elapsed
+            "Parsed {} DDS headers ({} failed, {} from the VFS index) in {:.2?}",
+            parsed, failed, cached, elapsed
         );
 
         Ok(())
@@ -360,7 +361,7 @@ impl TextureDiscoveryService {
         stats.total = textures.len();
 
         for record in textures.values() {
-            if record.source == "loose" {
+            if record.is_loose() {
                 stats.loose += 1;
             } else {
                 stats.bsa += 1;
@@ -371,7 +372,7 @@ impl TextureDiscoveryService {
 
                 // Count by format
                 if let Some(format) = &record.format {
-                    *stats.by_format.entry(format.clone()).or_insert(0) += 1;
+                    *stats.by_format.entry(format.to_string()).or_insert(0) += 1;
                 }
 
                 // Count by resolution
@@ -382,7 +383,7 @@ impl TextureDiscoveryService {
 
             // Count by texture type
             if let Some(texture_type) = &record.texture_type {
-                *stats.by_type.entry(texture_type.clone()).or_insert(0) += 1;
+                *stats.by_type.entry(texture_type.to_string()).or_insert(0) += 1;
             }
         }
 
@@ -439,3 +440,19 @@ impl std::fmt::Display for TextureStats {
         Ok(())
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_decompress_prefix_deflate() {
+        let data: Vec<u8> = (0..100_000u32).map(|i| (i * 7 % 251) as u8).collect();
+        let mut encoder = flate2::write::ZlibEncoder::new(Vec::new(), flate2::Compression::default());
+        encoder.write_all(&data).unwrap();
+        let compressed = encoder.finish().unwrap();
+
+        let prefix = TextureDiscoveryService::decompress_prefix(&compressed, dds::MAX_HEADER_SIZE).unwrap();
+        assert_eq!(prefix, data[..dds::MAX_HEADER_SIZE]);
+    }
+}
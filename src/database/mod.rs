@@ -3,5 +3,5 @@
 pub mod texture_record;
 pub mod discovery;
 
-pub use texture_record::TextureRecord;
+pub use texture_record::{intern, TextureRecord};
 pub use discovery::TextureDiscoveryService;
@@ -1,16 +1,33 @@
-use std::path::PathBuf;
+use std::collections::HashSet;
+use std::path::Path;
+use std::sync::{Arc, Mutex, OnceLock};
+
+/// Shared copy of `value`, so strings repeated across hundreds of thousands of records
+/// (source names, formats) are stored once
+pub fn intern(value: &str) -> Arc<str> {
+    static POOL: OnceLock<Mutex<HashSet<Arc<str>>>> = OnceLock::new();
+    let mut pool = POOL.get_or_init(|| Mutex::new(HashSet::new())).lock().unwrap();
+    if let Some(shared) = pool.get(value) {
+        return Arc::clone(shared);
+    }
+    let shared: Arc<str> = Arc::from(value);
+    pool.insert(Arc::clone(&shared));
+    shared
+}
 
 /// Represents a single texture in the game
+/// Cloning is cheap apart from `internal_path`: paths, sources and formats are shared
+/// (every texture from one BSA points at the same archive path and name).
 #[derive(Debug, Clone)]
 pub struct TextureRecord {
     /// Internal path (e.g., "textures/actors/character/female/femalebody_1.dds")
     pub internal_path: String,
 
     /// Actual file path (for loose files) or BSA path (for archived files)
-    pub actual_path: PathBuf,
+    pub actual_path: Arc<Path>,
 
     /// Source: either "loose", BSA name, or "Vanilla"
-    pub source: String,
+    pub source: Arc<str>,
 
     /// File size in bytes
     pub file_size: u64,
@@ -21,11 +38,15 @@ pub struct TextureRecord {
     /// Height in pixels (parsed from DDS header)
     pub height: Option<u32>,
 
-    /// Format (BC1, BC3, BC7, etc.)
-    pub format: Option<String>,
+    /// Format (BC1, BC3, BC7, etc.), interned
+    pub format: Option<Arc<str>>,
+
+    /// sRGB flag from the DX10 header's DXGI format (None for legacy headers,
+    /// which don't declare a color space)
+    pub srgb: Option<bool>,
 
     /// Texture type (will be classified later: diffuse, normal, etc.)
-    pub texture_type: Option<String>,
+    pub texture_type: Option<&'static str>,
 
     /// Number of lower-priority mods that also provide this texture
     pub conflict_count: usize,
@@ -33,25 +54,27 @@ pub struct TextureRecord {
 
 impl TextureRecord {
     /// Create a new texture record for a loose file
-    pub fn from_loose_file(internal_path: String, file_path: PathBuf, file_size: u64) -> Self {
+    pub fn from_loose_file(internal_path: String, file_path: impl Into<Arc<Path>>, file_size: u64) -> Self {
         Self {
             internal_path,
-            actual_path: file_path,
-            source: "loose".to_string(),
+            actual_path: file_path.into(),
+            source: intern("loose"),
             file_size,
             width: None,
             height: None,
             format: None,
+            srgb: None,
             texture_type: None,
             conflict_count: 0,
         }
     }
 
     /// Create a new texture record for a BSA file
+    /// `bsa_path` and `bsa_name` are shared by every record from the archive
     pub fn from_bsa_file(
         internal_path: String,
-        bsa_path: PathBuf,
-        bsa_name: String,
+        bsa_path: Arc<Path>,
+        bsa_name: Arc<str>,
         file_size: u64,
     ) -> Self {
         Self {
@@ -62,11 +85,25 @@ impl TextureRecord {
             width: None,
             height: None,
             format: None,
+            srgb: None,
             texture_type: None,
             conflict_count: 0,
         }
     }
 
+    /// Loose file in a mod or the Data directory, not in a BSA
+    pub fn is_loose(&self) -> bool {
+        &*self.source == "loose"
+    }
+
+    /// Set the header fields from a parsed DDS header
+    pub fn set_header(&mut self, header: &crate::dds::DDSHeader) {
+        self.width = Some(header.width);
+        self.height = Some(header.height);
+        self.format = Some(intern(&header.format));
+        self.srgb = header.srgb;
+    }
+
     /// Check if DDS header has been parsed
     pub fn has_header_info(&self) -> bool {
         self.width.is_some() && self.height.is_some() && self.format.is_some()
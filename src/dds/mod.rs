@@ -2,4 +2,4 @@
 
 pub mod parser;
 
-pub use parser::{DDSHeader, parse_dds_header};
+pub use parser::{DDSHeader, parse_dds_header, MAX_HEADER_SIZE};
@@ -7,6 +7,10 @@ const DDS_MAGIC: u32 = 0x20534444; // "DDS " in ASCII
 const DDS_HEADER_SIZE: usize = 124;
 const DX10_HEADER_SIZE: usize = 20;
 
+/// Bytes at the start of a DDS file that `parse_dds_header` looks at: magic, header
+/// and DX10 extension
+pub const MAX_HEADER_SIZE: usize = 4 + DDS_HEADER_SIZE + DX10_HEADER_SIZE;
+
 // DDS_PIXELFORMAT flags
 const DDPF_FOURCC: u32 = 0x0000_0004;
 
@@ -39,6 +43,9 @@ const DXGI_FORMAT_BC6H_UF16: u32 = 95;
 const DXGI_FORMAT_BC6H_SF16: u32 = 96;
 const DXGI_FORMAT_BC7_UNORM: u32 = 98;
 const DXGI_FORMAT_BC7_UNORM_SRGB: u32 = 99;
+const DXGI_FORMAT_R8G8B8A8_UNORM_SRGB: u32 = 29;
+const DXGI_FORMAT_B8G8R8A8_UNORM_SRGB: u32 = 91;
+const DXGI_FORMAT_B8G8R8X8_UNORM_SRGB: u32 = 93;
 
 /// DDS texture header information
 #[derive(Debug, Clone, PartialEq, Eq)]
@@ -46,6 +53,9 @@ pub struct DDSHeader {
     pub width: u32,
     pub height: u32,
     pub format: String,
+    /// Whether the DX10 DXGI format is an sRGB variant
+    /// None for legacy FourCC headers, which don't declare a color space
+    pub srgb: Option<bool>,
 }
 
 /// Parse DDS header from a stream (file or BSA file entry)
@@ -53,7 +63,7 @@ pub struct DDSHeader {
 /// Based on Microsoft DDS format specification
 pub fn parse_dds_header<R: Read + Seek>(stream: &mut R) -> Result<DDSHeader> {
     // Read header bytes (128 bytes standard + 20 bytes DX10 if present)
-    let mut header_buffer = vec![0u8; 148];
+    let mut header_buffer = vec![0u8; MAX_HEADER_SIZE];
     stream.seek(SeekFrom::Start(0))?;
     let bytes_read = stream.read(&mut header_buffer)?;
 
@@ -96,6 +106,15 @@ pub fn parse_dds_header<R: Read + Seek>(stream: &mut R) -> Result<DDSHeader> {
     // Read dwFourCC (offset 84)
     let fourcc = cursor.read_u32::<LittleEndian>()?;
 
+    let is_dx10 = (pixel_format_flags & DDPF_FOURCC) != 0 && fourcc == FOURCC_DX10;
+    let srgb = if is_dx10 && bytes_read >= 132 {
+        Some(is_srgb_dxgi(u32::from_le_bytes([
+            header_buffer[128], header_buffer[129], header_buffer[130], header_buffer[131],
+        ])))
+    } else {
+        None
+    };
+
     // Determine format based on FourCC
     let format = if (pixel_format_flags & DDPF_FOURCC) != 0 {
         match fourcc {
@@ -118,9 +137,24 @@ pub fn parse_dds_header<R: Read + Seek>(stream: &mut R) -> Result<DDSHeader> {
         width,
         height,
         format,
+        srgb,
     })
 }
 
+/// DXGI formats that store sRGB-encoded color
+fn is_srgb_dxgi(dxgi_format: u32) -> bool {
+    matches!(
+        dxgi_format,
+        DXGI_FORMAT_R8G8B8A8_UNORM_SRGB
+            | DXGI_FORMAT_BC1_UNORM_SRGB
+            | DXGI_FORMAT_BC2_UNORM_SRGB
+            | DXGI_FORMAT_BC3_UNORM_SRGB
+            | DXGI_FORMAT_B8G8R8A8_UNORM_SRGB
+            | DXGI_FORMAT_B8G8R8X8_UNORM_SRGB
+            | DXGI_FORMAT_BC7_UNORM_SRGB
+    )
+}
+
 /// Parse DX10 extended header for BC6H, BC7, etc.
 fn parse_dx10_format(dx10_header: &[u8]) -> Result<String> {
     if dx10_header.len() < 4 {
@@ -169,6 +203,32 @@ mod tests {
         assert!(result.is_err());
     }
 
+    #[test]
+    fn test_dx10_srgb() {
+        let mut data = vec![0u8; 148];
+        data[0..4].copy_from_slice(&DDS_MAGIC.to_le_bytes());
+        data[12..16].copy_from_slice(&256u32.to_le_bytes());
+        data[16..20].copy_from_slice(&512u32.to_le_bytes());
+        data[80..84].copy_from_slice(&DDPF_FOURCC.to_le_bytes());
+        data[84..88].copy_from_slice(&FOURCC_DX10.to_le_bytes());
+        data[128..132].copy_from_slice(&DXGI_FORMAT_BC7_UNORM_SRGB.to_le_bytes());
+
+        let header = parse_dds_header(&mut Cursor::new(data.clone())).unwrap();
+        assert_eq!((header.width, header.height), (512, 256));
+        assert_eq!(header.format, "BC7");
+        assert_eq!(header.srgb, Some(true));
+
+        data[128..132].copy_from_slice(&DXGI_FORMAT_BC7_UNORM.to_le_bytes());
+        assert_eq!(parse_dds_header(&mut Cursor::new(data.clone())).unwrap().srgb, Some(false));
+
+        data[128..132].copy_from_slice(&DXGI_FORMAT_B8G8R8X8_UNORM_SRGB.to_le_bytes());
+        assert_eq!(parse_dds_header(&mut Cursor::new(data.clone())).unwrap().srgb, Some(true));
+
+        // Legacy FourCC headers carry no color space
+        data[84..88].copy_from_slice(&FOURCC_DXT5.to_le_bytes());
+        assert_eq!(parse_dds_header(&mut Cursor::new(data)).unwrap().srgb, None);
+    }
+
     #[test]
     fn test_too_small() {
         let bad_data = vec![0u8; 64];
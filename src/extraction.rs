@@ -3,12 +3,74 @@
 
 use anyhow::Result;
 use log::{debug, info, warn};
+use rayon::prelude::*;
+use std::collections::HashMap;
 use std::fs::{self, File};
 use std::io::{Read, Write};
 use std::path::{Path, PathBuf};
+use std::sync::{Arc, Mutex, OnceLock};
 
 use crate::database::TextureRecord;
 
+/// How source textures reach the optimizer
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum ExtractionMode {
+    /// Write every source texture to the output directory up front
+    Full,
+    /// Only create output directories. Sources are read when each texture is
+    /// processed: archived bytes go straight to the encoder in memory and are
+    /// only written to disk if a backend needs a file (texconv, fallbacks)
+    Deferred,
+}
+
+/// An archive opened for extraction
+/// ba2 memory-maps archives read from a path, so file data is borrowed from the
+/// mapping until it's decompressed and the BSA is never read whole.
+struct OpenArchive {
+    archive: ba2::tes4::Archive<'static>,
+    /// Position of each file in archive order, by lowercased `dir\file` path.
+    /// Directories and files are stored sorted by hash, so this is the order their
+    /// data sits in the BSA.
+    order: HashMap<String, usize>,
+}
+
+impl OpenArchive {
+    fn new(archive: ba2::tes4::Archive<'static>) -> Self {
+        let mut order = HashMap::new();
+        for (dir_key, directory) in archive.iter() {
+            let dir_name = dir_key.name().to_string().to_lowercase();
+            for (file_key, _) in directory.iter() {
+                let file_name = file_key.name().to_string().to_lowercase();
+                let position = order.len();
+                order.insert(format!("{}\\{}", dir_name, file_name), position);
+            }
+        }
+        Self { archive, order }
+    }
+}
+
+/// Archives opened so far, so each BSA index is parsed once per run
+/// instead of once per extracted file
+static ARCHIVES: OnceLock<Mutex<HashMap<PathBuf, Arc<OpenArchive>>>> = OnceLock::new();
+
+fn open_archive(path: &Path) -> Result<Arc<OpenArchive>> {
+    use ba2::Reader;
+
+    let cache = ARCHIVES.get_or_init(|| Mutex::new(HashMap::new()));
+    if let Some(archive) = cache.lock().unwrap().get(path) {
+        return Ok(Arc::clone(archive));
+    }
+
+    // Read outside the lock so other archives can be opened meanwhile
+    let (archive, _options) = ba2::tes4::Archive::read(path)?;
+    let archive = Arc::new(OpenArchive::new(archive));
+    cache
+        .lock()
+        .unwrap()
+        .insert(path.to_path_buf(), Arc::clone(&archive));
+    Ok(archive)
+}
+
 /// Extract texture from BSA or copy from loose file
 pub fn extract_texture(record: &TextureRecord, output_dir: &Path) -> Result<PathBuf> {
     // Create output path preserving internal structure (keep textures/ prefix)
@@ -22,91 +84,113 @@ pub fn extract_texture(record: &TextureRecord, output_dir: &Path) -> Result<Path
     let output_path = output_dir.join(internal_path);
     debug!("extract_texture: output_path = {:?}", output_path);
 
+    extract_texture_to(record, &output_path)?;
+
+    Ok(output_path)
+}
+
+/// Extract texture from BSA or copy from loose file to an exact output path
+pub fn extract_texture_to(record: &TextureRecord, output_path: &Path) -> Result<()> {
     // Create parent directories
     if let Some(parent) = output_path.parent() {
         fs::create_dir_all(parent)?;
     }
 
+    // A previous run may have left a hardlinked duplicate output here; replace
+    // it rather than writing through into the file it shares
+    if output_path.exists() {
+        fs::remove_file(output_path)?;
+    }
+
     // Extract based on source type
-    if record.source == "loose" {
+    if record.is_loose() {
         // Copy loose file
-        fs::copy(&record.actual_path, &output_path)?;
+        fs::copy(&record.actual_path, output_path)?;
         debug!("Copied loose file: {} -> {:?}", record.internal_path, output_path);
     } else {
         // Extract from BSA (source contains BSA filename)
-        extract_from_bsa(record, &output_path)?;
+        let data = read_from_bsa(record)?;
+        let mut output_file = File::create(output_path)?;
+        output_file.write_all(&data)?;
         debug!("Extracted from BSA {}: {} -> {:?}", record.source, record.internal_path, output_path);
     }
 
-    Ok(output_path)
+    Ok(())
 }
 
-/// Extract a single file from BSA archive
-fn extract_from_bsa(record: &TextureRecord, output_path: &Path) -> Result<()> {
-    use ba2::Reader;
+/// Read a texture's DDS bytes from its BSA or loose file without writing anything
+pub fn read_texture_bytes(record: &TextureRecord) -> Result<Vec<u8>> {
+    if record.is_loose() {
+        Ok(fs::read(&record.actual_path)?)
+    } else {
+        read_from_bsa(record)
+    }
+}
 
-    // Open BSA archive
-    let archive_path = &record.actual_path;
-    let (archive, _options) = ba2::tes4::Archive::read(archive_path.as_path())?;
+/// Split an internal path into the BSA directory and file name it's stored under
+fn archive_path_parts(internal_path: &str) -> (String, String) {
+    let internal_clean = internal_path.replace('/', "\\");
+    match internal_clean.rsplit_once('\\') {
+        Some((dir_name, file_name)) => (dir_name.to_string(), file_name.to_string()),
+        None => (String::new(), internal_clean),
+    }
+}
 
-    // Parse internal path to directory and filename
-    let internal_clean = record.internal_path.replace('/', "\\");
-    let parts: Vec<&str> = internal_clean.rsplitn(2, '\\').collect();
+/// Read and decompress a single file from its BSA archive
+fn read_from_bsa(record: &TextureRecord) -> Result<Vec<u8>> {
+    use ba2::tes4::{ArchiveKey, DirectoryKey};
 
-    let (file_name, dir_name) = if parts.len() == 2 {
-        (parts[0], parts[1])
-    } else {
-        (parts[0], "")
+    // Open BSA archive (cached across calls)
+    let archive = open_archive(&record.actual_path)?;
+
+    // Keys are looked up by their BSA hash, which ignores case and separator style
+    let (dir_name, file_name) = archive_path_parts(&record.internal_path);
+    let file = archive
+        .archive
+        .get(&ArchiveKey::from(dir_name))
+        .and_then(|directory| directory.get(&DirectoryKey::from(file_name)));
+    let Some(file) = file else {
+        anyhow::bail!("File not found in BSA: {}", record.internal_path)
     };
 
-    // Find the file in the archive
-    let mut found = false;
-    let dir_name_lower = dir_name.to_lowercase();
-    let file_name_lower = file_name.to_lowercase();
-
-    for (dir_key, directory) in archive.iter() {
-        let dir_name_actual = dir_key.name().to_string().to_lowercase();
-
-        // Case-insensitive comparison
-        if dir_name_actual == dir_name_lower {
-            for (file_key, file) in directory.iter() {
-                let file_name_actual = file_key.name().to_string().to_lowercase();
-
-                if file_name_actual == file_name_lower {
-                    // Found the file - extract it
-                    let data = if file.is_decompressed() {
-                        file.as_bytes().to_vec()
-                    } else {
-                        // Try standard decompression first
-                        match file.decompress(&Default::default()) {
-                            Ok(decompressed) => decompressed.as_bytes().to_vec(),
-                            Err(_) => {
-                                // Try LZ4 fallback
-                                try_lz4_decompress(file.as_bytes())?
-                            }
-                        }
-                    };
-
-                    // Write to output file
-                    let mut output_file = File::create(output_path)?;
-                    output_file.write_all(&data)?;
-
-                    found = true;
-                    break;
-                }
+    let data = if file.is_decompressed() {
+        file.as_bytes().to_vec()
+    } else {
+        // Try standard decompression first
+        match file.decompress(&Default::default()) {
+            Ok(decompressed) => decompressed.as_bytes().to_vec(),
+            Err(_) => {
+                // Try LZ4 fallback
+                try_lz4_decompress(file.as_bytes())?
             }
         }
+    };
 
-        if found {
-            break;
-        }
-    }
+    Ok(data)
+}
 
-    if !found {
-        anyhow::bail!("File not found in BSA: {}", record.internal_path);
+/// Sort key placing a texture's data in storage order: loose files first, then each
+/// archive's files in the order they sit in it. Reading textures in this order walks
+/// every archive mapping front to back instead of seeking around it.
+pub fn storage_order(record: &TextureRecord) -> (Option<Arc<Path>>, usize) {
+    if record.is_loose() {
+        return (None, 0);
     }
+    let archive = open_archive(&record.actual_path).ok();
+    archive_order(record, archive.as_ref().map(|archive| &archive.order))
+}
 
-    Ok(())
+/// `storage_order` of an archived texture, given its archive's file order (None if
+/// the archive can't be opened). Files the archive doesn't list sort after the rest.
+fn archive_order(record: &TextureRecord, order: Option<&HashMap<String, usize>>) -> (Option<Arc<Path>>, usize) {
+    let position = order
+        .and_then(|order| {
+            let (dir_name, file_name) = archive_path_parts(&record.internal_path);
+            let path = format!("{}\\{}", dir_name, file_name).to_lowercase();
+            order.get(&path).copied()
+        })
+        .unwrap_or(usize::MAX);
+    (Some(Arc::clone(&record.actual_path)), position)
 }
 
 /// Try LZ4 decompression as fallback
@@ -120,40 +204,63 @@ fn try_lz4_decompress(compressed_data: &[u8]) -> Result<Vec<u8>> {
 }
 
 /// Extract all textures that need optimization
+/// In Deferred mode nothing is extracted yet: output directories are created and any
+/// stale output from a previous run is removed, so a missing output file reliably
+/// means "not extracted"
+/// Textures are handled in parallel and returned in storage order (`storage_order`),
+/// which is also the order that reads their sources sequentially later.
 pub fn extract_all_textures(
     textures: &[(String, TextureRecord, u32, u32)],
     output_dir: &Path,
+    mode: ExtractionMode,
 ) -> Result<Vec<(String, TextureRecord, u32, u32, PathBuf)>> {
-    info!("Extracting {} textures to {:?}...", textures.len(), output_dir);
+    match mode {
+        ExtractionMode::Full => info!("Extracting {} textures to {:?}...", textures.len(), output_dir),
+        ExtractionMode::Deferred => info!(
+            "Preparing {} textures in {:?} (sources read on demand)...",
+            textures.len(),
+            output_dir
+        ),
+    }
 
     // Create output directory
     fs::create_dir_all(output_dir)?;
 
     let start_time = std::time::Instant::now();
-    let mut extracted = Vec::new();
-    let mut failed = 0;
-
-    for (internal_path, record, target_width, target_height) in textures {
-        match extract_texture(record, output_dir) {
-            Ok(extracted_path) => {
-                extracted.push((
-                    internal_path.clone(),
-                    record.clone(),
-                    *target_width,
-                    *target_height,
-                    extracted_path,
-                ));
-            }
-            Err(e) => {
-                warn!("Failed to extract {}: {}", internal_path, e);
-                failed += 1;
-            }
-        }
-    }
+
+    let mut ordered: Vec<_> = textures.iter().collect();
+    ordered.sort_by_cached_key(|(_, record, _, _)| storage_order(record));
+
+    let results: Vec<_> = ordered
+        .par_iter()
+        .map(|(internal_path, record, target_width, target_height)| {
+            let result = match mode {
+                ExtractionMode::Full => extract_texture(record, output_dir),
+                ExtractionMode::Deferred => prepare_output(record, output_dir),
+            };
+            result
+                .map(|extracted_path| {
+                    (
+                        internal_path.clone(),
+                        record.clone(),
+                        *target_width,
+                        *target_height,
+                        extracted_path,
+                    )
+                })
+                .map_err(|e| {
+                    warn!("Failed to extract {}: {}", internal_path, e);
+                })
+        })
+        .collect();
+
+    let failed = results.iter().filter(|result| result.is_err()).count();
+    let extracted: Vec<_> = results.into_iter().filter_map(|result| result.ok()).collect();
 
     let elapsed = start_time.elapsed();
     info!(
-        "Extracted {} textures ({} failed) in {:.2?}",
+        "{} {} textures ({} failed) in {:.2?}",
+        if mode == ExtractionMode::Full { "Extracted" } else { "Prepared" },
         extracted.len(),
         failed,
         elapsed
@@ -161,3 +268,72 @@ pub fn extract_all_textures(
 
     Ok(extracted)
 }
+
+/// Create the output directory for a deferred texture and clear any stale output
+fn prepare_output(record: &TextureRecord, output_dir: &Path) -> Result<PathBuf> {
+    let output_path = output_dir.join(&record.internal_path);
+
+    if let Some(parent) = output_path.parent() {
+        fs::create_dir_all(parent)?;
+    }
+    if output_path.exists() {
+        fs::remove_file(&output_path)?;
+    }
+
+    Ok(output_path)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_storage_order() {
+        let archived = |internal_path: &str, bsa: &str| {
+            let bsa_path: Arc<Path> = Path::new(bsa).into();
+            TextureRecord::from_bsa_file(internal_path.to_string(), bsa_path, bsa.into(), 0)
+        };
+        let order: HashMap<String, usize> = [
+            ("textures\\armor\\iron\\cuirass.dds", 0),
+            ("textures\\armor\\iron\\helmet.dds", 1),
+            ("textures\\clutter\\bucket.dds", 2),
+        ]
+        .into_iter()
+        .map(|(path, position)| (path.to_string(), position))
+        .collect();
+
+        // Internal paths match whatever their case and separators
+        let helmet = archived("Textures/Armor/Iron/Helmet.dds", "b.bsa");
+        assert_eq!(archive_order(&helmet, Some(&order)), (Some(Path::new("b.bsa").into()), 1));
+        let missing = archived("textures/armor/iron/boots.dds", "b.bsa");
+        assert_eq!(archive_order(&missing, Some(&order)).1, usize::MAX);
+        assert_eq!(archive_order(&helmet, None).1, usize::MAX);
+
+        // Loose files first, then archive by archive, each in its own order
+        let mut keys = vec![
+            archive_order(&archived("textures/clutter/bucket.dds", "b.bsa"), Some(&order)),
+            archive_order(&helmet, Some(&order)),
+            archive_order(&archived("textures/armor/iron/cuirass.dds", "a.bsa"), Some(&order)),
+            storage_order(&TextureRecord::from_loose_file("textures/x.dds".into(), Path::new("x.dds"), 0)),
+            archive_order(&archived("textures/armor/iron/cuirass.dds", "b.bsa"), Some(&order)),
+        ];
+        keys.sort();
+        let sorted: Vec<_> = keys
+            .iter()
+            .map(|(archive, position)| (archive.as_deref().and_then(|p| p.to_str()), *position))
+            .collect();
+        assert_eq!(
+            sorted,
+            [(None, 0), (Some("a.bsa"), 0), (Some("b.bsa"), 0), (Some("b.bsa"), 1), (Some("b.bsa"), 2)]
+        );
+    }
+
+    #[test]
+    fn test_read_loose_texture_bytes() {
+        let dir = tempfile::tempdir().unwrap();
+        let path = dir.path().join("x.dds");
+        fs::write(&path, b"DDS bytes").unwrap();
+        let record = TextureRecord::from_loose_file("textures/x.dds".into(), path.as_path(), 9);
+        assert_eq!(read_texture_bytes(&record).unwrap(), b"DDS bytes");
+    }
+}
@@ -1,5 +1,6 @@
 /// Worker thread for running optimization in background
 use super::{AppSettings, ControlMessage, WorkerMessage};
+use crate::cache::{OutputCache, DEFAULT_CACHE_SIZE_MB};
 use crate::{database, exclusions, extraction, mo2, optimization, presets};
 use crossbeam_channel::{Receiver, Sender};
 use std::path::PathBuf;
@@ -181,7 +182,7 @@ impl OptimizationWorker {
         database::TextureDiscoveryService::discover_from_bsas(&bsa_files, &mut textures)?;
 
         let _ = tx.send(WorkerMessage::Log("Parsing DDS headers...".to_string()));
-        database::TextureDiscoveryService::parse_dds_headers(&mut textures)?;
+        database::TextureDiscoveryService::parse_dds_headers(&vfs, &mut textures)?;
 
         let _ = tx.send(WorkerMessage::Log(format!(
             "Discovered {} total textures",
@@ -294,14 +295,19 @@ impl OptimizationWorker {
         let _ = tx.send(WorkerMessage::Log("Step 6/6: Extracting and optimizing textures...".to_string()));
         let _ = tx.send(WorkerMessage::Log(format!("Extracting {} textures...", needs_optimization.len())));
 
-        let extracted = extraction::extract_all_textures(&needs_optimization, &output_dir)?;
+        // Deferred: archived sources are read during optimization, never staged on disk
+        let extracted = extraction::extract_all_textures(
+            &needs_optimization,
+            &output_dir,
+            extraction::ExtractionMode::Deferred,
+        )?;
 
         if extracted.is_empty() {
             let _ = tx.send(WorkerMessage::Log("No textures were successfully extracted".to_string()));
             return Ok(());
         }
 
-        let _ = tx.send(WorkerMessage::Log(format!("Extracted {} textures", extracted.len())));
+        let _ = tx.send(WorkerMessage::Log(format!("Prepared {} textures", extracted.len())));
 
         // Group by processing type
         let groups = optimization::group_by_processing_type(extracted);
@@ -369,15 +375,24 @@ impl OptimizationWorker {
         });
         let _ = tx.send(WorkerMessage::Log(format!("Running {} optimization...", backend.name())));
 
-        let stats = optimization::optimize_all(&groups, &tools, backend, Some(settings.thread_count))?;
+        // Unchanged textures are restored from the shared output cache
+        let cache = match OutputCache::open(&OutputCache::default_dir(), DEFAULT_CACHE_SIZE_MB << 20) {
+            Ok(cache) => Some(cache),
+            Err(e) => {
+                let _ = tx.send(WorkerMessage::Log(format!("Output cache unavailable: {}", e)));
+                None
+            }
+        };
+
+        let stats = optimization::optimize_all(&groups, &tools, backend, Some(settings.thread_count), cache.as_ref(), None, None)?;
 
         let _ = tx.send(WorkerMessage::Log(format!(
             "Optimization complete in {:.2?}",
             stats.duration
         )));
         let _ = tx.send(WorkerMessage::Log(format!(
-            "Optimized: {}, Deleted: {}, Failed: {}",
-            stats.optimized, stats.deleted, stats.failed
+            "Optimized: {} ({} from cache, {} deduplicated), Deleted: {}, Failed: {}",
+            stats.optimized, stats.cached, stats.deduplicated, stats.deleted, stats.failed
         )));
         let _ = tx.send(WorkerMessage::Log(format!(
             "Output directory: {:?}",
@@ -7,7 +7,9 @@ mod exclusions;
 mod texconv;
 mod presets;
 mod extraction;
+mod cache;
 mod optimization;
+mod radium_encode;
 mod gui;
 mod game;
 
@@ -126,6 +128,43 @@ enum Commands {
         /// Compression backend (nvtt3 = fast native CUDA, texconv = original Wine-based)
         #[arg(long, value_enum, default_value = "nvtt3")]
         backend: optimization::CompressionBackend,
+
+        /// Output cache directory (default: ~/.cache/radium-textures/outputs)
+        #[arg(long)]
+        cache_dir: Option<PathBuf>,
+
+        /// Size bound for the output cache, in MB
+        #[arg(long, default_value_t = cache::DEFAULT_CACHE_SIZE_MB)]
+        cache_size_mb: u64,
+
+        /// Encode every texture, without reading or filling the output cache
+        #[arg(long)]
+        no_cache: bool,
+
+        /// Pack the optimized textures into BSA archives (each with an empty plugin
+        /// that loads it) instead of leaving them as loose files
+        #[arg(long)]
+        pack_bsa: bool,
+
+        /// LZ4-compress textures packed with --pack-bsa
+        #[arg(long, requires = "pack_bsa")]
+        compress_bsa: bool,
+
+        /// Encode BC3/BC7 textures whose source is fully opaque as BC1, at half
+        /// the size (NVTT3 batch server only)
+        #[arg(long)]
+        auto_bc1: bool,
+
+        /// Encode in this process through libradium_encode.so instead of an
+        /// nvtt_batch_compress server; faster to feed, but a crash in NVTT or the
+        /// driver ends the run instead of failing one texture
+        #[arg(long)]
+        in_process: bool,
+
+        /// Wall-clock target for the whole run, in minutes: each texture's encoder
+        /// quality is picked by its importance and the throughput so far to finish on time
+        #[arg(long)]
+        time_budget: Option<u64>,
     },
 }
 
@@ -175,8 +214,13 @@ fn main() -> Result<()> {
         Some(Commands::Filter { profile, mods, data, preset }) => {
             filter_textures(profile, mods, data, preset)?;
         }
-        Some(Commands::Optimize { profile, mods, data, output, preset, backend }) => {
-            optimize_textures(profile, mods, data, output, preset, backend)?;
+        Some(Commands::Optimize { profile, mods, data, output, preset, backend, cache_dir, cache_size_mb, no_cache, pack_bsa, compress_bsa, auto_bc1, in_process, time_budget }) => {
+            let cache_dir = if no_cache {
+                None
+            } else {
+                Some(cache_dir.unwrap_or_else(cache::OutputCache::default_dir))
+            };
+            optimize_textures(profile, mods, data, output, preset, backend, cache_dir, cache_size_mb, pack_bsa, compress_bsa, auto_bc1, in_process, time_budget)?;
         }
     }
 
@@ -431,7 +475,7 @@ fn discover_textures(profile_path: PathBuf, mods_dir: PathBuf, data_dir: PathBuf
 
     // Parse DDS headers
     info!("\n=== Step 3: Parsing DDS Headers ===");
-    database::TextureDiscoveryService::parse_dds_headers(&mut textures)?;
+    database::TextureDiscoveryService::parse_dds_headers(&vfs, &mut textures)?;
 
     // Show statistics
     info!("\n{}", database::TextureDiscoveryService::get_statistics(&textures));
@@ -496,7 +540,7 @@ fn filter_textures(profile_path: PathBuf, mods_dir: PathBuf, data_dir: PathBuf,
     let mut textures = database::TextureDiscoveryService::discover_from_vfs(&vfs);
     let bsa_files = vfs.profile().get_plugin_bsas();
     database::TextureDiscoveryService::discover_from_bsas(&bsa_files, &mut textures)?;
-    database::TextureDiscoveryService::parse_dds_headers(&mut textures)?;
+    database::TextureDiscoveryService::parse_dds_headers(&vfs, &mut textures)?;
 
     info!("Total textures discovered: {}", textures.len());
 
@@ -579,10 +623,10 @@ fn filter_textures(profile_path: PathBuf, mods_dir: PathBuf, data_dir: PathBuf,
 
     // Break down by texture type
     info!("\n=== Optimization Needed by Type ===");
-    let mut by_type: std::collections::HashMap<String, usize> = std::collections::HashMap::new();
+    let mut by_type: std::collections::HashMap<&str, usize> = std::collections::HashMap::new();
     for (_path, record, _tw, _th) in &needs_optimization {
-        if let Some(texture_type) = &record.texture_type {
-            *by_type.entry(texture_type.clone()).or_insert(0) += 1;
+        if let Some(texture_type) = record.texture_type {
+            *by_type.entry(texture_type).or_insert(0) += 1;
         }
     }
 
@@ -625,7 +669,15 @@ fn optimize_textures(
     output_dir: PathBuf,
     preset: Preset,
     backend: optimization::CompressionBackend,
+    cache_dir: Option<PathBuf>,
+    cache_size_mb: u64,
+    pack_bsa: bool,
+    compress_bsa: bool,
+    auto_bc1: bool,
+    in_process: bool,
+    time_budget_minutes: Option<u64>,
 ) -> Result<()> {
+    let run_start = std::time::Instant::now();
     info!("=== Radium Textures Optimization Pipeline ===");
 
     // Convert CLI preset to optimization preset
@@ -643,6 +695,9 @@ fn optimize_textures(
     info!("  Parallax: {}px", opt_preset.parallax_max);
     info!("  Material: {}px", opt_preset.material_max);
     info!("Output: {:?}", output_dir);
+    if let Some(minutes) = time_budget_minutes {
+        info!("Time budget: {} min", minutes);
+    }
 
     // Step 1: Load profile and discover textures
     info!("\n=== Step 1: Discovering Textures ===");
@@ -652,7 +707,7 @@ fn optimize_textures(
     let mut textures = database::TextureDiscoveryService::discover_from_vfs(&vfs);
     let bsa_files = vfs.profile().get_plugin_bsas();
     database::TextureDiscoveryService::discover_from_bsas(&bsa_files, &mut textures)?;
-    database::TextureDiscoveryService::parse_dds_headers(&mut textures)?;
+    database::TextureDiscoveryService::parse_dds_headers(&vfs, &mut textures)?;
 
     info!("Discovered {} total textures", textures.len());
 
@@ -724,8 +779,13 @@ fn optimize_textures(
     }
 
     // Step 4: Extract textures
+    // Deferred: archived sources are read during optimization, never staged on disk
     info!("\n=== Step 4: Extracting Textures ===");
-    let extracted = extraction::extract_all_textures(&needs_optimization, &output_dir)?;
+    let extracted = extraction::extract_all_textures(
+        &needs_optimization,
+        &output_dir,
+        extraction::ExtractionMode::Deferred,
+    )?;
 
     if extracted.is_empty() {
         info!("No textures were successfully extracted");
@@ -750,7 +810,9 @@ fn optimize_textures(
     info!("\n=== Step 6: Running Texture Optimization ===");
 
     // Find compression tools
-    let tools = optimization::CompressionTools::find();
+    let mut tools = optimization::CompressionTools::find();
+    tools.auto_bc1 = auto_bc1;
+    tools.nvtt3_in_process = in_process;
 
     // Determine which backend to use
     let actual_backend = if tools.is_available(backend) {
@@ -780,18 +842,57 @@ fn optimize_textures(
         info!("  nvcompress: {:?}", path);
     }
 
-    let stats = optimization::optimize_all(&groups, &tools, actual_backend, None)?;
+    // A cache that can't be opened only costs the speedup
+    let cache = cache_dir.and_then(|dir| match cache::OutputCache::open(&dir, cache_size_mb << 20) {
+        Ok(cache) => Some(cache),
+        Err(e) => {
+            info!("Warning: Output cache unavailable at {:?}: {}", dir, e);
+            None
+        }
+    });
+
+    // Archives are named after the output mod, as its plugin would be
+    let packer = if pack_bsa {
+        let name = output_dir
+            .file_name()
+            .map(|n| n.to_string_lossy().into_owned())
+            .unwrap_or_else(|| "Radium Textures".to_string());
+        Some(bsa::BsaWriter::new(&output_dir, &name, compress_bsa)?)
+    } else {
+        None
+    };
+
+    let budget = time_budget_minutes.map(|minutes| optimization::TimeBudget {
+        deadline: run_start + std::time::Duration::from_secs(minutes * 60),
+        preset: opt_preset,
+    });
+
+    let stats = optimization::optimize_all(&groups, &tools, actual_backend, None, cache.as_ref(), packer.as_ref(), budget)?;
+    let archives = match packer {
+        Some(packer) => packer.finish()?,
+        None => Vec::new(),
+    };
 
     // Final summary
     info!("\n=== Optimization Complete ===");
     info!("Duration: {:.2?}", stats.duration);
-    info!("Textures optimized: {}", stats.optimized);
-    info!("Textures deleted (already optimal): {}", stats.deleted);
-    info!("Failed: {}", stats.failed);
     info!(
-        "\nOptimized textures are in: {:?}",
-        output_dir.join("textures")
+        "Textures optimized: {} ({} from cache, {} deduplicated)",
+        stats.optimized, stats.cached, stats.deduplicated
     );
+    info!("Textures deleted (already optimal): {}", stats.deleted);
+    info!("Failed: {}", stats.failed);
+    if archives.is_empty() {
+        info!(
+            "\nOptimized textures are in: {:?}",
+            output_dir.join("textures")
+        );
+    } else {
+        info!("\nOptimized textures are packed in:");
+        for archive in &archives {
+            info!("  {:?}", archive);
+        }
+    }
     info!("Drag and drop this folder into your mod manager!");
 
     Ok(())
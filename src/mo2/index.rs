@@ -0,0 +1,472 @@
+/// Persistent index of the folders the VFS is built from
+/// Walking every mod folder dominates startup on large profiles, especially over network
+/// file systems. The index remembers each folder's tree (every directory's mtime, every
+/// file's size and mtime) and the DDS header fields read from its textures, so a folder
+/// whose directories are all unchanged is taken from the index instead of walked again
+/// and its textures' headers aren't reread.
+/// Adding, removing or renaming a file changes its directory's mtime, which is what
+/// triggers a rescan. A file rewritten in place under the same name leaves its directory
+/// alone, so the files discovery uses are stat'ed again each run (`restat`) and one whose
+/// size or mtime moved loses its cached header.
+
+use anyhow::Result;
+use byteorder::{LittleEndian, ReadBytesExt, WriteBytesExt};
+use log::{debug, info, warn};
+use rayon::prelude::*;
+use std::collections::{HashMap, HashSet};
+use std::ffi::OsStr;
+use std::fs::{self, File};
+use std::io::{BufWriter, Read, Write};
+use std::os::unix::ffi::OsStrExt;
+use std::path::{Path, PathBuf};
+use std::time::SystemTime;
+use walkdir::WalkDir;
+
+use crate::dds::DDSHeader;
+
+/// Bump when the file layout changes; an index of another version is ignored
+const INDEX_VERSION: u32 = 1;
+
+const INDEX_MAGIC: &[u8; 4] = b"RVFI";
+
+/// One file under an indexed folder
+#[derive(Debug, Clone, PartialEq)]
+pub struct IndexedFile {
+    pub size: u64,
+    /// Modification time in nanoseconds since the epoch
+    pub mtime: u64,
+    /// Header fields, once discovery has read them for this size and mtime
+    pub header: Option<DDSHeader>,
+}
+
+/// An indexed folder tree
+#[derive(Debug, Default)]
+struct IndexedRoot {
+    /// Every directory in the tree, relative to the root ("" = the root), with its mtime
+    dirs: Vec<(PathBuf, u64)>,
+    /// Files by path relative to the root
+    files: HashMap<PathBuf, IndexedFile>,
+}
+
+/// Index of folder scans, loaded from and saved to a file in the user cache
+pub struct VfsIndex {
+    path: Option<PathBuf>,
+    roots: HashMap<PathBuf, IndexedRoot>,
+    /// Roots refreshed this run; only these are saved, so removed mods drop out
+    used: HashSet<PathBuf>,
+    dirty: bool,
+}
+
+fn mtime_nanos(modified: std::io::Result<SystemTime>) -> u64 {
+    modified
+        .ok()
+        .and_then(|t| t.duration_since(SystemTime::UNIX_EPOCH).ok())
+        .map_or(0, |d| d.as_nanos() as u64)
+}
+
+fn dir_mtime(path: &Path) -> Option<u64> {
+    let meta = fs::metadata(path).ok()?;
+    meta.is_dir().then(|| mtime_nanos(meta.modified()))
+}
+
+impl IndexedRoot {
+    /// Directories are stat'ed but not read; any difference means the tree changed
+    fn is_current(&self, root: &Path) -> bool {
+        !self.dirs.is_empty()
+            && self
+                .dirs
+                .iter()
+                .all(|(dir, mtime)| dir_mtime(&root.join(dir)) == Some(*mtime))
+    }
+
+    /// Walk `root`, keeping headers from `previous` for files whose size and mtime match
+    fn walk(root: &Path, previous: Option<&IndexedRoot>) -> Self {
+        let mut indexed = IndexedRoot::default();
+        for entry in WalkDir::new(root)
+            .follow_links(false)
+            .into_iter()
+            .filter_map(|e| e.ok())
+        {
+            let Ok(rel_path) = entry.path().strip_prefix(root) else {
+                continue;
+            };
+
+            // Symlinks are indexed as whatever they point to, like Path::is_file does
+            let meta = if entry.path_is_symlink() {
+                fs::metadata(entry.path())
+            } else {
+                entry.metadata().map_err(std::io::Error::from)
+            };
+            let Ok(meta) = meta else {
+                continue;
+            };
+
+            if entry.file_type().is_dir() {
+                indexed.dirs.push((rel_path.to_path_buf(), mtime_nanos(meta.modified())));
+            } else if meta.is_file() {
+                let mut file = IndexedFile {
+                    size: meta.len(),
+                    mtime: mtime_nanos(meta.modified()),
+                    header: None,
+                };
+                if let Some(old) = previous.and_then(|p| p.files.get(rel_path)) {
+                    if (old.size, old.mtime) == (file.size, file.mtime) {
+                        file.header = old.header.clone();
+                    }
+                }
+                indexed.files.insert(rel_path.to_path_buf(), file);
+            }
+        }
+        indexed
+    }
+}
+
+impl VfsIndex {
+    /// Per-user index location (~/.cache/radium-textures/vfs-index.bin on Linux)
+    pub fn default_path() -> PathBuf {
+        dirs::cache_dir()
+            .unwrap_or_else(|| PathBuf::from("."))
+            .join("radium-textures")
+            .join("vfs-index.bin")
+    }
+
+    /// Index kept in memory only, never saved
+    pub fn in_memory() -> Self {
+        Self {
+            path: None,
+            roots: HashMap::new(),
+            used: HashSet::new(),
+            dirty: false,
+        }
+    }
+
+    /// Load the index at `path`; missing, outdated or corrupt indexes start empty
+    pub fn open(path: &Path) -> Self {
+        let mut index = Self::in_memory();
+        index.path = Some(path.to_path_buf());
+
+        match Self::load(path) {
+            Ok(roots) => {
+                debug!("VFS index: loaded {} folders from {:?}", roots.len(), path);
+                index.roots = roots;
+            }
+            Err(e) if path.exists() => warn!("VFS index: ignoring {:?}: {}", path, e),
+            Err(_) => {}
+        }
+        index
+    }
+
+    fn load(path: &Path) -> Result<HashMap<PathBuf, IndexedRoot>> {
+        let file = File::open(path)?;
+        if file.metadata()?.len() == 0 {
+            anyhow::bail!("empty file");
+        }
+        // SAFETY: the index is only ever replaced by rename, never written in place
+        let map = unsafe { memmap2::Mmap::map(&file)? };
+        Self::decode(&map)
+    }
+
+    fn decode(mut data: &[u8]) -> Result<HashMap<PathBuf, IndexedRoot>> {
+        let mut magic = [0u8; 4];
+        data.read_exact(&mut magic)?;
+        let version = data.read_u32::<LittleEndian>()?;
+        if &magic != INDEX_MAGIC || version != INDEX_VERSION {
+            anyhow::bail!("not a version {} index", INDEX_VERSION);
+        }
+
+        let mut roots = HashMap::new();
+        for _ in 0..data.read_u32::<LittleEndian>()? {
+            let root = read_path(&mut data)?;
+            let mut indexed = IndexedRoot::default();
+            for _ in 0..data.read_u32::<LittleEndian>()? {
+                let dir = read_path(&mut data)?;
+                indexed.dirs.push((dir, data.read_u64::<LittleEndian>()?));
+            }
+            for _ in 0..data.read_u32::<LittleEndian>()? {
+                let rel_path = read_path(&mut data)?;
+                let size = data.read_u64::<LittleEndian>()?;
+                let mtime = data.read_u64::<LittleEndian>()?;
+                let header = match data.read_u8()? {
+                    0 => None,
+                    _ => Some(DDSHeader {
+                        width: data.read_u32::<LittleEndian>()?,
+                        height: data.read_u32::<LittleEndian>()?,
+                        format: String::from_utf8(read_bytes(&mut data)?.to_vec())?,
+                        srgb: match data.read_u8()? {
+                            0 => None,
+                            1 => Some(false),
+                            _ => Some(true),
+                        },
+                    }),
+                };
+                indexed.files.insert(rel_path, IndexedFile { size, mtime, header });
+            }
+            roots.insert(root, indexed);
+        }
+        Ok(roots)
+    }
+
+    /// Bring the given folders up to date, walking only those that changed since they
+    /// were indexed (in parallel). Folders that don't exist are left out.
+    pub fn refresh(&mut self, roots: &[PathBuf]) {
+        let start_time = std::time::Instant::now();
+
+        let scans: Vec<(PathBuf, Option<IndexedRoot>)> = roots
+            .par_iter()
+            .filter(|root| root.is_dir())
+            .map(|root| {
+                let previous = self.roots.get(root);
+                match previous {
+                    Some(indexed) if indexed.is_current(root) => (root.clone(), None),
+                    _ => (root.clone(), Some(IndexedRoot::walk(root, previous))),
+                }
+            })
+            .collect();
+
+        let folders = scans.len();
+        let mut rescanned = 0;
+        for (root, scan) in scans {
+            if let Some(scan) = scan {
+                debug!("VFS index: rescanned {:?}", root);
+                rescanned += 1;
+                self.roots.insert(root.clone(), scan);
+            }
+            self.used.insert(root);
+        }
+        // Folders no longer in the profile are dropped from the saved index
+        self.dirty |= rescanned > 0 || self.roots.len() > self.used.len();
+
+        info!(
+            "VFS index: {} folders, {} unchanged, {} rescanned in {:.2?}",
+            folders,
+            folders - rescanned,
+            rescanned,
+            start_time.elapsed()
+        );
+    }
+
+    /// Files under an indexed folder, by path relative to it
+    pub fn files(&self, root: &Path) -> impl Iterator<Item = (&PathBuf, &IndexedFile)> {
+        self.roots.get(root).into_iter().flat_map(|indexed| indexed.files.iter())
+    }
+
+    /// Stat `paths` again (in parallel) and return their entries, updated for files
+    /// rewritten in place since the scan: those take the new size and mtime and drop their
+    /// cached header. None for paths not under an indexed folder or no longer files.
+    pub fn restat(&mut self, paths: &[&Path]) -> Vec<Option<IndexedFile>> {
+        let stats: Vec<Option<(u64, u64)>> = paths
+            .par_iter()
+            .map(|path| {
+                let meta = fs::metadata(path).ok()?;
+                meta.is_file().then(|| (meta.len(), mtime_nanos(meta.modified())))
+            })
+            .collect();
+
+        let mut entries = Vec::with_capacity(paths.len());
+        for (path, stat) in paths.iter().zip(stats) {
+            let found = self.find(path).map(|(r, p)| (r.clone(), p.clone()));
+            let (Some((size, mtime)), Some((root, rel_path))) = (stat, found) else {
+                entries.push(None);
+                continue;
+            };
+            let file = self.roots.get_mut(&root).unwrap().files.get_mut(&rel_path).unwrap();
+            if (file.size, file.mtime) != (size, mtime) {
+                *file = IndexedFile { size, mtime, header: None };
+                self.dirty = true;
+            }
+            entries.push(Some(file.clone()));
+        }
+        entries
+    }
+
+    /// Remember the header read from `path`, for as long as the file is unchanged
+    pub fn set_header(&mut self, path: &Path, header: &DDSHeader) {
+        let Some((root, rel_path)) = self.find(path).map(|(r, p)| (r.clone(), p.clone())) else {
+            return;
+        };
+        let file = self.roots.get_mut(&root).unwrap().files.get_mut(&rel_path).unwrap();
+        if file.header.as_ref() != Some(header) {
+            file.header = Some(header.clone());
+            self.dirty = true;
+        }
+    }
+
+    /// Indexed folder and relative path of `path`
+    fn find(&self, path: &Path) -> Option<(&PathBuf, &PathBuf)> {
+        path.ancestors().skip(1).find_map(|ancestor| {
+            let (root, indexed) = self.roots.get_key_value(ancestor)?;
+            let rel_path = path.strip_prefix(ancestor).ok()?;
+            indexed.files.get_key_value(rel_path).map(|(rel_path, _)| (root, rel_path))
+        })
+    }
+
+    /// Write the index back if anything changed. A no-op for in-memory indexes.
+    pub fn save(&mut self) -> Result<()> {
+        let Some(path) = &self.path else {
+            return Ok(());
+        };
+        if !self.dirty {
+            return Ok(());
+        }
+        if let Some(parent) = path.parent() {
+            fs::create_dir_all(parent)?;
+        }
+
+        // Write via temp + rename so a reader never maps a half-written index
+        let temp = path.with_extension(format!("{}.tmp", std::process::id()));
+        let written = File::create(&temp).map_err(anyhow::Error::from).and_then(|file| {
+            let mut out = BufWriter::new(file);
+            self.encode(&mut out)?;
+            out.flush()?;
+            Ok(())
+        });
+        if let Err(e) = written.and_then(|_| fs::rename(&temp, path).map_err(Into::into)) {
+            let _ = fs::remove_file(&temp);
+            return Err(e);
+        }
+
+        self.dirty = false;
+        debug!("VFS index: saved {} folders to {:?}", self.used.len(), path);
+        Ok(())
+    }
+
+    fn encode<W: Write>(&self, out: &mut W) -> Result<()> {
+        out.write_all(INDEX_MAGIC)?;
+        out.write_u32::<LittleEndian>(INDEX_VERSION)?;
+
+        let roots: Vec<_> = self
+            .roots
+            .iter()
+            .filter(|(root, _)| self.used.contains(*root))
+            .collect();
+        out.write_u32::<LittleEndian>(roots.len() as u32)?;
+        for (root, indexed) in roots {
+            write_bytes(out, root.as_os_str().as_bytes())?;
+            out.write_u32::<LittleEndian>(indexed.dirs.len() as u32)?;
+            for (dir, mtime) in &indexed.dirs {
+                write_bytes(out, dir.as_os_str().as_bytes())?;
+                out.write_u64::<LittleEndian>(*mtime)?;
+            }
+            out.write_u32::<LittleEndian>(indexed.files.len() as u32)?;
+            for (rel_path, file) in &indexed.files {
+                write_bytes(out, rel_path.as_os_str().as_bytes())?;
+                out.write_u64::<LittleEndian>(file.size)?;
+                out.write_u64::<LittleEndian>(file.mtime)?;
+                match &file.header {
+                    None => out.write_u8(0)?,
+                    Some(header) => {
+                        out.write_u8(1)?;
+                        out.write_u32::<LittleEndian>(header.width)?;
+                        out.write_u32::<LittleEndian>(header.height)?;
+                        write_bytes(out, header.format.as_bytes())?;
+                        out.write_u8(match header.srgb {
+                            None => 0,
+                            Some(false) => 1,
+                            Some(true) => 2,
+                        })?;
+                    }
+                }
+            }
+        }
+        Ok(())
+    }
+}
+
+/// Length-prefixed bytes
+fn write_bytes<W: Write>(out: &mut W, bytes: &[u8]) -> Result<()> {
+    out.write_u32::<LittleEndian>(bytes.len() as u32)?;
+    out.write_all(bytes)?;
+    Ok(())
+}
+
+fn read_bytes<'a>(data: &mut &'a [u8]) -> Result<&'a [u8]> {
+    let len = data.read_u32::<LittleEndian>()? as usize;
+    if len > data.len() {
+        anyhow::bail!("truncated");
+    }
+    let (bytes, rest) = data.split_at(len);
+    *data = rest;
+    Ok(bytes)
+}
+
+fn read_path(data: &mut &[u8]) -> Result<PathBuf> {
+    Ok(PathBuf::from(OsStr::from_bytes(read_bytes(data)?)))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    impl VfsIndex {
+        /// Entry for a file under any indexed folder, as last scanned or restat'ed
+        fn lookup(&self, path: &Path) -> Option<&IndexedFile> {
+            self.find(path).map(|(root, rel_path)| &self.roots[root].files[rel_path])
+        }
+    }
+
+    fn header() -> DDSHeader {
+        DDSHeader { width: 512, height: 256, format: "BC7".to_string(), srgb: Some(true) }
+    }
+
+    #[test]
+    fn test_reuse_and_rescan() {
+        let dir = tempfile::tempdir().unwrap();
+        let root = dir.path().join("mod");
+        fs::create_dir_all(root.join("textures/armor")).unwrap();
+        fs::write(root.join("textures/armor/a.dds"), [0u8; 10]).unwrap();
+        let index_path = dir.path().join("index.bin");
+
+        let mut index = VfsIndex::open(&index_path);
+        index.refresh(&[root.clone()]);
+        index.set_header(&root.join("textures/armor/a.dds"), &header());
+        index.save().unwrap();
+
+        // Unchanged: served from the saved index, header included
+        let mut index = VfsIndex::open(&index_path);
+        assert!(index.roots[&root].is_current(&root));
+        index.refresh(&[root.clone()]);
+        assert!(!index.dirty);
+        let file = index.lookup(&root.join("textures/armor/a.dds")).unwrap();
+        assert_eq!((file.size, file.header.clone()), (10, Some(header())));
+
+        // A new file changes its directory's mtime; the rescan keeps the old header
+        fs::write(root.join("textures/armor/b.dds"), [0u8; 20]).unwrap();
+        assert!(!index.roots[&root].is_current(&root));
+        index.refresh(&[root.clone()]);
+        assert_eq!(index.files(&root).count(), 2);
+        assert_eq!(index.lookup(&root.join("textures/armor/b.dds")).unwrap().size, 20);
+        assert!(index.lookup(&root.join("textures/armor/a.dds")).unwrap().header.is_some());
+    }
+
+    #[test]
+    fn test_restat_drops_stale_header() {
+        let dir = tempfile::tempdir().unwrap();
+        let root = dir.path().join("mod");
+        fs::create_dir_all(root.join("textures")).unwrap();
+        let a = root.join("textures/a.dds");
+        let b = root.join("textures/b.dds");
+        fs::write(&a, [0u8; 10]).unwrap();
+        fs::write(&b, [0u8; 10]).unwrap();
+
+        let mut index = VfsIndex::in_memory();
+        index.refresh(&[root.clone()]);
+        index.set_header(&a, &header());
+        index.set_header(&b, &header());
+
+        // Rewritten in place: the directory is untouched, so only a restat sees it
+        let rewritten = fs::OpenOptions::new().write(true).open(&a).unwrap();
+        rewritten.set_len(4096).unwrap();
+        let earlier = SystemTime::UNIX_EPOCH + std::time::Duration::from_secs(1);
+        rewritten.set_modified(earlier).unwrap();
+        drop(rewritten);
+        assert!(index.roots[&root].is_current(&root));
+
+        let outside = dir.path().join("other.dds");
+        let entries = index.restat(&[a.as_path(), b.as_path(), outside.as_path()]);
+        let a_entry = entries[0].as_ref().unwrap();
+        assert_eq!((a_entry.size, a_entry.header.clone()), (4096, None));
+        assert_eq!(entries[1].as_ref().unwrap().header, Some(header()));
+        assert!(entries[2].is_none());
+        assert_eq!(index.lookup(&a).unwrap().size, 4096);
+    }
+}
@@ -1,3 +1,4 @@
+pub mod index;
 pub mod profile;
 pub mod vfs;
 
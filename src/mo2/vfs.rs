@@ -1,10 +1,12 @@
+use super::index::{IndexedFile, VfsIndex};
 use super::profile::{Mod, Profile};
+use crate::dds::DDSHeader;
 use anyhow::Result;
-use log::{debug, info};
+use log::{debug, info, warn};
 use std::collections::HashMap;
 use std::path::{Path, PathBuf};
+use std::sync::Mutex;
 use unicode_normalization::UnicodeNormalization;
-use walkdir::WalkDir;
 
 /// Source of a file in the virtual file system
 #[derive(Debug, Clone)]
@@ -56,14 +58,23 @@ pub struct VirtualFileSystem {
     /// Virtual path is relative to Data/ (e.g., "textures/foo/bar.dds")
     file_map: HashMap<String, FileSource>,
     profile: Profile,
+    /// Scans of the Data directory and mod folders, persisted across runs
+    index: Mutex<VfsIndex>,
 }
 
 impl VirtualFileSystem {
-    /// Build the VFS from an MO2 profile
+    /// Build the VFS from an MO2 profile, rescanning only folders that changed since
+    /// the last run (see `VfsIndex`)
     pub fn new(profile: Profile) -> Result<Self> {
+        Self::with_index(profile, VfsIndex::open(&VfsIndex::default_path()))
+    }
+
+    /// Build the VFS from an MO2 profile using `index` for folder scans
+    pub fn with_index(profile: Profile, index: VfsIndex) -> Result<Self> {
         let mut vfs = Self {
             file_map: HashMap::new(),
             profile,
+            index: Mutex::new(index),
         };
 
         vfs.build_file_map()?;
@@ -74,18 +85,26 @@ impl VirtualFileSystem {
     fn build_file_map(&mut self) -> Result<()> {
         info!("Building VFS file map...");
 
+        // Collect first to avoid borrow checker issues
+        let enabled_mods: Vec<_> = self.profile.enabled_mods().cloned().collect();
+
+        // Bring every folder's scan up to date first, in parallel
+        let mut roots = vec![self.profile.game_data_dir.clone()];
+        roots.extend(enabled_mods.iter().map(|mod_entry| mod_entry.path.clone()));
+        self.index.get_mut().unwrap().refresh(&roots);
+
         // Layer 1: Vanilla game files (lowest priority)
         self.index_vanilla_files()?;
 
         // Layer 2: Enabled mods (top of modlist = highest priority)
         // Higher priority mods are processed first; lower priority mods
         // only insert if no higher-priority file exists for that path
-        // Collect first to avoid borrow checker issues
-        let enabled_mods: Vec<_> = self.profile.enabled_mods().cloned().collect();
         for mod_entry in &enabled_mods {
             self.index_mod_files(mod_entry)?;
         }
 
+        self.save_index();
+
         info!(
             "VFS built with {} unique file entries",
             self.file_map.len()
@@ -103,27 +122,17 @@ impl VirtualFileSystem {
         }
         debug!("Game Data directory found, indexing vanilla files...");
 
+        let index = self.index.get_mut().unwrap();
         let mut count = 0;
-        for entry in WalkDir::new(data_dir)
-            .follow_links(false)
-            .into_iter()
-            .filter_map(|e| e.ok())
-        {
-            let path = entry.path();
-            if !path.is_file() {
-                continue;
-            }
-
-            // Get relative path from Data/
-            if let Ok(rel_path) = path.strip_prefix(data_dir) {
-                let virtual_path = self.normalize_path(rel_path);
-
-                self.file_map.insert(
-                    virtual_path,
-                    FileSource::Vanilla(path.to_path_buf()),
-                );
-                count += 1;
-            }
+        for (rel_path, _) in index.files(data_dir) {
+            // Paths are relative to Data/
+            let virtual_path = Self::normalize_path(rel_path);
+
+            self.file_map.insert(
+                virtual_path,
+                FileSource::Vanilla(data_dir.join(rel_path)),
+            );
+            count += 1;
         }
 
         debug!("Indexed {} vanilla files", count);
@@ -137,41 +146,32 @@ impl VirtualFileSystem {
             return Ok(());
         }
 
+        let index = self.index.get_mut().unwrap();
         let mut count = 0;
-        for entry in WalkDir::new(&mod_entry.path)
-            .follow_links(false)
-            .into_iter()
-            .filter_map(|e| e.ok())
-        {
-            let path = entry.path();
-            if !path.is_file() {
-                continue;
-            }
-
-            // Get relative path from mod root
-            if let Ok(rel_path) = path.strip_prefix(&mod_entry.path) {
-                let virtual_path = self.normalize_path(rel_path);
-
-                // Insert or overwrite - higher priority wins
-                self.file_map
-                    .entry(virtual_path)
-                    .and_modify(|existing| {
-                        if mod_entry.priority > existing.priority() {
-                            *existing = FileSource::Mod {
-                                mod_name: mod_entry.name.clone(),
-                                mod_priority: mod_entry.priority,
-                                file_path: path.to_path_buf(),
-                            };
-                        }
-                    })
-                    .or_insert_with(|| FileSource::Mod {
-                        mod_name: mod_entry.name.clone(),
-                        mod_priority: mod_entry.priority,
-                        file_path: path.to_path_buf(),
-                    });
-
-                count += 1;
-            }
+        for (rel_path, _) in index.files(&mod_entry.path) {
+            // Paths are relative to the mod root
+            let virtual_path = Self::normalize_path(rel_path);
+            let path = mod_entry.path.join(rel_path);
+
+            // Insert or overwrite - higher priority wins
+            self.file_map
+                .entry(virtual_path)
+                .and_modify(|existing| {
+                    if mod_entry.priority > existing.priority() {
+                        *existing = FileSource::Mod {
+                            mod_name: mod_entry.name.clone(),
+                            mod_priority: mod_entry.priority,
+                            file_path: path.clone(),
+                        };
+                    }
+                })
+                .or_insert_with(|| FileSource::Mod {
+                    mod_name: mod_entry.name.clone(),
+                    mod_priority: mod_entry.priority,
+                    file_path: path.clone(),
+                });
+
+            count += 1;
         }
 
         debug!("Indexed {} files from mod: {}", count, mod_entry.name);
@@ -181,7 +181,7 @@ impl VirtualFileSystem {
     /// Normalize a path for case-insensitive comparison
     /// Windows file systems are case-insensitive, so we normalize to lowercase
     /// Also normalize Unicode to NFC form
-    fn normalize_path(&self, path: &Path) -> String {
+    fn normalize_path(path: &Path) -> String {
         path.to_string_lossy()
             .to_lowercase()
             .nfc()
@@ -199,7 +199,7 @@ impl VirtualFileSystem {
     /// Returns Vec of (mod_name, priority, path) sorted by priority (lowest to highest)
     /// This is case-insensitive to handle Linux filesystems
     pub fn get_file_layers(&self, virtual_path: &str) -> Vec<(String, usize, PathBuf)> {
-        let normalized = self.normalize_path(Path::new(virtual_path));
+        let normalized = Self::normalize_path(Path::new(virtual_path));
         let mut layers = Vec::new();
 
         // Search through all indexed files for ones matching this normalized path
@@ -253,6 +253,30 @@ impl VirtualFileSystem {
     pub fn profile(&self) -> &Profile {
         &self.profile
     }
+
+    /// Size, mtime and any cached header of physical files under the Data directory or
+    /// a mod folder, each stat'ed again so a file rewritten in place since its folder was
+    /// scanned doesn't keep its old header
+    pub fn indexed_files(&self, paths: &[&Path]) -> Vec<Option<IndexedFile>> {
+        self.index.lock().unwrap().restat(paths)
+    }
+
+    /// Cache headers read from physical files, so the next run can skip reading them
+    pub fn store_headers<'a>(&self, headers: impl IntoIterator<Item = (&'a Path, &'a DDSHeader)>) {
+        let mut index = self.index.lock().unwrap();
+        for (path, header) in headers {
+            index.set_header(path, header);
+        }
+        drop(index);
+        self.save_index();
+    }
+
+    /// Write the index back; failing to is not fatal, the next run just rescans
+    fn save_index(&self) {
+        if let Err(e) = self.index.lock().unwrap().save() {
+            warn!("Failed to save VFS index: {}", e);
+        }
+    }
 }
 
 #[derive(Debug, Default)]
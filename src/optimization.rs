@@ -4,16 +4,24 @@
 use anyhow::Result;
 use indicatif::{ProgressBar, ProgressStyle};
 use log::{debug, error, info, warn};
+use rayon::iter::Either;
 use rayon::prelude::*;
 use rayon::ThreadPoolBuilder;
 use std::env;
 use std::fs::{self, File};
 use std::io::{BufRead, BufReader, Read, Write};
 use std::path::{Path, PathBuf};
-use std::process::{Command, Stdio};
+use std::process::{Child, ChildStderr, ChildStdin, Command, Stdio};
 use std::sync::atomic::{AtomicUsize, Ordering};
+use std::collections::{HashMap, HashSet};
+use std::sync::{Mutex, OnceLock};
+use std::time::Instant;
 
+use crate::bsa::BsaWriter;
+use crate::cache::{CacheKey, EncodeParams, OutputCache};
 use crate::database::TextureRecord;
+use crate::presets::{Importance, OptimizationPreset};
+use crate::radium_encode::{self, EncodeResult, RadiumEngine};
 
 /// DDS file validation result
 #[derive(Debug)]
@@ -197,6 +205,11 @@ pub struct CompressionTools {
     pub nvtt3_path: Option<PathBuf>,
     pub nvtt3_batch_path: Option<PathBuf>,
     pub nvtt3_lib_path: Option<PathBuf>,
+    /// Encode opaque BC3/BC7 outputs as BC1 (NVTT3 batch server only)
+    pub auto_bc1: bool,
+    /// Run the NVTT3 pipeline in this process through libradium_encode.so
+    /// instead of the server process (see `Nvtt3Server`)
+    pub nvtt3_in_process: bool,
 }
 
 impl CompressionTools {
@@ -217,6 +230,8 @@ impl CompressionTools {
             nvtt3_path,
             nvtt3_batch_path,
             nvtt3_lib_path,
+            auto_bc1: false,
+            nvtt3_in_process: false,
         }
     }
 
@@ -287,6 +302,41 @@ impl CompressionTools {
         (None, None, None)
     }
 
+    /// Identity of the tool build `backend` encodes with, for output cache keys
+    /// Built from the size and mtime of each binary, so rebuilding a tool
+    /// invalidates the outputs it made.
+    pub fn fingerprint(&self, backend: CompressionBackend) -> String {
+        let paths: Vec<PathBuf> = match backend {
+            CompressionBackend::Texconv => self.texconv_path.iter().cloned().collect(),
+            CompressionBackend::Nvtt3 => self
+                .nvtt3_path
+                .iter()
+                .chain(self.nvtt3_batch_path.iter())
+                .cloned()
+                .chain(self.nvtt3_lib_path.iter().map(|dir| dir.join("libnvtt.so")))
+                .chain(self.nvtt3_lib_path.iter().map(|dir| dir.join(radium_encode::LIBRARY_NAME)))
+                .collect(),
+        };
+
+        let mut fingerprint = backend.name().to_string();
+        if let CompressionBackend::Nvtt3 = backend {
+            for flag in nvtt3_output_flags(self.auto_bc1) {
+                fingerprint.push_str(&format!("|{}", flag));
+            }
+        }
+        for path in paths {
+            if let Ok(meta) = fs::metadata(&path) {
+                let mtime = meta
+                    .modified()
+                    .ok()
+                    .and_then(|t| t.duration_since(std::time::UNIX_EPOCH).ok())
+                    .map_or(0, |d| d.as_secs());
+                fingerprint.push_str(&format!("|{}:{}", meta.len(), mtime));
+            }
+        }
+        fingerprint
+    }
+
     /// Check if a backend is available
     pub fn is_available(&self, backend: CompressionBackend) -> bool {
         match backend {
@@ -315,10 +365,440 @@ pub struct ProcessingRecord {
     pub extracted_path: PathBuf,
     pub target_width: u32,
     pub target_height: u32,
-    pub texture_type: String,
+    pub texture_type: &'static str,
     pub current_width: u32,
     pub current_height: u32,
     pub oversized: bool,
+    /// Source has been written to `extracted_path` (false for deferred extraction)
+    pub extracted: bool,
+}
+
+impl ProcessingRecord {
+    /// Tangent-space normal map (`_n` suffix, see `classify_texture`)
+    pub fn is_normal_map(&self) -> bool {
+        self.texture_type == "Normal"
+    }
+}
+
+/// Write a deferred texture's source to `extracted_path` for backends that need a file
+fn ensure_extracted(record: &ProcessingRecord) -> Result<()> {
+    if !record.extracted {
+        crate::extraction::extract_texture_to(&record.record, &record.extracted_path)?;
+    }
+    Ok(())
+}
+
+/// NVTT encoder quality, fastest first
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub enum EncodeQuality {
+    Fastest,
+    Normal,
+    Production,
+    Highest,
+}
+
+impl EncodeQuality {
+    const ALL: [Self; 4] = [Self::Fastest, Self::Normal, Self::Production, Self::Highest];
+
+    /// Name in NVTT3 job lines and output cache keys
+    pub fn name(self) -> &'static str {
+        match self {
+            Self::Fastest => "fastest",
+            Self::Normal => "normal",
+            Self::Production => "production",
+            Self::Highest => "highest",
+        }
+    }
+
+    /// Rough encode time relative to Normal
+    fn cost_weight(self) -> f64 {
+        match self {
+            Self::Fastest => 0.4,
+            Self::Normal => 1.0,
+            Self::Production => 2.5,
+            Self::Highest => 5.0,
+        }
+    }
+
+    /// `steps` levels slower (faster when negative), no slower than `ceiling`
+    fn shifted(self, steps: i32, ceiling: Self) -> Self {
+        Self::ALL[(self as i32 + steps).clamp(0, ceiling as i32) as usize]
+    }
+}
+
+/// Encoder quality both backends run at outside a time budget, part of the output cache key
+const ENCODE_QUALITY: EncodeQuality = EncodeQuality::Normal;
+
+/// Called with each record whose output was written successfully
+type OnEncoded<'a> = &'a (dyn Fn(&ProcessingRecord) + Sync);
+
+/// Cache key for a record's output: its current source bytes plus the encode settings
+fn source_key(
+    record: &ProcessingRecord,
+    format: Option<&str>,
+    tool: &str,
+    quality: EncodeQuality,
+) -> Result<CacheKey> {
+    let params = EncodeParams {
+        tool,
+        format,
+        target_width: record.target_width,
+        target_height: record.target_height,
+        srgb_hint: false,
+        quality: quality.name(),
+        normal_map: record.is_normal_map(),
+    };
+    if record.extracted {
+        CacheKey::from_file(&record.extracted_path, &params)
+    } else if record.record.is_loose() {
+        CacheKey::from_file(&record.record.actual_path, &params)
+    } else {
+        let data = crate::extraction::read_texture_bytes(&record.record)?;
+        Ok(CacheKey::from_bytes(&data, &params))
+    }
+}
+
+/// A group's encoding work once cached outputs and duplicate sources are taken out
+#[derive(Default)]
+struct GroupPlan {
+    /// One record per distinct source, still to be encoded
+    pending: Vec<ProcessingRecord>,
+    /// Cache keys of `pending`, by output path
+    keys: HashMap<PathBuf, CacheKey>,
+    /// Outputs of byte-identical sources, by the pending output they copy
+    duplicates: HashMap<PathBuf, Vec<PathBuf>>,
+    /// Outputs restored from the cache
+    cached: Vec<PathBuf>,
+}
+
+impl GroupPlan {
+    fn duplicate_count(&self) -> usize {
+        self.duplicates.values().map(Vec::len).sum()
+    }
+
+    /// Give every duplicate of the encoded `output` its contents; returns the ones linked
+    fn link_duplicates(&self, output: &Path) -> Vec<PathBuf> {
+        let mut copies = Vec::new();
+        for dest in self.duplicates.get(output).into_iter().flatten() {
+            match link_output(output, dest) {
+                Ok(()) => copies.push(dest.clone()),
+                Err(e) => error!("Failed to link duplicate {:?}: {}", dest, e),
+            }
+        }
+        copies
+    }
+}
+
+/// Rough encode cost of one output pixel in `format`, relative to BC1
+/// BC7 and BC6H search far more partitions/modes per block than the BCn formats
+/// they replace; uncompressed output is little more than a copy.
+fn format_cost_weight(format: &str) -> f64 {
+    match format.to_uppercase().as_str() {
+        f if f.starts_with("BC7") || f.starts_with("BC6") => 8.0,
+        f if f.starts_with("BC3") || f.starts_with("BC2") => 1.5,
+        f if f.starts_with("BC4") => 0.5,
+        f if f.starts_with("BC") => 1.0,
+        _ => 0.25,
+    }
+}
+
+/// Cost of decoding/resizing one source pixel, in the same units as the weights above
+const DECODE_COST_PER_PIXEL: f64 = 0.25;
+
+/// Estimated work for one record: the source is decoded and filtered at full
+/// size, then its whole target mip chain (4/3 of the top level) is encoded
+fn estimated_cost(record: &ProcessingRecord, format: Option<&str>) -> f64 {
+    let format = format.or(record.record.format.as_deref()).unwrap_or("BC7");
+    let source = record.current_width as f64 * record.current_height as f64;
+    let target = record.target_width as f64 * record.target_height as f64 * 4.0 / 3.0;
+    source * DECODE_COST_PER_PIXEL + target * format_cost_weight(format)
+}
+
+/// Order records largest-first (longest processing time first), so the big
+/// textures start while every worker is busy and a run ends on a tail of small
+/// ones instead of a single 8K straggler. Ties keep discovery order.
+fn schedule_by_cost(records: &mut [ProcessingRecord], format: Option<&str>) {
+    // Costs are non-negative, where the bit patterns order like the values
+    records.sort_by_cached_key(|record| std::cmp::Reverse(estimated_cost(record, format).to_bits()));
+}
+
+/// Run `f` on every record on the current pool's threads, each taking the next
+/// record from a shared cursor, so records start in slice order
+/// A plain par_iter splits the slice into ranges up front and only steals whole
+/// ranges, which would give one thread all the largest-first textures.
+fn for_each_in_order<F>(records: &[ProcessingRecord], f: F)
+where
+    F: Fn(&ProcessingRecord) + Sync,
+{
+    let next = AtomicUsize::new(0);
+    rayon::broadcast(|_| loop {
+        let i = next.fetch_add(1, Ordering::Relaxed);
+        match records.get(i) {
+            Some(record) => f(record),
+            None => break,
+        }
+    });
+}
+
+/// Wall-clock target for a run: NVTT3 jobs trade encoder quality to finish by `deadline`
+#[derive(Debug, Clone, Copy)]
+pub struct TimeBudget {
+    pub deadline: Instant,
+    /// Ranks textures by on-screen importance (see `OptimizationPreset::importance`)
+    pub preset: OptimizationPreset,
+}
+
+/// Completed jobs needed before throughput is trusted to re-plan
+const SCHEDULER_MIN_SAMPLES: usize = 16;
+
+/// Range of the level shift applied to every preferred quality
+const SCHEDULER_SHIFTS: std::ops::RangeInclusive<i32> = -3..=1;
+
+/// Picks each NVTT3 job's encoder quality so a run finishes within its `TimeBudget`
+/// Every texture has a preferred quality by importance: Production for close-up
+/// character and gear maps, Fastest for LOD, terrain and maps the preset shrinks to
+/// a quarter of diffuse size, Normal otherwise. As jobs are sent, the throughput
+/// measured so far projects how long the rest would take, and every texture moves
+/// the same number of levels from its preference: the slowest shift that still fits
+/// the time left.
+pub struct QualityScheduler {
+    budget: TimeBudget,
+    state: Mutex<SchedulerState>,
+}
+
+#[derive(Default)]
+struct SchedulerState {
+    /// Estimated cost of the work not yet sent, at Normal quality, by importance
+    remaining: [f64; 3],
+    /// Jobs sent and not finished: cost at Normal and the quality chosen
+    in_flight: HashMap<PathBuf, (f64, EncodeQuality)>,
+    /// Quality-weighted cost of `in_flight`
+    in_flight_cost: f64,
+    /// Quality-weighted cost of finished jobs, and how many there were
+    done: f64,
+    done_jobs: usize,
+    started: Option<Instant>,
+    shift: i32,
+    /// Outputs encoded below their preferred quality, kept out of the output cache
+    downgraded: HashSet<PathBuf>,
+    /// Jobs sent at each quality
+    chosen: [usize; 4],
+}
+
+impl QualityScheduler {
+    /// Budget for every record in `groups`; cached and duplicate records are taken out
+    /// with `remove_work` once each group is planned
+    pub fn new(budget: TimeBudget, groups: &ProcessingGroups) -> Self {
+        let mut state = SchedulerState::default();
+        for (group, format, _) in groups.encode_groups() {
+            for record in group {
+                let importance = budget.preset.importance(record.texture_type, &record.internal_path);
+                state.remaining[importance as usize] += estimated_cost(record, format);
+            }
+        }
+        Self { budget, state: Mutex::new(state) }
+    }
+
+    fn importance(&self, record: &ProcessingRecord) -> Importance {
+        self.budget.preset.importance(record.texture_type, &record.internal_path)
+    }
+
+    /// Quality with time to spare, and the slowest it goes when ahead of schedule
+    fn quality_range(importance: Importance) -> (EncodeQuality, EncodeQuality) {
+        match importance {
+            Importance::High => (EncodeQuality::Production, EncodeQuality::Highest),
+            Importance::Normal => (EncodeQuality::Normal, EncodeQuality::Production),
+            Importance::Low => (EncodeQuality::Fastest, EncodeQuality::Fastest),
+        }
+    }
+
+    /// Quality for `record` with time to spare; what its cache key records
+    fn preferred(&self, record: &ProcessingRecord) -> EncodeQuality {
+        Self::quality_range(self.importance(record)).0
+    }
+
+    /// Quality of `importance` textures with every preference shifted `shift` levels
+    fn level(importance: Importance, shift: i32) -> EncodeQuality {
+        let (preferred, ceiling) = Self::quality_range(importance);
+        preferred.shifted(shift, ceiling)
+    }
+
+    /// Projected cost of everything not yet finished, at shift `shift`
+    fn projected(state: &SchedulerState, shift: i32) -> f64 {
+        let remaining: f64 = [Importance::Low, Importance::Normal, Importance::High]
+            .into_iter()
+            .map(|importance| state.remaining[importance as usize] * Self::level(importance, shift).cost_weight())
+            .sum();
+        remaining + state.in_flight_cost
+    }
+
+    /// Take records that won't be encoded (restored from the cache, or duplicates)
+    /// out of the remaining work
+    fn remove_work<'a>(&self, records: impl Iterator<Item = &'a ProcessingRecord>, format: Option<&str>) {
+        let mut state = self.state.lock().unwrap();
+        for record in records {
+            let remaining = &mut state.remaining[self.importance(record) as usize];
+            *remaining = (*remaining - estimated_cost(record, format)).max(0.0);
+        }
+    }
+
+    /// Quality to send `record` at, re-planning from the throughput measured so far
+    fn choose(&self, record: &ProcessingRecord, format: Option<&str>) -> EncodeQuality {
+        let now = Instant::now();
+        let cost = estimated_cost(record, format);
+        let importance = self.importance(record);
+        let mut state = self.state.lock().unwrap();
+        let started = *state.started.get_or_insert(now);
+        let remaining = &mut state.remaining[importance as usize];
+        *remaining = (*remaining - cost).max(0.0);
+
+        let elapsed = now.duration_since(started).as_secs_f64();
+        if state.done_jobs >= SCHEDULER_MIN_SAMPLES && elapsed > 0.0 {
+            let rate = state.done / elapsed;
+            let left = self.budget.deadline.saturating_duration_since(now).as_secs_f64();
+            let fits = |shift: &i32| Self::projected(&state, *shift) / rate <= left;
+            let shift = SCHEDULER_SHIFTS.rev().find(fits).unwrap_or(*SCHEDULER_SHIFTS.start());
+            if shift != state.shift {
+                debug!("Quality budget: {:.0}s left, shifting preferences by {}", left, shift);
+                state.shift = shift;
+            }
+        }
+
+        let quality = Self::level(importance, state.shift);
+        if quality < Self::quality_range(importance).0 {
+            state.downgraded.insert(record.extracted_path.clone());
+        } else {
+            state.downgraded.remove(&record.extracted_path);
+        }
+        if let Some((cost, quality)) = state.in_flight.insert(record.extracted_path.clone(), (cost, quality)) {
+            // Sent again after a server restart
+            state.in_flight_cost -= cost * quality.cost_weight();
+        }
+        state.in_flight_cost += cost * quality.cost_weight();
+        state.chosen[quality as usize] += 1;
+        quality
+    }
+
+    /// Count a sent job's work as done, whether it succeeded or not
+    fn finished(&self, record: &ProcessingRecord) {
+        let mut state = self.state.lock().unwrap();
+        if let Some((cost, quality)) = state.in_flight.remove(&record.extracted_path) {
+            let weighted = cost * quality.cost_weight();
+            state.in_flight_cost = (state.in_flight_cost - weighted).max(0.0);
+            state.done += weighted;
+            state.done_jobs += 1;
+        }
+    }
+
+    /// Whether `output` was encoded below its preferred quality
+    fn downgraded(&self, output: &Path) -> bool {
+        self.state.lock().unwrap().downgraded.contains(output)
+    }
+
+    fn log_summary(&self) {
+        let state = self.state.lock().unwrap();
+        let now = Instant::now();
+        let margin = if now <= self.budget.deadline {
+            format!("{:.0?} ahead of the deadline", self.budget.deadline - now)
+        } else {
+            format!("{:.0?} past the deadline", now - self.budget.deadline)
+        };
+        info!(
+            "Quality budget: {} fastest, {} normal, {} production, {} highest; {}",
+            state.chosen[0], state.chosen[1], state.chosen[2], state.chosen[3], margin
+        );
+    }
+}
+
+/// Restore a group's outputs that are already in the cache, and pick one record
+/// to encode for each set of byte-identical sources, ordered largest-first
+/// Identical sources have identical headers, so without a cache only records
+/// that share their dimensions and format with another are hashed at all.
+fn plan_group(
+    group: &[ProcessingRecord],
+    format: Option<&str>,
+    tool: &str,
+    cache: Option<&OutputCache>,
+    scheduler: Option<&QualityScheduler>,
+) -> GroupPlan {
+    let shape = |r: &ProcessingRecord| {
+        (r.current_width, r.current_height, r.record.format.clone(), r.target_width, r.target_height)
+    };
+    let mut shapes: HashMap<_, usize> = HashMap::new();
+    if cache.is_none() {
+        for record in group {
+            *shapes.entry(shape(record)).or_default() += 1;
+        }
+    }
+
+    let (cached, keyed): (Vec<PathBuf>, Vec<(&ProcessingRecord, Option<CacheKey>)>) = group
+        .par_iter()
+        .partition_map(|record| {
+            if cache.is_none() && shapes[&shape(record)] < 2 {
+                return Either::Right((record, None));
+            }
+            // A budgeted run keys outputs by the quality they get with time to spare
+            let quality = scheduler.map_or(ENCODE_QUALITY, |s| s.preferred(record));
+            match source_key(record, format, tool, quality) {
+                Ok(key) if cache.map_or(false, |c| c.fetch(&key, &record.extracted_path)) => {
+                    Either::Left(record.extracted_path.clone())
+                }
+                Ok(key) => Either::Right((record, Some(key))),
+                Err(e) => {
+                    debug!("Cannot hash source of {}: {}", record.internal_path, e);
+                    Either::Right((record, None))
+                }
+            }
+        });
+
+    let mut plan = GroupPlan {
+        cached,
+        ..Default::default()
+    };
+    let mut representatives: HashMap<CacheKey, PathBuf> = HashMap::new();
+    for (record, key) in keyed {
+        if let Some(key) = key {
+            if let Some(representative) = representatives.get(&key) {
+                plan.duplicates
+                    .entry(representative.clone())
+                    .or_default()
+                    .push(record.extracted_path.clone());
+                continue;
+            }
+            representatives.insert(key, record.extracted_path.clone());
+            plan.keys.insert(record.extracted_path.clone(), key);
+        }
+        plan.pending.push(record.clone());
+    }
+    schedule_by_cost(&mut plan.pending, format);
+    plan
+}
+
+/// Give `dest` the contents of `src`: a hardlink where the filesystem allows it,
+/// otherwise a copy. Goes through a temp name so a staged source at `dest` is
+/// replaced in one step.
+fn link_output(src: &Path, dest: &Path) -> std::io::Result<()> {
+    link_output_with(src, dest, |src, temp| fs::hard_link(src, temp))
+}
+
+/// `link_output` with the linking step passed in, so the copy fallback can be tested
+fn link_output_with(
+    src: &Path,
+    dest: &Path,
+    link: fn(&Path, &Path) -> std::io::Result<()>,
+) -> std::io::Result<()> {
+    if let Some(parent) = dest.parent() {
+        fs::create_dir_all(parent)?;
+    }
+    let temp = dest.with_extension("dds.link");
+    let _ = fs::remove_file(&temp);
+    if link(src, &temp).is_err() {
+        fs::copy(src, &temp)?;
+    }
+    fs::rename(&temp, dest).map_err(|e| {
+        let _ = fs::remove_file(&temp);
+        e
+    })
 }
 
 /// Minimum texture dimension - textures smaller than this are skipped (VRAMr Rule 1)
@@ -353,6 +833,20 @@ impl ProcessingGroups {
     pub fn total_with_skipped(&self) -> usize {
         self.total() + self.skipped_small
     }
+
+    /// The groups that are encoded, in processing order, with the format each is
+    /// encoded to (None keeps the source's) and its name in logs
+    pub fn encode_groups(&self) -> [(&[ProcessingRecord], Option<&'static str>, &'static str); 7] {
+        [
+            (&self.bc7_resize, Some("BC7"), "BC7"),
+            (&self.bc4_resize, Some("BC4"), "BC4"),
+            (&self.rgba_resize, Some("RGBA"), "RGBA"),
+            (&self.pbr_resize, None, "PBR"),
+            (&self.specular_resize, Some("BC4"), "Specular"), // BC4 for grayscale specular (0.5 bytes/pixel)
+            (&self.emissive_resize, Some("BC1"), "Emissive"), // BC1 for emissive (has color)
+            (&self.gloss_resize, Some("BC4"), "Gloss"),
+        ]
+    }
 }
 
 /// Group textures by processing type (following Optimise.py logic)
@@ -363,12 +857,12 @@ pub fn group_by_processing_type(
 
     for (internal_path, record, target_width, target_height, extracted_path) in textures {
         // Get texture properties
-        let Some(texture_type) = &record.texture_type else {
+        let Some(texture_type) = record.texture_type else {
             continue;
         };
         let Some(width) = record.width else { continue };
         let Some(height) = record.height else { continue };
-        let format = record.format.as_ref().map(|s| s.as_str()).unwrap_or("");
+        let format = record.format.as_deref().unwrap_or("");
 
         // VRAMr Rule 1: Skip textures smaller than 512 in any dimension
         // These are too small to benefit from optimization
@@ -387,19 +881,26 @@ pub fn group_by_processing_type(
         let oversized = current_max > target_max;
 
         // Check for RGB/PBR formats
-        let is_rgb = format.to_uppercase() == "ARGB_8888";
+        let format_upper = format.to_uppercase();
+        let is_rgb = format_upper == "ARGB_8888";
         let is_pbr = internal_path.to_lowercase().contains("/pbr/");
+        let is_single_channel = matches!(
+            format_upper.as_str(),
+            "BC4" | "BC4_UNORM" | "BC4_SNORM" | "ATI1" | "ATI1N"
+        );
 
+        let extracted = extracted_path.exists();
         let proc_record = ProcessingRecord {
-            internal_path: internal_path.clone(),
-            record: record.clone(),
+            internal_path,
+            record,
             extracted_path,
             target_width,
             target_height,
-            texture_type: texture_type.clone(),
+            texture_type,
             current_width: width,
             current_height: height,
             oversized,
+            extracted,
         };
 
         // Group by processing type (exact Optimise.py logic)
@@ -407,7 +908,7 @@ pub fn group_by_processing_type(
             // Already at target size - delete only
             groups.delete_only.push(proc_record);
         } else {
-            match texture_type.as_str() {
+            match texture_type {
                 "Specular" => {
                     // Specular: resize to 1024, no format conversion
                     groups.specular_resize.push(proc_record);
@@ -434,19 +935,12 @@ pub fn group_by_processing_type(
                     // Resolve by checking source format: single-channel → BC4, multi-channel → BC7.
                     if is_rgb {
                         groups.rgba_resize.push(proc_record);
+                    } else if is_single_channel {
+                        groups.bc4_resize.push(proc_record);
                     } else {
-                        let fmt_upper = format.to_uppercase();
-                        let is_single_channel = matches!(
-                            fmt_upper.as_str(),
-                            "BC4" | "BC4_UNORM" | "BC4_SNORM" | "ATI1" | "ATI1N"
-                        );
-                        if is_single_channel {
-                            groups.bc4_resize.push(proc_record);
-                        } else {
-                            // Multi-channel source (DXT1/DXT3/DXT5/BC7/etc.) —
-                            // this is a color texture (e.g. male variant), not a mask.
-                            groups.bc7_resize.push(proc_record);
-                        }
+                        // Multi-channel source (DXT1/DXT3/DXT5/BC7/etc.) —
+                        // this is a color texture (e.g. male variant), not a mask.
+                        groups.bc7_resize.push(proc_record);
                     }
                 }
                 "Diffuse" => {
@@ -479,6 +973,7 @@ pub fn process_batch_texconv(
     batch: &[ProcessingRecord],
     format: Option<&str>,
     texconv_path: &Path,
+    encoded: OnEncoded,
 ) -> Result<(usize, usize)> {
     if batch.is_empty() {
         return Ok((0, 0));
@@ -499,20 +994,21 @@ pub fn process_batch_texconv(
     let format_name = format.unwrap_or("resize");
     pb.set_message(format!("Processing {} textures...", format_name));
 
-    // Process textures in parallel (16 processes, each single-threaded)
-    batch.par_iter().for_each(|record| {
-            match process_single_texture(record, format, texconv_path) {
-                Ok(_) => {
-                    total_success.fetch_add(1, Ordering::Relaxed);
-                    pb.inc(1);
-                }
-                Err(e) => {
-                    error!("Failed to process {}: {}", record.internal_path, e);
-                    total_failed.fetch_add(1, Ordering::Relaxed);
-                    pb.inc(1);
-                }
+    // Process textures in parallel (16 processes, each single-threaded), in batch order
+    for_each_in_order(batch, |record| {
+        match process_single_texture(record, format, texconv_path) {
+            Ok(_) => {
+                total_success.fetch_add(1, Ordering::Relaxed);
+                encoded(record);
+                pb.inc(1);
             }
-        });
+            Err(e) => {
+                error!("Failed to process {}: {}", record.internal_path, e);
+                total_failed.fetch_add(1, Ordering::Relaxed);
+                pb.inc(1);
+            }
+        }
+    });
 
     let success = total_success.into_inner();
     let failed = total_failed.into_inner();
@@ -530,6 +1026,8 @@ fn process_single_texture(
     format: Option<&str>,
     texconv_path: &Path,
 ) -> Result<()> {
+    ensure_extracted(record)?;
+
     // Use FULL absolute path to the extracted file
     let full_path = &record.extracted_path;
 
@@ -572,7 +1070,7 @@ fn process_single_texture(
             if f.read_exact(&mut hdr).is_ok() {
                 if &hdr[84..88] == b"DX10" {
                     let dxgi = u32::from_le_bytes([hdr[128], hdr[129], hdr[130], hdr[131]]);
-                    srgb = matches!(dxgi, 28 | 72 | 75 | 78 | 91 | 99);
+                    srgb = matches!(dxgi, 29 | 72 | 75 | 78 | 91 | 93 | 99);
                 }
             }
         }
@@ -697,6 +1195,8 @@ fn process_single_texture_nvtt3(
     nvtt_tool_path: &Path,
     lib_path: Option<&Path>,
 ) -> Result<()> {
+    ensure_extracted(record)?;
+
     let full_path = &record.extracted_path;
 
     debug!("process_single_texture_nvtt3: extracted_path = {:?}", full_path);
@@ -711,17 +1211,7 @@ fn process_single_texture_nvtt3(
     let max_extent = record.target_width.max(record.target_height);
 
     // Determine format argument
-    let format_arg = match format {
-        Some(fmt) => match fmt.to_uppercase().as_str() {
-            "BC7" | "BC7_UNORM" => "bc7",
-            "BC4" | "BC4_UNORM" => "bc4",
-            "BC3" | "BC3_UNORM" => "bc3",
-            "BC1" | "BC1_UNORM" => "bc1",
-            "BC5" | "BC5_UNORM" => "bc5",
-            _ => "bc7",
-        },
-        None => "bc7", // Default to BC7
-    };
+    let format_arg = nvtt3_format_arg(format);
 
     // Build nvtt_resize_compress command
     let mut cmd = Command::new(nvtt_tool_path);
@@ -787,7 +1277,692 @@ fn process_single_texture_nvtt3(
     Ok(())
 }
 
-/// Process a batch of textures with NVTT3 - uses batch tool for better GPU utilization
+/// Map a group format name to the nvtt3 tool's format argument
+fn nvtt3_format_arg(format: Option<&str>) -> &'static str {
+    match format {
+        Some(fmt) => match fmt.to_uppercase().as_str() {
+            "BC7" | "BC7_UNORM" => "bc7",
+            "BC4" | "BC4_UNORM" => "bc4",
+            "BC3" | "BC3_UNORM" => "bc3",
+            "BC1" | "BC1_UNORM" => "bc1",
+            "BC5" | "BC5_UNORM" => "bc5",
+            _ => "bc7",
+        },
+        None => "bc7",
+    }
+}
+
+/// Small textures (<= 512px after resize) the NVTT3 server packs into one GPU submission
+/// Clutter textures are cheap to encode, so per-submission overhead dominates without this
+const NVTT3_PACK_SIZE: usize = 32;
+
+/// Memory (MB) a single mip chain may hold on the GPU before the NVTT3 server switches
+/// that texture to level-by-level compression. Fits a 4K chain; 8K streams.
+const NVTT3_VRAM_BUDGET_MB: usize = 1024;
+
+/// Source reads the NVTT3 server keeps in flight ahead of its decoders, and outputs it
+/// queues for its writer thread, so neither disk side stalls the GPU
+const NVTT3_IO_DEPTH: usize = 4;
+
+/// NVTT3 server flags that change what gets encoded, so they're part of the
+/// tool fingerprint. --reuse-mips starts a downscale from the stored source mip
+/// nearest the target instead of filtering the full top level; --copy-mips
+/// answers a downscale that keeps the source format (BC7 -> BC7 at half size)
+/// by copying the stored lower levels under a new header, without encoding.
+const NVTT3_OUTPUT_FLAGS: &[&str] = &["--reuse-mips", "--copy-mips"];
+
+/// `NVTT3_OUTPUT_FLAGS` plus the opt-in ones: --auto-bc1 writes an opaque
+/// source asked for as BC3/BC7 as BC1, at half the size
+fn nvtt3_output_flags(auto_bc1: bool) -> Vec<&'static str> {
+    let mut flags = NVTT3_OUTPUT_FLAGS.to_vec();
+    if auto_bc1 {
+        flags.push("--auto-bc1");
+    }
+    flags
+}
+
+/// Pipeline options for the NVTT3 server process and the in-process engine alike
+fn nvtt3_engine_args(streams: usize, auto_bc1: bool) -> Vec<String> {
+    let mut args: Vec<String> = vec![
+        "--streams".into(),
+        streams.to_string(),
+        "--pack".into(),
+        NVTT3_PACK_SIZE.to_string(),
+        "--vram-budget".into(),
+        NVTT3_VRAM_BUDGET_MB.to_string(),
+        "--io-depth".into(),
+        NVTT3_IO_DEPTH.to_string(),
+        // Outputs land in the live mod folder; never leave a half-written DDS
+        "--atomic-write".into(),
+        // Shard across every visible GPU; a single-GPU box behaves as before
+        "--devices".into(),
+        "0".into(),
+        // Per-stage timings on every result, summed up in the run's timing report
+        "--timing".into(),
+    ];
+    args.extend(nvtt3_output_flags(auto_bc1).iter().map(|flag| flag.to_string()));
+    args
+}
+
+/// A running `nvtt_batch_compress --server --streams N` process
+/// Jobs go in on stdin one line at a time, OK:/FAIL: results come back on stderr
+/// in completion order, tagged with the job's 1-based submission number
+struct Nvtt3Process {
+    child: Child,
+    stdin: Option<ChildStdin>,
+    stderr: std::io::Lines<BufReader<ChildStderr>>,
+    /// Job lines written so far - the server numbers jobs in this order
+    submitted: usize,
+}
+
+impl Nvtt3Process {
+    fn spawn(batch_tool_path: &Path, lib_path: Option<&Path>, args: &[String]) -> Result<Self> {
+        let mut cmd = Command::new(batch_tool_path);
+
+        if let Some(lib_dir) = lib_path {
+            cmd.env("LD_LIBRARY_PATH", lib_dir);
+        }
+
+        cmd.arg("--server");
+        cmd.args(args);
+        cmd.stdin(Stdio::piped());
+        cmd.stderr(Stdio::piped());
+        cmd.stdout(Stdio::null());
+
+        let mut child = cmd.spawn()?;
+        let stdin = child.stdin.take();
+        let stderr = match child.stderr.take() {
+            Some(s) => BufReader::new(s).lines(),
+            None => anyhow::bail!("nvtt_batch_compress stderr not captured"),
+        };
+
+        let mut process = Self { child, stdin, stderr, submitted: 0 };
+
+        // Wait for READY so a broken install fails here rather than on every job
+        loop {
+            match process.stderr.next() {
+                Some(Ok(line)) if line.starts_with("READY:") => break,
+                Some(Ok(line)) if line.starts_with("CUDA:") => info!("NVTT3 server: {}", line),
+                Some(Ok(_)) => {}
+                _ => anyhow::bail!("nvtt_batch_compress --server exited before READY"),
+            }
+        }
+
+        Ok(process)
+    }
+
+    /// Feed `jobs` to the server keeping at most `window` in flight, calling `on_result`
+    /// for each one as it completes. If the server dies, the jobs it had in flight come
+    /// back unanswered in `lost` and the rest were never sent.
+    fn stream<'a, F>(
+        &mut self,
+        jobs: &[&'a ProcessingRecord],
+        format_arg: &str,
+        scheduler: Option<&QualityScheduler>,
+        window: usize,
+        on_result: &F,
+    ) -> StreamOutcome<'a>
+    where
+        F: Fn(&'a ProcessingRecord, Result<Option<Nvtt3JobStats>, String>) + Sync,
+    {
+        let Nvtt3Process { child, stdin, stderr, submitted } = self;
+        let in_flight: Mutex<HashMap<usize, &'a ProcessingRecord>> = Mutex::new(HashMap::new());
+        let mut handled = 0;
+
+        // One token per job in flight; the reader hands a token back per result
+        let (slot_tx, slot_rx) = crossbeam_channel::bounded::<()>(window.max(1));
+
+        let alive = std::thread::scope(|scope| {
+            let in_flight = &in_flight;
+
+            // Reads results until the SYNC reply that follows the last job
+            let reader = scope.spawn(move || loop {
+                let line = match stderr.next() {
+                    Some(Ok(line)) => line,
+                    _ => return false,
+                };
+
+                if line.starts_with("SYNC:") {
+                    return true;
+                }
+
+                let ok = line.starts_with("OK:");
+                if !ok && !line.starts_with("FAIL:") {
+                    continue;
+                }
+
+                // OK:i/n:path:... / FAIL:i/n:path:reason
+                let parts: Vec<&str> = line.splitn(4, ':').collect();
+                let job_num = parts
+                    .get(1)
+                    .and_then(|p| p.split('/').next())
+                    .and_then(|n| n.parse::<usize>().ok());
+                let record = job_num.and_then(|n| in_flight.lock().unwrap().remove(&n));
+
+                if let Some(record) = record {
+                    let result = if ok {
+                        Ok(parse_nvtt3_ok(&line))
+                    } else {
+                        Err(parts.get(3).unwrap_or(&"unknown error").to_string())
+                    };
+                    on_result(record, result);
+                    let _ = slot_rx.recv();
+                }
+            });
+
+            let mut write_ok = stdin.is_some();
+            if let Some(stdin) = stdin.as_mut() {
+                for (record, job) in nvtt3_jobs(jobs, format_arg, scheduler, window) {
+                    let job = match job {
+                        Ok(job) => job,
+                        Err(e) => {
+                            on_result(record, Err(format!("Failed to read source: {}", e)));
+                            handled += 1;
+                            continue;
+                        }
+                    };
+
+                    // Blocks while the window is full; errors once the reader has given up
+                    if slot_tx.send(()).is_err() {
+                        write_ok = false;
+                        break;
+                    }
+
+                    let job_num = *submitted + 1;
+                    in_flight.lock().unwrap().insert(job_num, record);
+
+                    let written = writeln!(stdin, "{}", job.line)
+                        .and_then(|_| match &job.payload {
+                            Some(data) => stdin.write_all(data),
+                            None => Ok(()),
+                        })
+                        .and_then(|_| stdin.flush());
+
+                    if written.is_err() {
+                        // Not accepted - leave it for the next server and stop this one
+                        in_flight.lock().unwrap().remove(&job_num);
+                        write_ok = false;
+                        break;
+                    }
+
+                    *submitted += 1;
+                    handled += 1;
+                }
+
+                if write_ok {
+                    write_ok = writeln!(stdin, "SYNC").and_then(|_| stdin.flush()).is_ok();
+                }
+            }
+
+            if !write_ok {
+                let _ = child.kill();
+            }
+
+            reader.join().unwrap_or(false)
+        });
+
+        let lost = if alive {
+            Vec::new()
+        } else {
+            let mut lost: Vec<_> = in_flight.into_inner().unwrap_or_default().into_iter().collect();
+            lost.sort_by_key(|(job_num, _)| *job_num);
+            lost.into_iter().map(|(_, record)| record).collect()
+        };
+
+        StreamOutcome { sent: handled, alive, lost }
+    }
+}
+
+/// What `Nvtt3Process::stream` did with a run of jobs
+struct StreamOutcome<'a> {
+    /// Jobs dealt with from the front of the run, including `lost`
+    sent: usize,
+    /// The server is still running
+    alive: bool,
+    /// Jobs in flight when the server died, in submission order, never answered
+    lost: Vec<&'a ProcessingRecord>,
+}
+
+/// Stages timed by `nvtt_batch_compress --timing`, in the order of its OK: field
+const NVTT3_STAGES: [&str; 7] = ["load", "upload", "resize", "mips", "encode", "patch", "write"];
+
+/// Details of one texture from its OK: line or in-process result
+#[derive(Debug, Clone, PartialEq)]
+pub struct Nvtt3JobStats {
+    pub format: String,
+    pub source_pixels: u64,
+    /// Milliseconds per entry of `NVTT3_STAGES`
+    pub stages: [f64; 7],
+}
+
+/// Parse `OK:i/n:path:WxH->WxH:FORMAT:mips:load=..,upload=..,...`
+/// Fields are taken from the end since the path may contain ':'. None for lines
+/// without timings.
+fn parse_nvtt3_ok(line: &str) -> Option<Nvtt3JobStats> {
+    let mut fields = line.rsplitn(5, ':');
+    let timing = fields.next()?;
+    let _mips = fields.next()?;
+    let format = fields.next()?;
+    let dims = fields.next()?;
+
+    let (source, _) = dims.split_once("->")?;
+    let (width, height) = source.split_once('x')?;
+    let source_pixels = width.parse::<u64>().ok()? * height.parse::<u64>().ok()?;
+
+    let mut stages = [0.0; 7];
+    for field in timing.split(',') {
+        let (name, value) = field.split_once('=')?;
+        let index = NVTT3_STAGES.iter().position(|stage| *stage == name)?;
+        stages[index] = value.parse().ok()?;
+    }
+
+    Some(Nvtt3JobStats {
+        format: format.to_string(),
+        source_pixels,
+        stages,
+    })
+}
+
+/// Outcome of one in-process engine job, in the form OK:/FAIL: lines are parsed into
+fn nvtt3_result(result: EncodeResult) -> Result<Option<Nvtt3JobStats>, String> {
+    if let Some(reason) = result.error {
+        return Err(reason);
+    }
+    Ok(Some(Nvtt3JobStats {
+        format: result.format,
+        source_pixels: result.source_width as u64 * result.source_height as u64,
+        stages: result.stage_ms,
+    }))
+}
+
+/// Stage timings and throughput across the NVTT3 batches of a run
+#[derive(Debug, Default)]
+struct Nvtt3TimingReport {
+    /// Milliseconds per texture, one list per entry of `NVTT3_STAGES`
+    stages: [Vec<f64>; 7],
+    /// Per format: (textures, source pixels, seconds of batch wall time)
+    formats: HashMap<String, (usize, u64, f64)>,
+}
+
+impl Nvtt3TimingReport {
+    /// Add one batch: its textures' stats and how long the batch took
+    fn add_batch(&mut self, jobs: &[Nvtt3JobStats], elapsed: std::time::Duration) {
+        let mut pixels: HashMap<&str, (usize, u64)> = HashMap::new();
+        for job in jobs {
+            for (samples, ms) in self.stages.iter_mut().zip(job.stages) {
+                samples.push(ms);
+            }
+            let entry = pixels.entry(job.format.as_str()).or_default();
+            entry.0 += 1;
+            entry.1 += job.source_pixels;
+        }
+
+        // A batch is one format, but charge its wall time by pixels in case it isn't
+        let total: u64 = pixels.values().map(|(_, p)| p).sum();
+        for (format, (count, format_pixels)) in pixels {
+            let share = if total > 0 { format_pixels as f64 / total as f64 } else { 0.0 };
+            let entry = self.formats.entry(format.to_string()).or_default();
+            entry.0 += count;
+            entry.1 += format_pixels;
+            entry.2 += elapsed.as_secs_f64() * share;
+        }
+    }
+
+    /// Nearest-rank percentile of sorted samples
+    fn percentile(sorted: &[f64], p: usize) -> f64 {
+        if sorted.is_empty() {
+            return 0.0;
+        }
+        sorted[((sorted.len() - 1) * p + 50) / 100]
+    }
+
+    fn log(&self) {
+        if self.stages[0].is_empty() {
+            return;
+        }
+
+        info!("NVTT3 stage timings over {} textures (ms):", self.stages[0].len());
+        for (name, samples) in NVTT3_STAGES.iter().zip(&self.stages) {
+            let mut sorted = samples.clone();
+            sorted.sort_by(|a, b| a.total_cmp(b));
+            info!(
+                "  {:<7} p50 {:>9.2}  p95 {:>9.2}  max {:>9.2}  total {:>9.1} s",
+                name,
+                Self::percentile(&sorted, 50),
+                Self::percentile(&sorted, 95),
+                sorted.last().copied().unwrap_or(0.0),
+                sorted.iter().sum::<f64>() / 1000.0
+            );
+        }
+
+        let mut formats: Vec<_> = self.formats.iter().collect();
+        formats.sort_by(|a, b| a.0.cmp(b.0));
+        for (format, (count, pixels, seconds)) in formats {
+            let megapixels = *pixels as f64 / 1e6;
+            info!(
+                "  {:<7} {:>8.1} MP/s ({} textures, {:.0} MP in {:.1} s)",
+                format,
+                if *seconds > 0.0 { megapixels / seconds } else { 0.0 },
+                count,
+                megapixels,
+                seconds
+            );
+        }
+    }
+}
+
+/// One job for the NVTT3 server, plus the source DDS bytes when they're sent inline
+struct Nvtt3Job {
+    line: String,
+    payload: Option<Vec<u8>>,
+}
+
+/// Build the server job for a record
+/// Sources already on disk are passed by path: extracted files are rewritten in place and
+/// deferred loose files are read straight from the mod. Deferred archived sources are read
+/// into memory and sent inline (`@<len>` input field) so they never touch the disk.
+fn nvtt3_job(record: &ProcessingRecord, format_arg: &str, quality: Option<EncodeQuality>) -> Result<Nvtt3Job> {
+    // Job line: input|output|max_extent|format|srgb_hint[|header[|kind[|quality]]]
+    // srgb_hint: always 0 (legacy stays UNORM)
+    // header: "width,height,dx10,srgb" from discovery, so the server doesn't re-probe the source
+    // kind: "normal" for normal maps, whose mips the server renormalizes (header may be empty)
+    // quality: encoder quality picked by a time budget, else the server's --quality
+    let max_extent = record.target_width.max(record.target_height);
+    let mut rest = format!("{}|{}|{}|0", record.extracted_path.display(), max_extent, format_arg);
+    let header = match (record.record.width, record.record.height) {
+        (Some(width), Some(height)) => {
+            let srgb = record.record.srgb;
+            format!(
+                "{},{},{},{}",
+                width,
+                height,
+                srgb.is_some() as u8,
+                srgb.unwrap_or(false) as u8
+            )
+        }
+        _ => String::new(),
+    };
+    if !header.is_empty() || record.is_normal_map() || quality.is_some() {
+        rest.push_str(&format!("|{}", header));
+    }
+    if record.is_normal_map() || quality.is_some() {
+        rest.push_str(if record.is_normal_map() { "|normal" } else { "|" });
+    }
+    if let Some(quality) = quality {
+        rest.push_str(&format!("|{}", quality.name()));
+    }
+
+    if record.extracted {
+        Ok(Nvtt3Job {
+            line: format!("{}|{}", record.extracted_path.display(), rest),
+            payload: None,
+        })
+    } else if record.record.is_loose() {
+        Ok(Nvtt3Job {
+            line: format!("{}|{}", record.record.actual_path.display(), rest),
+            payload: None,
+        })
+    } else {
+        let data = crate::extraction::read_texture_bytes(&record.record)?;
+        Ok(Nvtt3Job {
+            line: format!("@{}|{}", data.len(), rest),
+            payload: Some(data),
+        })
+    }
+}
+
+/// `nvtt3_job` for each of `jobs` in order, built `ahead` at a time on the rayon pool,
+/// so archived sources are decompressed in parallel while the jobs before them encode
+/// A `scheduler` picks each job's quality as its chunk is built, from the throughput
+/// measured up to then.
+fn nvtt3_jobs<'j, 'a>(
+    jobs: &'j [&'a ProcessingRecord],
+    format_arg: &'j str,
+    scheduler: Option<&'j QualityScheduler>,
+    ahead: usize,
+) -> impl Iterator<Item = (&'a ProcessingRecord, Result<Nvtt3Job>)> + 'j {
+    jobs.chunks(ahead.max(1)).flat_map(move |chunk| {
+        chunk
+            .par_iter()
+            .map(|record| {
+                let quality = scheduler.map(|s| s.choose(record, Some(format_arg)));
+                (*record, nvtt3_job(record, format_arg, quality))
+            })
+            .collect::<Vec<_>>()
+    })
+}
+
+impl Drop for Nvtt3Process {
+    fn drop(&mut self) {
+        // Closing stdin ends the session; the server prints BATCH_END and exits
+        drop(self.stdin.take());
+        let _ = self.child.wait();
+    }
+}
+
+/// The NVTT3 server shared by every texture group of a run
+/// A single process (one CUDA context) decodes on `streams` CPU threads and keeps the
+/// GPU fed, instead of one process per worker thread competing for the device.
+/// Without CUDA it encodes on a pool of CPU threads instead, and a texture the GPU
+/// fails on is retried on the CPU in-process before it is reported as failed.
+/// Spawned on first use and respawned if it dies mid-run; the jobs it had in flight are
+/// then retried one at a time, so only a texture that crashes it by itself fails.
+/// With `in_process` set and libradium_encode.so built next to libnvtt.so, the same
+/// pipeline runs in this process instead. That saves the pipe round trips, but a
+/// crash in NVTT or the driver then ends the whole run, so it is opt-in.
+pub struct Nvtt3Server {
+    batch_tool_path: PathBuf,
+    lib_path: Option<PathBuf>,
+    streams: usize,
+    process: Mutex<Option<Nvtt3Process>>,
+    /// Use the in-process engine instead of the server process
+    in_process: bool,
+    /// In-process engine, loaded on first use; None if not wanted or the library isn't there
+    engine: OnceLock<Option<RadiumEngine>>,
+    timings: Mutex<Nvtt3TimingReport>,
+    /// Pass --auto-bc1 (see `nvtt3_output_flags`)
+    auto_bc1: bool,
+    /// Picks each job's encoder quality in a time-budgeted run
+    scheduler: Option<QualityScheduler>,
+}
+
+impl Nvtt3Server {
+    pub fn new(batch_tool_path: &Path, lib_path: Option<&Path>, streams: usize) -> Self {
+        Self {
+            batch_tool_path: batch_tool_path.to_path_buf(),
+            lib_path: lib_path.map(|p| p.to_path_buf()),
+            streams: streams.max(1),
+            process: Mutex::new(None),
+            in_process: false,
+            engine: OnceLock::new(),
+            timings: Mutex::new(Nvtt3TimingReport::default()),
+            auto_bc1: false,
+            scheduler: None,
+        }
+    }
+
+    /// Log the stage timings and throughput of every batch run so far
+    pub fn log_timing_report(&self) {
+        if let Ok(report) = self.timings.lock() {
+            report.log();
+        }
+    }
+
+    /// Options the server process or in-process engine starts with
+    fn engine_args(&self) -> Vec<String> {
+        nvtt3_engine_args(self.streams, self.auto_bc1)
+    }
+
+    /// Jobs kept in flight - enough that decode threads never wait on the driver
+    fn window(&self) -> usize {
+        self.streams * 2 + 1
+    }
+
+    /// The in-process engine, loaded on first call if `in_process` is set
+    fn engine(&self) -> Option<&RadiumEngine> {
+        self.engine
+            .get_or_init(|| {
+                if !self.in_process {
+                    return None;
+                }
+                let lib_dir = self.lib_path.as_deref()?;
+                if !lib_dir.join(radium_encode::LIBRARY_NAME).exists() {
+                    warn!("NVTT3 engine: {} not built, using the server process", radium_encode::LIBRARY_NAME);
+                    return None;
+                }
+                match RadiumEngine::load(lib_dir, &self.engine_args()) {
+                    Ok(engine) => {
+                        let gpus = engine.stats().gpus;
+                        info!("NVTT3 engine: in-process, {} CUDA device(s)", gpus);
+                        Some(engine)
+                    }
+                    Err(e) => {
+                        warn!("NVTT3 engine: {}, using the server process", e);
+                        None
+                    }
+                }
+            })
+            .as_ref()
+    }
+
+    /// Run every record through the server, calling `on_result` as each completes
+    fn run_jobs<'a, F>(&self, jobs: &[&'a ProcessingRecord], format_arg: &str, on_result: &F)
+    where
+        F: Fn(&'a ProcessingRecord, Result<Option<Nvtt3JobStats>, String>) + Sync,
+    {
+        // Held on both paths, so each call gets back only its own results
+        let mut process = match self.process.lock() {
+            Ok(p) => p,
+            Err(poisoned) => poisoned.into_inner(),
+        };
+
+        if let Some(engine) = self.engine() {
+            self.run_in_process(engine, jobs, format_arg, on_result);
+            return;
+        }
+
+        let mut next = 0;
+        let mut suspects: Vec<&'a ProcessingRecord> = Vec::new();
+        while next < jobs.len() {
+            if let Err(e) = self.ensure_process(&mut process) {
+                for record in jobs[next..].iter().chain(&suspects) {
+                    on_result(record, Err(format!("NVTT3 server unavailable: {}", e)));
+                }
+                return;
+            }
+
+            let outcome = process
+                .as_mut()
+                .unwrap()
+                .stream(&jobs[next..], format_arg, self.scheduler.as_ref(), self.window(), on_result);
+            next += outcome.sent;
+
+            if !outcome.alive {
+                warn!(
+                    "NVTT3 server exited with {} jobs in flight, restarting for {} remaining jobs",
+                    outcome.lost.len(),
+                    jobs.len() - next
+                );
+                suspects.extend(outcome.lost);
+                *process = None;
+            }
+        }
+
+        // Any job the dead server had in flight may be what crashed it, so rather than
+        // failing them all (and sending them through Wine), each gets another try on its
+        // own. Only a job that takes the server down by itself is reported.
+        for (i, record) in suspects.iter().enumerate() {
+            if let Err(e) = self.ensure_process(&mut process) {
+                for record in &suspects[i..] {
+                    on_result(record, Err(format!("NVTT3 server unavailable: {}", e)));
+                }
+                return;
+            }
+
+            let outcome = process
+                .as_mut()
+                .unwrap()
+                .stream(&[*record], format_arg, self.scheduler.as_ref(), 1, on_result);
+            if !outcome.alive {
+                warn!("NVTT3 server crashed on {}", record.internal_path);
+                for record in outcome.lost {
+                    on_result(record, Err("Crashed the NVTT3 server".to_string()));
+                }
+                *process = None;
+            }
+        }
+    }
+
+    /// Spawn the server process unless one is running
+    fn ensure_process(&self, process: &mut Option<Nvtt3Process>) -> Result<()> {
+        if process.is_none() {
+            let spawned = Nvtt3Process::spawn(&self.batch_tool_path, self.lib_path.as_deref(), &self.engine_args());
+            match spawned {
+                Ok(p) => *process = Some(p),
+                Err(e) => {
+                    error!("Failed to start NVTT3 server: {}", e);
+                    return Err(e);
+                }
+            }
+        }
+        Ok(())
+    }
+
+    /// `run_jobs` on the in-process engine, keeping at most `window` jobs in flight
+    fn run_in_process<'a, F>(
+        &self,
+        engine: &RadiumEngine,
+        jobs: &[&'a ProcessingRecord],
+        format_arg: &str,
+        on_result: &F,
+    ) where
+        F: Fn(&'a ProcessingRecord, Result<Option<Nvtt3JobStats>, String>) + Sync,
+    {
+        let window = self.window();
+        let mut in_flight: HashMap<usize, &'a ProcessingRecord> = HashMap::new();
+
+        // Wait for at least one result; false if the engine has none left to give
+        let collect = |in_flight: &mut HashMap<usize, &'a ProcessingRecord>| {
+            let results = engine.poll(window, None);
+            let any = !results.is_empty();
+            for result in results {
+                if let Some(record) = in_flight.remove(&result.job) {
+                    on_result(record, nvtt3_result(result));
+                }
+            }
+            any
+        };
+
+        for (i, (record, job)) in nvtt3_jobs(jobs, format_arg, self.scheduler.as_ref(), window).enumerate() {
+            if in_flight.len() >= window && !collect(&mut in_flight) {
+                for record in &jobs[i..] {
+                    on_result(record, Err("NVTT3 engine stopped".to_string()));
+                }
+                break;
+            }
+            let job = match job {
+                Ok(job) => job,
+                Err(e) => {
+                    on_result(record, Err(format!("Failed to read source: {}", e)));
+                    continue;
+                }
+            };
+            match engine.submit(&job.line, job.payload.as_deref()) {
+                Some(number) => {
+                    in_flight.insert(number, record);
+                }
+                None => on_result(record, Err("Invalid job line".to_string())),
+            }
+        }
+
+        while !in_flight.is_empty() && collect(&mut in_flight) {}
+        for (_, record) in in_flight {
+            on_result(record, Err("NVTT3 engine lost the job".to_string()));
+        }
+    }
+}
+
+/// Process a batch of textures with NVTT3 - uses the batch server for better GPU utilization
 /// Falls back to per-file processing if batch tool is not available
 /// If texconv_fallback is provided, retries failed files with texconv
 /// Returns (success_count, failed_count)
@@ -796,65 +1971,39 @@ pub fn process_batch_nvtt3(
     format: Option<&str>,
     nvtt_tool_path: &Path,
     lib_path: Option<&Path>,
+    server: Option<&Nvtt3Server>,
     texconv_fallback: Option<&Path>,
+    encoded: OnEncoded,
 ) -> Result<(usize, usize)> {
-    // Check if batch tool exists alongside the single-file tool
-    let batch_tool_path = nvtt_tool_path
-        .parent()
-        .map(|p| p.join("nvtt_batch_compress"));
-
-    if let Some(ref batch_path) = batch_tool_path {
-        if batch_path.exists() {
-            return process_batch_nvtt3_batched(batch, format, batch_path, lib_path, texconv_fallback);
-        }
+    if let Some(server) = server {
+        return process_batch_nvtt3_batched(batch, format, server, texconv_fallback, encoded);
     }
 
     // Fallback to per-file processing
-    process_batch_nvtt3_perfile(batch, format, nvtt_tool_path, lib_path)
+    process_batch_nvtt3_perfile(batch, format, nvtt_tool_path, lib_path, encoded)
 }
 
-/// Batch size for NVTT3 processing - balance between CUDA init overhead and parallelism
-/// Smaller batches = more parallelism, larger batches = less CUDA init overhead
-const NVTT3_BATCH_SIZE: usize = 100;
-
-/// Process textures using nvtt_batch_compress with parallel batch execution
-/// Multiple batch processes run in parallel for better GPU utilization
+/// Process textures by streaming jobs to the persistent NVTT3 server
 /// If texconv_fallback is provided, retries failed files with texconv
-fn process_batch_nvtt3_batched(
-    batch: &[ProcessingRecord],
+fn process_batch_nvtt3_batched<'a>(
+    batch: &'a [ProcessingRecord],
     format: Option<&str>,
-    batch_tool_path: &Path,
-    lib_path: Option<&Path>,
+    server: &Nvtt3Server,
     texconv_fallback: Option<&Path>,
+    encoded: OnEncoded,
 ) -> Result<(usize, usize)> {
-    use std::sync::Mutex;
-
     if batch.is_empty() {
         return Ok((0, 0));
     }
 
     let format_name = format.unwrap_or("BC7");
-    let format_arg = match format {
-        Some(fmt) => match fmt.to_uppercase().as_str() {
-            "BC7" | "BC7_UNORM" => "bc7",
-            "BC4" | "BC4_UNORM" => "bc4",
-            "BC3" | "BC3_UNORM" => "bc3",
-            "BC1" | "BC1_UNORM" => "bc1",
-            "BC5" | "BC5_UNORM" => "bc5",
-            _ => "bc7",
-        },
-        None => "bc7",
-    };
-
-    // Use thread pool configured by user settings
-    let parallel_jobs = rayon::current_num_threads();
+    let format_arg = nvtt3_format_arg(format);
 
     info!(
-        "NVTT3 Batch: Processing {} {} textures ({} parallel jobs, {} per batch)",
+        "NVTT3 Batch: Processing {} {} textures ({} decode streams)",
         batch.len(),
         format_name,
-        parallel_jobs,
-        NVTT3_BATCH_SIZE
+        server.streams
     );
 
     // Create progress bar for all textures
@@ -871,130 +2020,46 @@ fn process_batch_nvtt3_batched(
     let total_failed = AtomicUsize::new(0);
 
     // Collect failed records for texconv fallback
-    let failed_records: Mutex<Vec<&ProcessingRecord>> = Mutex::new(Vec::new());
-
-    // Create a map from path to record for fallback lookup
-    let record_map: std::collections::HashMap<String, &ProcessingRecord> = batch
-        .iter()
-        .map(|r| (r.extracted_path.to_string_lossy().to_string(), r))
-        .collect();
-
-    // Split into chunks and process in parallel
-    let chunks: Vec<_> = batch.chunks(NVTT3_BATCH_SIZE).collect();
-
-    chunks.par_iter().enumerate().for_each(|(batch_idx, chunk)| {
-        let batch_num = batch_idx + 1;
-
-        debug!(
-            "Processing batch {}/{} ({} textures)",
-            batch_num,
-            chunks.len(),
-            chunk.len()
-        );
-
-        // Create batch file
-        let batch_file = match tempfile::Builder::new()
-            .prefix("nvtt_batch_")
-            .suffix(".txt")
-            .tempfile() {
-                Ok(f) => f,
-                Err(e) => {
-                    error!("Failed to create batch file: {}", e);
-                    total_failed.fetch_add(chunk.len(), Ordering::Relaxed);
-                    pb.inc(chunk.len() as u64);
-                    return;
-                }
-            };
-
-        // Write batch entries: input|output|max_extent|format|srgb_hint
-        // srgb_hint: always 0 (legacy stays UNORM)
-        {
-            let mut writer = std::io::BufWriter::new(&batch_file);
-            for record in *chunk {
-                let max_extent = record.target_width.max(record.target_height);
-                if let Err(e) = writeln!(
-                    writer,
-                    "{}|{}|{}|{}|0",
-                    record.extracted_path.display(),
-                    record.extracted_path.display(),
-                    max_extent,
-                    format_arg
-                ) {
-                    error!("Failed to write batch entry: {}", e);
-                }
-            }
-            if let Err(e) = writer.flush() {
-                error!("Failed to flush batch file: {}", e);
-            }
-        }
+    let failed_records: Mutex<Vec<&'a ProcessingRecord>> = Mutex::new(Vec::new());
 
-        // Run batch compress with streaming output
-        let mut cmd = Command::new(batch_tool_path);
+    let jobs: Vec<&'a ProcessingRecord> = batch.iter().collect();
+    let job_stats: Mutex<Vec<Nvtt3JobStats>> = Mutex::new(Vec::new());
+    let start_time = std::time::Instant::now();
 
-        if let Some(lib_dir) = lib_path {
-            cmd.env("LD_LIBRARY_PATH", lib_dir);
+    server.run_jobs(&jobs, format_arg, &|record: &'a ProcessingRecord, result: Result<Option<Nvtt3JobStats>, String>| {
+        if let Some(scheduler) = &server.scheduler {
+            scheduler.finished(record);
         }
-
-        cmd.arg(batch_file.path());
-        cmd.stderr(Stdio::piped());
-        cmd.stdout(Stdio::null());
-
-        let mut child = match cmd.spawn() {
-            Ok(c) => c,
-            Err(e) => {
-                error!("Failed to spawn batch process: {}", e);
-                total_failed.fetch_add(chunk.len(), Ordering::Relaxed);
-                pb.inc(chunk.len() as u64);
-                return;
+        match result {
+            Ok(stats) => {
+                total_success.fetch_add(1, Ordering::Relaxed);
+                if let (Some(stats), Ok(mut job_stats)) = (stats, job_stats.lock()) {
+                    job_stats.push(stats);
+                }
+                encoded(record);
             }
-        };
-
-        // Read stderr for progress updates
-        if let Some(stderr) = child.stderr.take() {
-            let reader = BufReader::new(stderr);
-
-            for line in reader.lines().flatten() {
-                if line.starts_with("OK:") {
-                    total_success.fetch_add(1, Ordering::Relaxed);
-                    pb.inc(1);
-                } else if line.starts_with("FAIL:") {
-                    // Extract failed file path for fallback
-                    let parts: Vec<&str> = line.splitn(4, ':').collect();
-                    if parts.len() >= 3 {
-                        let failed_path = parts[2].to_string();
-                        if let Some(record) = record_map.get(&failed_path) {
-                            if texconv_fallback.is_some() {
-                                // Don't count as failed yet - will retry with texconv
-                                if let Ok(mut failed) = failed_records.lock() {
-                                    failed.push(*record);
-                                }
-                            } else {
-                                total_failed.fetch_add(1, Ordering::Relaxed);
-                                error!("NVTT3 batch failed: {} - {}", parts[2], parts.get(3).unwrap_or(&"unknown error"));
-                            }
-                        } else {
-                            total_failed.fetch_add(1, Ordering::Relaxed);
-                            error!("NVTT3 batch failed: {} - {}", parts[2], parts.get(3).unwrap_or(&"unknown error"));
-                        }
-                    } else {
-                        total_failed.fetch_add(1, Ordering::Relaxed);
+            Err(reason) => {
+                if texconv_fallback.is_some() {
+                    // Don't count as failed yet - will retry with texconv
+                    if let Ok(mut failed) = failed_records.lock() {
+                        failed.push(record);
                     }
-                    pb.inc(1);
-                } else if line.starts_with("CUDA:") {
-                    debug!("NVTT3 batch {}: {}", batch_num, line);
+                } else {
+                    total_failed.fetch_add(1, Ordering::Relaxed);
+                    error!("NVTT3 batch failed: {} - {}", record.internal_path, reason);
                 }
             }
         }
-
-        // Wait for process to finish
-        if let Err(e) = child.wait() {
-            error!("Failed to wait for batch process: {}", e);
-        }
+        pb.inc(1);
     });
 
     let mut success = total_success.into_inner();
     let mut failed = total_failed.into_inner();
 
+    if let Ok(mut timings) = server.timings.lock() {
+        timings.add_batch(&job_stats.into_inner().unwrap_or_default(), start_time.elapsed());
+    }
+
     pb.finish_with_message(format!(
         "NVTT3: {} success, {} failed",
         success, failed
@@ -1024,6 +2089,7 @@ fn process_batch_nvtt3_batched(
                 match process_single_texture(record, format, texconv_path) {
                     Ok(_) => {
                         fallback_success.fetch_add(1, Ordering::Relaxed);
+                        encoded(record);
                         debug!("Texconv fallback succeeded: {}", record.internal_path);
                     }
                     Err(e) => {
@@ -1068,6 +2134,7 @@ pub fn process_batch_nvtt3_perfile(
     format: Option<&str>,
     nvtt_tool_path: &Path,
     lib_path: Option<&Path>,
+    encoded: OnEncoded,
 ) -> Result<(usize, usize)> {
     if batch.is_empty() {
         return Ok((0, 0));
@@ -1096,11 +2163,12 @@ pub fn process_batch_nvtt3_perfile(
     );
     pb.set_message(format!("[{}]", format_name));
 
-    // Process in parallel using the thread pool configured by optimize_all
-    batch.par_iter().for_each(|record| {
+    // Process in parallel using the thread pool configured by optimize_all, in batch order
+    for_each_in_order(batch, |record| {
         match process_single_texture_nvtt3(record, format, nvtt_tool_path, lib_path) {
             Ok(_) => {
                 total_success.fetch_add(1, Ordering::Relaxed);
+                encoded(record);
             }
             Err(e) => {
                 error!("NVTT3 failed for {}: {}", record.internal_path, e);
@@ -1129,30 +2197,43 @@ pub fn process_delete_batch(batch: &[ProcessingRecord]) -> Result<(usize, usize)
     let failed = AtomicUsize::new(0);
 
     batch.par_iter().for_each(|record| {
-            match fs::remove_file(&record.extracted_path) {
-                Ok(_) => {
-                    debug!(
-                        "Deleted (already optimal): {} ({}x{})",
-                        record.internal_path, record.current_width, record.current_height
-                    );
-                    success.fetch_add(1, Ordering::Relaxed);
-                }
-                Err(e) => {
-                    error!("Failed to delete {}: {}", record.internal_path, e);
-                    failed.fetch_add(1, Ordering::Relaxed);
-                }
+        // Deferred textures were never written, so there is nothing to delete
+        if !record.extracted {
+            success.fetch_add(1, Ordering::Relaxed);
+            return;
+        }
+        match fs::remove_file(&record.extracted_path) {
+            Ok(_) => {
+                debug!(
+                    "Deleted (already optimal): {} ({}x{})",
+                    record.internal_path, record.current_width, record.current_height
+                );
+                success.fetch_add(1, Ordering::Relaxed);
             }
-        });
+            Err(e) => {
+                error!("Failed to delete {}: {}", record.internal_path, e);
+                failed.fetch_add(1, Ordering::Relaxed);
+            }
+        }
+    });
 
     Ok((success.into_inner(), failed.into_inner()))
 }
 
 /// Optimize all texture groups using the specified backend
+/// With a `cache`, textures whose source and settings match an earlier run are
+/// restored from it instead of being encoded, and new outputs are added to it.
+/// With a `packer`, every output is queued for its BSA archive as soon as it exists.
+/// With a `budget`, NVTT3 jobs get the encoder quality that finishes the run by its
+/// deadline (see `QualityScheduler`).
 pub fn optimize_all(
     groups: &ProcessingGroups,
     tools: &CompressionTools,
     backend: CompressionBackend,
     thread_count: Option<usize>,
+    cache: Option<&OutputCache>,
+    packer: Option<&BsaWriter>,
+    budget: Option<TimeBudget>,
 ) -> Result<OptimizationStats> {
     let num_threads = thread_count.unwrap_or_else(num_cpus::get);
 
@@ -1194,6 +2275,33 @@ pub fn optimize_all(
         .num_threads(num_threads)
         .build()?;
 
+    // One persistent NVTT3 server for the whole run, decoding on one stream per worker thread
+    let nvtt3_server = match backend {
+        CompressionBackend::Nvtt3 => {
+            // Batch tool lives alongside the single-file tool
+            let batch_path = tools.nvtt3_batch_path.clone().or_else(|| {
+                tools
+                    .nvtt3_path
+                    .as_ref()
+                    .and_then(|p| p.parent())
+                    .map(|p| p.join("nvtt_batch_compress"))
+                    .filter(|p| p.exists())
+            });
+            batch_path.map(|path| {
+                let mut server = Nvtt3Server::new(&path, tools.nvtt3_lib_path.as_deref(), num_threads);
+                server.auto_bc1 = tools.auto_bc1;
+                server.in_process = tools.nvtt3_in_process;
+                server.scheduler = budget.map(|budget| QualityScheduler::new(budget, groups));
+                server
+            })
+        }
+        CompressionBackend::Texconv => None,
+    };
+    let scheduler = nvtt3_server.as_ref().and_then(|s| s.scheduler.as_ref());
+    if budget.is_some() && scheduler.is_none() {
+        warn!("Time budget ignored: per-job quality needs the NVTT3 batch server");
+    }
+
     let start_time = std::time::Instant::now();
     let mut stats = OptimizationStats::default();
     stats.skipped_small = groups.skipped_small;
@@ -1206,46 +2314,94 @@ pub fn optimize_all(
         stats.failed += failed;
     }
 
-    // Helper macro to process a batch with the selected backend
-    macro_rules! process_group {
-        ($group:expr, $format:expr, $name:expr) => {
-            if !$group.is_empty() {
-                info!("Processing {} {} textures...", $group.len(), $name);
-                let (success, failed) = match backend {
-                    CompressionBackend::Texconv => {
-                        let texconv_path = tools.texconv_path.as_ref().unwrap();
-                        pool.install(|| process_batch_texconv(&$group, $format, texconv_path))?
-                    }
-                    CompressionBackend::Nvtt3 => {
-                        // nvtt_resize_compress handles resize + compress in one CUDA step
-                        // Falls back to texconv for files NVTT3 can't load (malformed DDS headers)
-                        let nvtt3_path = tools.nvtt3_path.as_ref().unwrap();
-                        let lib_path = tools.nvtt3_lib_path.as_deref();
-                        let texconv_fallback = tools.texconv_path.as_deref();
-                        pool.install(|| process_batch_nvtt3(&$group, $format, nvtt3_path, lib_path, texconv_fallback))?
-                    }
-                };
-                stats.optimized += success;
-                stats.failed += failed;
+    let tool_fingerprint = tools.fingerprint(backend);
+
+    // Process all texture groups
+    for (group, format, name) in groups.encode_groups() {
+        if group.is_empty() {
+            continue;
+        }
+        info!("Processing {} {} textures...", group.len(), name);
+
+        // Unchanged textures come straight from the cache, and each set of
+        // identical sources is encoded once and linked to the other outputs
+        let plan = pool.install(|| plan_group(group, format, &tool_fingerprint, cache, scheduler));
+        let pending = &plan.pending;
+        let duplicates = plan.duplicate_count();
+        let cached = plan.cached.len();
+        if cached > 0 || duplicates > 0 {
+            info!(
+                "  {} restored from cache, {} duplicates of other sources, {} to encode",
+                cached,
+                duplicates,
+                pending.len()
+            );
+        }
+        if let Some(packer) = packer {
+            for output in &plan.cached {
+                packer.add(output, &[]);
+            }
+        }
+        if let Some(scheduler) = scheduler {
+            let sent: HashSet<&PathBuf> = pending.iter().map(|r| &r.extracted_path).collect();
+            scheduler.remove_work(group.iter().filter(|r| !sent.contains(&r.extracted_path)), format);
+        }
+        let linked = AtomicUsize::new(0);
+        let encoded = |record: &ProcessingRecord| {
+            let output = &record.extracted_path;
+            // An output the budget encoded below its preferred quality isn't what its key promises
+            let downgraded = scheduler.map_or(false, |s| s.downgraded(output));
+            if let (Some(cache), Some(key), false) = (cache, plan.keys.get(output), downgraded) {
+                if let Err(e) = cache.store(key, output) {
+                    warn!("Output cache: failed to store {}: {}", record.internal_path, e);
+                }
+            }
+            let copies = plan.link_duplicates(output);
+            linked.fetch_add(copies.len(), Ordering::Relaxed);
+            if let Some(packer) = packer {
+                packer.add(output, &copies);
             }
         };
+
+        let (success, failed) = match backend {
+            CompressionBackend::Texconv => {
+                let texconv_path = tools.texconv_path.as_ref().unwrap();
+                pool.install(|| process_batch_texconv(pending, format, texconv_path, &encoded))?
+            }
+            CompressionBackend::Nvtt3 => {
+                // nvtt_resize_compress handles resize + compress in one CUDA step
+                // Falls back to texconv for files NVTT3 can't load (malformed DDS headers)
+                let nvtt3_path = tools.nvtt3_path.as_ref().unwrap();
+                let lib_path = tools.nvtt3_lib_path.as_deref();
+                let texconv_fallback = tools.texconv_path.as_deref();
+                pool.install(|| process_batch_nvtt3(pending, format, nvtt3_path, lib_path, nvtt3_server.as_ref(), texconv_fallback, &encoded))?
+            }
+        };
+        let linked = linked.into_inner();
+        stats.optimized += success + cached + linked;
+        stats.cached += cached;
+        stats.deduplicated += linked;
+        stats.failed += failed + (duplicates - linked);
     }
 
-    // Process all texture groups
-    process_group!(groups.bc7_resize, Some("BC7"), "BC7");
-    process_group!(groups.bc4_resize, Some("BC4"), "BC4");
-    process_group!(groups.rgba_resize, Some("RGBA"), "RGBA");
-    process_group!(groups.pbr_resize, None, "PBR");
-    process_group!(groups.specular_resize, Some("BC4"), "Specular");  // BC4 for grayscale specular (0.5 bytes/pixel)
-    process_group!(groups.emissive_resize, Some("BC1"), "Emissive");  // BC1 for emissive (has color)
-    process_group!(groups.gloss_resize, Some("BC4"), "Gloss");
+    if let Some(server) = &nvtt3_server {
+        server.log_timing_report();
+    }
+    if let Some(scheduler) = scheduler {
+        scheduler.log_summary();
+    }
+
+    if let Some(cache) = cache {
+        info!("Output cache: {} hits, {} new entries", cache.hits(), cache.stored());
+        cache.evict()?;
+    }
 
     let elapsed = start_time.elapsed();
     stats.duration = elapsed;
 
     info!(
-        "Optimization complete in {:.2?}: {} optimized, {} deleted, {} failed, {} skipped (<512)",
-        elapsed, stats.optimized, stats.deleted, stats.failed, stats.skipped_small
+        "Optimization complete in {:.2?}: {} optimized ({} from cache, {} deduplicated), {} deleted, {} failed, {} skipped (<512)",
+        elapsed, stats.optimized, stats.cached, stats.deduplicated, stats.deleted, stats.failed, stats.skipped_small
     );
 
     Ok(stats)
@@ -1262,15 +2418,239 @@ pub fn optimize_all_legacy(
         nvtt3_path: None,
         nvtt3_batch_path: None,
         nvtt3_lib_path: None,
+        auto_bc1: false,
+        nvtt3_in_process: false,
     };
-    optimize_all(groups, &tools, CompressionBackend::Texconv, thread_count)
+    optimize_all(groups, &tools, CompressionBackend::Texconv, thread_count, None, None, None)
 }
 
 #[derive(Debug, Default)]
 pub struct OptimizationStats {
     pub optimized: usize,
+    pub cached: usize,        // Of `optimized`, restored from the output cache
+    pub deduplicated: usize,  // Of `optimized`, linked to an identical source's output
     pub deleted: usize,
     pub failed: usize,
     pub skipped_small: usize,  // Textures skipped due to being < 512x512
     pub duration: std::time::Duration,
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_nvtt3_ok() {
+        let line = "OK:3/9:/mods/a:b/x.dds:2048x1024->1024x512:BC7:11:\
+                    load=1.5,upload=0.25,resize=2,mips=3,encode=40.5,patch=0,write=0.75";
+        let stats = parse_nvtt3_ok(line).unwrap();
+        assert_eq!(stats.format, "BC7");
+        assert_eq!(stats.source_pixels, 2048 * 1024);
+        assert_eq!(stats.stages, [1.5, 0.25, 2.0, 3.0, 40.5, 0.0, 0.75]);
+
+        // Servers started without --timing
+        assert_eq!(parse_nvtt3_ok("OK:1/1:/a/x.dds:64x64->32x32:BC1:6"), None);
+    }
+
+    #[test]
+    fn test_nvtt3_engine_args() {
+        let args = nvtt3_engine_args(4, false);
+        assert!(args.iter().any(|a| a == "--copy-mips"));
+        assert!(!args.iter().any(|a| a == "--auto-bc1"));
+        assert!(nvtt3_engine_args(4, true).iter().any(|a| a == "--auto-bc1"));
+
+        // Outputs encoded with --auto-bc1 are cached apart from the others
+        let fingerprint = |auto_bc1| {
+            let tools = CompressionTools {
+                texconv_path: None,
+                nvtt3_path: None,
+                nvtt3_batch_path: None,
+                nvtt3_lib_path: None,
+                auto_bc1,
+                nvtt3_in_process: false,
+            };
+            tools.fingerprint(CompressionBackend::Nvtt3)
+        };
+        assert_ne!(fingerprint(false), fingerprint(true));
+    }
+
+    #[test]
+    fn test_in_process_is_opt_in() {
+        // A built library alone doesn't move encoding into this process
+        let dir = tempfile::tempdir().unwrap();
+        fs::write(dir.path().join(radium_encode::LIBRARY_NAME), b"not loaded").unwrap();
+        let server = Nvtt3Server::new(Path::new("nvtt_batch_compress"), Some(dir.path()), 2);
+        assert!(server.engine().is_none());
+    }
+
+    #[test]
+    fn test_nvtt3_result() {
+        let result = EncodeResult {
+            job: 3,
+            error: None,
+            source_width: 2048,
+            source_height: 1024,
+            width: 1024,
+            height: 512,
+            mip_count: 11,
+            format: "BC7".to_string(),
+            stage_ms: [1.5, 0.25, 2.0, 3.0, 40.5, 0.0, 0.75],
+        };
+        // Same stats as the equivalent OK: line
+        let line = "OK:3/0:/a/x.dds:2048x1024->1024x512:BC7:11:\
+                    load=1.5,upload=0.25,resize=2,mips=3,encode=40.5,patch=0,write=0.75";
+        assert_eq!(nvtt3_result(result.clone()), Ok(parse_nvtt3_ok(line)));
+
+        let failed = EncodeResult { error: Some("Failed to load DDS file".to_string()), ..result };
+        assert_eq!(nvtt3_result(failed), Err("Failed to load DDS file".to_string()));
+    }
+
+    #[test]
+    fn test_timing_report() {
+        let job = |format: &str, encode: f64| Nvtt3JobStats {
+            format: format.to_string(),
+            source_pixels: 1_000_000,
+            stages: [0.0, 0.0, 0.0, 0.0, encode, 0.0, 0.0],
+        };
+        let mut report = Nvtt3TimingReport::default();
+        let jobs: Vec<_> = (1..=100).map(|i| job("BC7", i as f64)).collect();
+        report.add_batch(&jobs, std::time::Duration::from_secs(4));
+        report.add_batch(&[job("BC1", 1.0)], std::time::Duration::from_secs(1));
+
+        let mut encode = report.stages[4].clone();
+        encode.sort_by(|a, b| a.total_cmp(b));
+        assert_eq!(Nvtt3TimingReport::percentile(&encode, 50), 50.0);
+        assert_eq!(Nvtt3TimingReport::percentile(&encode, 95), 95.0);
+        assert_eq!(report.formats["BC7"], (100, 100_000_000, 4.0));
+        assert_eq!(report.formats["BC1"], (1, 1_000_000, 1.0));
+    }
+
+    #[test]
+    fn test_schedule_by_cost() {
+        let record = |name: &str, source: u32, target: u32, format: &str| {
+            let mut texture = TextureRecord::from_loose_file(name.to_string(), PathBuf::from(name), 0);
+            texture.format = Some(format.into());
+            ProcessingRecord {
+                internal_path: name.to_string(),
+                record: texture,
+                extracted_path: PathBuf::from(name),
+                target_width: target,
+                target_height: target,
+                texture_type: "Diffuse",
+                current_width: source,
+                current_height: source,
+                oversized: true,
+                extracted: true,
+            }
+        };
+        let mut records = vec![
+            record("icon_a", 512, 256, "BC1"),
+            record("landscape", 8192, 2048, "BC1"),
+            record("icon_b", 512, 256, "BC1"),
+            record("normal", 2048, 1024, "BC7"),
+        ];
+
+        schedule_by_cost(&mut records, None);
+        let order: Vec<_> = records.iter().map(|r| r.internal_path.as_str()).collect();
+        assert_eq!(order, ["landscape", "normal", "icon_a", "icon_b"]);
+
+        // The group's target format weighs in, not just the source's
+        schedule_by_cost(&mut records, Some("BC4"));
+        assert!(estimated_cost(&records[1], Some("BC7")) > estimated_cost(&records[1], Some("BC4")));
+    }
+
+    #[test]
+    fn test_plan_group_duplicates() {
+        let dir = tempfile::tempdir().unwrap();
+        let record = |name: &str, source: &[u8]| {
+            let path = dir.path().join(name);
+            fs::write(&path, source).unwrap();
+            let mut texture = TextureRecord::from_loose_file(name.to_string(), path.clone(), 0);
+            texture.format = Some("BC7".into());
+            ProcessingRecord {
+                internal_path: name.to_string(),
+                record: texture,
+                extracted_path: path,
+                target_width: 1024,
+                target_height: 1024,
+                texture_type: "Diffuse",
+                current_width: 2048,
+                current_height: 2048,
+                oversized: true,
+                extracted: true,
+            }
+        };
+        let group = vec![
+            record("a.dds", b"shared source"),
+            record("b.dds", b"shared source"),
+            record("c.dds", b"other source"),
+        ];
+
+        // The identical pair is encoded once; c shares only its shape
+        let plan = plan_group(&group, Some("BC7"), "tool", None, None);
+        assert_eq!(plan.pending.len(), 2);
+        assert_eq!(plan.duplicate_count(), 1);
+        let (encoded, copy) = match plan.pending.iter().find(|r| r.internal_path != "c.dds") {
+            Some(r) if r.internal_path == "a.dds" => (&group[0], &group[1]),
+            _ => (&group[1], &group[0]),
+        };
+
+        // Linking replaces the duplicate's staged source with the encoded output
+        fs::write(&encoded.extracted_path, b"encoded output").unwrap();
+        assert_eq!(plan.link_duplicates(&encoded.extracted_path), [copy.extracted_path.clone()]);
+        assert_eq!(fs::read(&copy.extracted_path).unwrap(), b"encoded output");
+        assert!(plan.link_duplicates(&group[2].extracted_path).is_empty());
+
+        // Where the filesystem refuses a hardlink, the output is copied instead
+        let dest = dir.path().join("nested/d.dds");
+        let refuse = |_: &Path, _: &Path| Err(std::io::Error::new(std::io::ErrorKind::Other, "cross-device link"));
+        link_output_with(&encoded.extracted_path, &dest, refuse).unwrap();
+        assert_eq!(fs::read(&dest).unwrap(), b"encoded output");
+        assert!(!dest.with_extension("dds.link").exists());
+    }
+
+    #[test]
+    fn test_quality_scheduler() {
+        let record = |name: &str| ProcessingRecord {
+            internal_path: name.to_string(),
+            record: TextureRecord::from_loose_file(name.to_string(), PathBuf::from(name), 0),
+            extracted_path: PathBuf::from(name),
+            target_width: 1024,
+            target_height: 1024,
+            texture_type: "Diffuse",
+            current_width: 2048,
+            current_height: 2048,
+            oversized: true,
+            extracted: true,
+        };
+        let body = record("textures/actors/character/female/femalebody_1.dds");
+        let wall = record("textures/architecture/whiterun/wrwall.dds");
+        let lod = record("textures/lod/whiterunlod.dds");
+        let mut groups = ProcessingGroups::default();
+        groups.bc7_resize = vec![body.clone(), wall.clone(), lod.clone()];
+        let budget = |deadline| TimeBudget { deadline, preset: OptimizationPreset::OPTIMUM };
+
+        // With time to spare, every texture gets its preference
+        let far = Instant::now() + std::time::Duration::from_secs(3600);
+        let scheduler = QualityScheduler::new(budget(far), &groups);
+        assert_eq!(scheduler.choose(&body, Some("bc7")), EncodeQuality::Production);
+        assert_eq!(scheduler.choose(&wall, Some("bc7")), EncodeQuality::Normal);
+        assert_eq!(scheduler.choose(&lod, Some("bc7")), EncodeQuality::Fastest);
+        assert!(!scheduler.downgraded(&body.extracted_path));
+
+        // Past the deadline, once throughput is measured, everything drops to Fastest
+        let scheduler = QualityScheduler::new(budget(Instant::now()), &groups);
+        for _ in 0..SCHEDULER_MIN_SAMPLES {
+            scheduler.choose(&wall, Some("bc7"));
+            scheduler.finished(&wall);
+        }
+        std::thread::sleep(std::time::Duration::from_millis(2));
+        assert_eq!(scheduler.choose(&body, Some("bc7")), EncodeQuality::Fastest);
+        assert!(scheduler.downgraded(&body.extracted_path));
+
+        let line = nvtt3_job(&lod, "bc7", Some(EncodeQuality::Fastest)).unwrap().line;
+        assert!(line.ends_with("|1024|bc7|0|||fastest"), "{}", line);
+        assert_eq!(EncodeQuality::Normal.shifted(5, EncodeQuality::Production), EncodeQuality::Production);
+        assert_eq!(EncodeQuality::Production.shifted(-3, EncodeQuality::Highest), EncodeQuality::Fastest);
+    }
+}
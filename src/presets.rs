@@ -1,6 +1,27 @@
 /// Optimization presets for texture downscaling
 /// Based on texture type, determines maximum resolution
 
+/// How much a texture's encode quality shows on screen, for time-budgeted runs
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+pub enum Importance {
+    Low,
+    Normal,
+    High,
+}
+
+/// Folders of textures seen close up: characters, and the gear they wear and carry
+const CLOSE_UP_FOLDERS: [&str; 4] = [
+    "textures/actors/character/",
+    "textures/armor/",
+    "textures/clothes/",
+    "textures/weapons/",
+];
+
+/// Folders of textures only seen small or far away
+/// Not clutter: it holds hand-held and inventory-inspected items seen up close, so
+/// it's left to the size-ratio rule of `importance` like any other folder.
+const DISTANT_FOLDERS: [&str; 2] = ["textures/lod/", "textures/terrain/"];
+
 #[derive(Debug, Clone, Copy)]
 pub struct OptimizationPreset {
     pub name: &'static str,
@@ -61,18 +82,45 @@ impl OptimizationPreset {
         material_max: 512,
     };
 
+    /// Maximum dimension for a texture type, None for types that aren't optimized
+    fn max_resolution(&self, texture_type: &str) -> Option<u32> {
+        match texture_type {
+            "Diffuse" => Some(self.diffuse_max),
+            "Normal" => Some(self.normal_max),
+            "Parallax" => Some(self.parallax_max),
+            "Specular" | "Emissive" | "Emissive Mask" | "Subsurface" | "Environment" | "Multi-layer" => {
+                Some(self.material_max)
+            }
+            _ => None,
+        }
+    }
+
+    /// On-screen importance of a texture
+    /// Character and gear diffuse and normal maps are High, LOD and terrain Low.
+    /// So is any type this preset keeps at a quarter of the diffuse size or less:
+    /// the preset has already traded its detail for VRAM.
+    pub fn importance(&self, texture_type: &str, internal_path: &str) -> Importance {
+        let path = internal_path.to_lowercase().replace('\\', "/");
+        if DISTANT_FOLDERS.iter().any(|folder| path.starts_with(folder)) || path.contains("/lod/") {
+            return Importance::Low;
+        }
+        if matches!(texture_type, "Diffuse" | "Normal")
+            && CLOSE_UP_FOLDERS.iter().any(|folder| path.starts_with(folder))
+        {
+            return Importance::High;
+        }
+        match self.max_resolution(texture_type) {
+            Some(max_res) if max_res * 4 <= self.diffuse_max => Importance::Low,
+            _ => Importance::Normal,
+        }
+    }
+
     /// Get target resolution for a texture based on its type
     /// Returns None if texture should not be optimized
     pub fn get_target_resolution(&self, texture_type: &str, current_width: u32, current_height: u32) -> Option<(u32, u32)> {
         // Determine max dimension based on texture type
-        let max_res = match texture_type {
-            "Diffuse" => self.diffuse_max,
-            "Normal" => self.normal_max,
-            "Parallax" => self.parallax_max,
-            "Specular" | "Emissive" | "Emissive Mask" | "Subsurface" | "Environment" | "Multi-layer" => {
-                self.material_max
-            }
-            _ => return None, // Unknown type, skip
+        let Some(max_res) = self.max_resolution(texture_type) else {
+            return None; // Unknown type, skip
         };
 
         // Use the larger dimension to determine if downscaling needed
@@ -178,4 +226,22 @@ mod tests {
         let target = preset.get_target_resolution("Normal", 2048, 4096);
         assert_eq!(target, Some((512, 1024)));
     }
+
+    #[test]
+    fn test_importance() {
+        let preset = OptimizationPreset::OPTIMUM;
+        let importance = |texture_type, path| preset.importance(texture_type, path);
+
+        assert_eq!(importance("Diffuse", "textures/actors/character/female/femalebody_1.dds"), Importance::High);
+        assert_eq!(importance("Normal", "textures/armor/steel/cuirass_n.dds"), Importance::High);
+        assert_eq!(importance("Diffuse", "textures/architecture/whiterun/wrwall.dds"), Importance::Normal);
+        assert_eq!(importance("Diffuse", "textures/lod/whiterunlod.dds"), Importance::Low);
+        // Clutter is picked up and inspected, so only its size ratio can lower it
+        assert_eq!(importance("Diffuse", "textures/clutter/bucket.dds"), Importance::Normal);
+        assert_eq!(importance("Parallax", "textures/clutter/bucket_p.dds"), Importance::Low);
+        // Optimum keeps parallax and material maps at 512 against 2K diffuse
+        assert_eq!(importance("Parallax", "textures/architecture/whiterun/wrwall_p.dds"), Importance::Low);
+        assert_eq!(importance("Specular", "textures/armor/steel/cuirass_s.dds"), Importance::Low);
+        assert_eq!(OptimizationPreset::HQ.importance("Specular", "textures/armor/steel/cuirass_s.dds"), Importance::Normal);
+    }
 }
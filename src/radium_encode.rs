@@ -0,0 +1,256 @@
+/// In-process NVTT3 encoder: bindings to libradium_encode.so (tools/nvtt3/radium_encode.h)
+/// The library runs the nvtt_batch_compress pipeline inside this process, so jobs are
+/// handed over by function call and results come back as structs, with no process to
+/// spawn and no stderr lines to parse. It is loaded at runtime when optimize runs with
+/// --in-process; without it the caller falls back to the server process.
+
+use anyhow::Result;
+use std::ffi::{c_char, c_int, c_void, CStr, CString};
+use std::os::unix::ffi::OsStrExt;
+use std::path::Path;
+use std::time::Duration;
+
+/// File name of the library, next to nvtt_batch_compress and libnvtt.so
+pub const LIBRARY_NAME: &str = "libradium_encode.so";
+
+/// RADIUM_ENCODE_ABI_VERSION this binding was written against
+const ABI_VERSION: c_int = 1;
+
+/// Entries of `stage_ms`, as in `nvtt_batch_compress --timing`
+pub const STAGE_COUNT: usize = 7;
+
+#[repr(C)]
+struct RawResult {
+    job: c_int,
+    ok: c_int,
+    error: *const c_char,
+    source_width: c_int,
+    source_height: c_int,
+    width: c_int,
+    height: c_int,
+    mip_count: c_int,
+    format: *const c_char,
+    stage_ms: [f64; STAGE_COUNT],
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct RawStats {
+    submitted: c_int,
+    succeeded: c_int,
+    failed: c_int,
+    pending: c_int,
+    gpus: c_int,
+}
+
+/// One finished job
+#[derive(Debug, Clone, PartialEq)]
+pub struct EncodeResult {
+    /// Number `submit` returned for the job
+    pub job: usize,
+    /// Why the job failed, None when its output was written
+    pub error: Option<String>,
+    pub source_width: u32,
+    pub source_height: u32,
+    pub width: u32,
+    pub height: u32,
+    pub mip_count: u32,
+    /// Format written, e.g. "BC7"
+    pub format: String,
+    /// Milliseconds per stage: load, upload, resize, mips, encode, patch, write
+    pub stage_ms: [f64; STAGE_COUNT],
+}
+
+/// Engine counters, see `radium_stats`
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub struct EncodeStats {
+    pub submitted: usize,
+    pub succeeded: usize,
+    pub failed: usize,
+    /// Submitted but not returned by `poll` yet
+    pub pending: usize,
+    /// CUDA devices in use, 0 = CPU engine only
+    pub gpus: usize,
+}
+
+type CreateFn = unsafe extern "C" fn(c_int, *const *const c_char) -> *mut c_void;
+type DestroyFn = unsafe extern "C" fn(*mut c_void);
+type SubmitFn = unsafe extern "C" fn(*mut c_void, *const c_char) -> c_int;
+type SubmitMemoryFn = unsafe extern "C" fn(*mut c_void, *const c_char, *const c_void, usize) -> c_int;
+type PollFn = unsafe extern "C" fn(*mut c_void, *mut RawResult, c_int, c_int) -> c_int;
+type StatsFn = unsafe extern "C" fn(*mut c_void, *mut RawStats);
+type VersionFn = unsafe extern "C" fn() -> c_int;
+
+const RTLD_NOW: c_int = 2;
+
+#[link(name = "dl")]
+extern "C" {
+    fn dlopen(filename: *const c_char, flags: c_int) -> *mut c_void;
+    fn dlsym(handle: *mut c_void, symbol: *const c_char) -> *mut c_void;
+    fn dlerror() -> *const c_char;
+}
+
+fn dl_error() -> String {
+    // SAFETY: dlerror returns null or a NUL-terminated string owned by libdl
+    unsafe {
+        let message = dlerror();
+        if message.is_null() {
+            "unknown error".to_string()
+        } else {
+            CStr::from_ptr(message).to_string_lossy().into_owned()
+        }
+    }
+}
+
+/// Address of `name` in `handle`, as a function pointer of type `T`
+unsafe fn symbol<T: Copy>(handle: *mut c_void, name: &str) -> Result<T> {
+    let c_name = CString::new(name)?;
+    let address = dlsym(handle, c_name.as_ptr());
+    if address.is_null() {
+        anyhow::bail!("{}: {}", name, dl_error());
+    }
+    Ok(std::mem::transmute_copy(&address))
+}
+
+/// A running engine. The library keeps it thread-safe, so one engine can be shared by
+/// every thread; only one may exist per process. The library stays loaded for the rest
+/// of the run, as CUDA and NVTT don't support being unloaded.
+pub struct RadiumEngine {
+    engine: *mut c_void,
+    destroy: DestroyFn,
+    submit: SubmitFn,
+    submit_memory: SubmitMemoryFn,
+    poll: PollFn,
+    stats: StatsFn,
+}
+
+// SAFETY: every radium_engine_* function may be called from any thread
+unsafe impl Send for RadiumEngine {}
+unsafe impl Sync for RadiumEngine {}
+
+impl RadiumEngine {
+    /// Load the library from `lib_dir` and start an engine with the given
+    /// nvtt_batch_compress options (--streams, --pack, ...)
+    pub fn load(lib_dir: &Path, args: &[String]) -> Result<Self> {
+        let path = lib_dir.join(LIBRARY_NAME);
+        if !path.exists() {
+            anyhow::bail!("{:?} not found", path);
+        }
+        let c_path = CString::new(path.as_os_str().as_bytes())?;
+        let c_args = args
+            .iter()
+            .map(|arg| CString::new(arg.as_str()))
+            .collect::<Result<Vec<_>, _>>()?;
+        let argv: Vec<*const c_char> = c_args.iter().map(|arg| arg.as_ptr()).collect();
+
+        // SAFETY: the symbols are the C ABI of radium_encode.h, checked by its version
+        unsafe {
+            let handle = dlopen(c_path.as_ptr(), RTLD_NOW);
+            if handle.is_null() {
+                anyhow::bail!("failed to load {:?}: {}", path, dl_error());
+            }
+
+            let version: VersionFn = symbol(handle, "radium_abi_version")?;
+            if version() != ABI_VERSION {
+                anyhow::bail!("{:?} has ABI version {}, expected {}", path, version(), ABI_VERSION);
+            }
+
+            let create: CreateFn = symbol(handle, "radium_engine_create")?;
+            let mut engine = Self {
+                engine: std::ptr::null_mut(),
+                destroy: symbol(handle, "radium_engine_destroy")?,
+                submit: symbol(handle, "radium_engine_submit")?,
+                submit_memory: symbol(handle, "radium_engine_submit_memory")?,
+                poll: symbol(handle, "radium_engine_poll")?,
+                stats: symbol(handle, "radium_engine_stats")?,
+            };
+            engine.engine = create(argv.len() as c_int, argv.as_ptr());
+            if engine.engine.is_null() {
+                anyhow::bail!("radium_engine_create failed (bad option, or an engine already exists)");
+            }
+            Ok(engine)
+        }
+    }
+
+    /// Queue a job line `input|output|max_extent|format|srgb[|header[|kind[|quality]]]`, with the
+    /// source DDS bytes when they're in memory (the input field is then ignored).
+    /// Returns the job's number, or None if the line was rejected.
+    pub fn submit(&self, job: &str, source: Option<&[u8]>) -> Option<usize> {
+        let c_job = CString::new(job).ok()?;
+        // SAFETY: the engine is live until drop; the library copies the job and source
+        let number = unsafe {
+            match source {
+                Some(data) => (self.submit_memory)(
+                    self.engine,
+                    c_job.as_ptr(),
+                    data.as_ptr() as *const c_void,
+                    data.len(),
+                ),
+                None => (self.submit)(self.engine, c_job.as_ptr()),
+            }
+        };
+        (number > 0).then_some(number as usize)
+    }
+
+    /// Finished jobs, up to `max`, waiting up to `timeout` for the first (None = until one
+    /// finishes). Empty right away when nothing is pending.
+    pub fn poll(&self, max: usize, timeout: Option<Duration>) -> Vec<EncodeResult> {
+        let timeout_ms = timeout.map_or(-1, |t| t.as_millis().min(i32::MAX as u128) as c_int);
+        let mut raw: Vec<RawResult> = Vec::with_capacity(max.max(1));
+
+        // SAFETY: the library writes at most `capacity` results into the buffer
+        let count = unsafe {
+            let count = (self.poll)(self.engine, raw.as_mut_ptr(), raw.capacity() as c_int, timeout_ms);
+            raw.set_len(count.max(0) as usize);
+            count
+        };
+        if count <= 0 {
+            return Vec::new();
+        }
+
+        raw.iter()
+            .map(|result| {
+                // SAFETY: error and format are null or static strings in the library
+                let text = |s: *const c_char| unsafe {
+                    (!s.is_null()).then(|| CStr::from_ptr(s).to_string_lossy().into_owned())
+                };
+                EncodeResult {
+                    job: result.job.max(0) as usize,
+                    error: if result.ok != 0 {
+                        None
+                    } else {
+                        Some(text(result.error).unwrap_or_else(|| "unknown error".to_string()))
+                    },
+                    source_width: result.source_width.max(0) as u32,
+                    source_height: result.source_height.max(0) as u32,
+                    width: result.width.max(0) as u32,
+                    height: result.height.max(0) as u32,
+                    mip_count: result.mip_count.max(0) as u32,
+                    format: text(result.format).unwrap_or_default(),
+                    stage_ms: result.stage_ms,
+                }
+            })
+            .collect()
+    }
+
+    pub fn stats(&self) -> EncodeStats {
+        let mut raw = RawStats::default();
+        // SAFETY: the engine is live until drop
+        unsafe { (self.stats)(self.engine, &mut raw) };
+        EncodeStats {
+            submitted: raw.submitted.max(0) as usize,
+            succeeded: raw.succeeded.max(0) as usize,
+            failed: raw.failed.max(0) as usize,
+            pending: raw.pending.max(0) as usize,
+            gpus: raw.gpus.max(0) as usize,
+        }
+    }
+}
+
+impl Drop for RadiumEngine {
+    fn drop(&mut self) {
+        // Finishes every submitted job first
+        // SAFETY: created by radium_engine_create and not used after this
+        unsafe { (self.destroy)(self.engine) };
+    }
+}
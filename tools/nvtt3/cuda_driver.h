@@ -0,0 +1,357 @@
+/*
+ * cuda_driver.h - minimal CUDA driver API loader for the NVTT3 tools
+ *
+ * libnvtt links the CUDA runtime statically and doesn't export it, so the
+ * tools reach device memory through the driver API in libcuda.so.1, loaded at
+ * run time. Nothing here is required: if the driver can't be loaded the tools
+ * simply keep their host-memory paths.
+ *
+ * Allocations are made in the device's primary context, which is the context
+ * the CUDA runtime (and so NVTT) uses, so pointers are interchangeable.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <dlfcn.h>
+
+typedef int CUresult;
+typedef int CUdevice;
+typedef struct CUctx_st* CUcontext;
+typedef unsigned long long CUdeviceptr;
+
+static const CUresult CUDA_SUCCESS = 0;
+static const unsigned int CU_MEMHOSTALLOC_PORTABLE = 0x01;
+
+class CudaDriver {
+public:
+    static const int kMaxDevices = 16;
+
+    // The process-wide driver, loaded and initialized on first use
+    static CudaDriver& get() {
+        static CudaDriver driver;
+        return driver;
+    }
+
+    bool available() const { return m_available; }
+
+    // Number of visible CUDA devices (0 if the driver isn't available)
+    int deviceCount() {
+        int count = 0;
+        if (!m_available || m_cuDeviceGetCount(&count) != CUDA_SUCCESS) return 0;
+        return count < kMaxDevices ? count : kMaxDevices;
+    }
+
+    // Make `device`'s primary context current on the calling thread
+    bool makeCurrent(int device) {
+        if (!m_available || device < 0 || device >= kMaxDevices) return false;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_contexts[device]) {
+            CUdevice dev;
+            CUcontext ctx;
+            if (m_cuDeviceGet(&dev, device) != CUDA_SUCCESS ||
+                m_cuDevicePrimaryCtxRetain(&ctx, dev) != CUDA_SUCCESS) {
+                return false;
+            }
+            m_contexts[device] = ctx;
+        }
+        return m_cuCtxSetCurrent(m_contexts[device]) == CUDA_SUCCESS;
+    }
+
+    // The context current on the calling thread; null if none
+    CUcontext current() {
+        CUcontext ctx = nullptr;
+        if (!m_available || m_cuCtxGetCurrent(&ctx) != CUDA_SUCCESS) return nullptr;
+        return ctx;
+    }
+
+    // Make `ctx` (a value from current(), null included) current again
+    bool restore(CUcontext ctx) {
+        return m_available && m_cuCtxSetCurrent(ctx) == CUDA_SUCCESS;
+    }
+
+    bool alloc(CUdeviceptr* ptr, size_t bytes) {
+        return m_cuMemAlloc(ptr, bytes) == CUDA_SUCCESS;
+    }
+
+    void free(CUdeviceptr ptr) {
+        if (ptr) m_cuMemFree(ptr);
+    }
+
+    bool copyToHost(void* dst, CUdeviceptr src, size_t bytes) {
+        return m_cuMemcpyDtoH(dst, src, bytes) == CUDA_SUCCESS;
+    }
+
+    bool copyToDevice(CUdeviceptr dst, const void* src, size_t bytes) {
+        return m_cuMemcpyHtoD && m_cuMemcpyHtoD(dst, src, bytes) == CUDA_SUCCESS;
+    }
+
+    // Page-locked host memory usable from every context. Optional: false when
+    // the driver lacks it, and the caller falls back to pageable memory.
+    bool allocHost(void** ptr, size_t bytes) {
+        if (!m_available || !m_cuMemHostAlloc) return false;
+        return m_cuMemHostAlloc(ptr, bytes, CU_MEMHOSTALLOC_PORTABLE) == CUDA_SUCCESS;
+    }
+
+    void freeHost(void* ptr) {
+        if (ptr && m_cuMemFreeHost) m_cuMemFreeHost(ptr);
+    }
+
+private:
+    CudaDriver() {
+        m_lib = dlopen("libcuda.so.1", RTLD_NOW | RTLD_LOCAL);
+        if (!m_lib) return;
+
+        bool ok = sym(m_cuInit, "cuInit") &&
+                  sym(m_cuDeviceGetCount, "cuDeviceGetCount") &&
+                  sym(m_cuDeviceGet, "cuDeviceGet") &&
+                  sym(m_cuDevicePrimaryCtxRetain, "cuDevicePrimaryCtxRetain") &&
+                  sym(m_cuCtxGetCurrent, "cuCtxGetCurrent") &&
+                  sym(m_cuCtxSetCurrent, "cuCtxSetCurrent") &&
+                  sym(m_cuMemAlloc, "cuMemAlloc_v2") &&
+                  sym(m_cuMemFree, "cuMemFree_v2") &&
+                  sym(m_cuMemcpyDtoH, "cuMemcpyDtoH_v2");
+        m_available = ok && m_cuInit(0) == CUDA_SUCCESS;
+
+        // Only the BufferPool needs these, and it copes without them
+        if (!sym(m_cuMemHostAlloc, "cuMemHostAlloc") || !sym(m_cuMemFreeHost, "cuMemFreeHost")) {
+            m_cuMemHostAlloc = nullptr;
+            m_cuMemFreeHost = nullptr;
+        }
+        sym(m_cuMemcpyHtoD, "cuMemcpyHtoD_v2");
+    }
+
+    // Primary contexts stay retained for the life of the process
+    ~CudaDriver() = default;
+    CudaDriver(const CudaDriver&) = delete;
+    CudaDriver& operator=(const CudaDriver&) = delete;
+
+    template <typename Fn>
+    bool sym(Fn& fn, const char* name) {
+        fn = reinterpret_cast<Fn>(dlsym(m_lib, name));
+        return fn != nullptr;
+    }
+
+    void* m_lib = nullptr;
+    bool m_available = false;
+    std::mutex m_mutex;
+    CUcontext m_contexts[kMaxDevices] = {};
+
+    CUresult (*m_cuInit)(unsigned int) = nullptr;
+    CUresult (*m_cuDeviceGetCount)(int*) = nullptr;
+    CUresult (*m_cuDeviceGet)(CUdevice*, int) = nullptr;
+    CUresult (*m_cuDevicePrimaryCtxRetain)(CUcontext*, CUdevice) = nullptr;
+    CUresult (*m_cuCtxGetCurrent)(CUcontext*) = nullptr;
+    CUresult (*m_cuCtxSetCurrent)(CUcontext) = nullptr;
+    CUresult (*m_cuMemAlloc)(CUdeviceptr*, size_t) = nullptr;
+    CUresult (*m_cuMemFree)(CUdeviceptr) = nullptr;
+    CUresult (*m_cuMemcpyDtoH)(void*, CUdeviceptr, size_t) = nullptr;
+    CUresult (*m_cuMemcpyHtoD)(CUdeviceptr, const void*, size_t) = nullptr;
+    CUresult (*m_cuMemHostAlloc)(void**, size_t, unsigned int) = nullptr;
+    CUresult (*m_cuMemFreeHost)(void*) = nullptr;
+};
+
+// Device allocation reused across submissions; grows, never shrinks
+class DeviceBuffer {
+public:
+    DeviceBuffer() = default;
+    ~DeviceBuffer() { CudaDriver::get().free(m_ptr); }
+    DeviceBuffer(const DeviceBuffer&) = delete;
+    DeviceBuffer& operator=(const DeviceBuffer&) = delete;
+
+    // Make room for at least `bytes`; the contents are not preserved
+    bool reserve(size_t bytes) {
+        if (bytes <= m_size) return true;
+        CudaDriver& driver = CudaDriver::get();
+        driver.free(m_ptr);
+        m_ptr = 0;
+        m_size = 0;
+        if (!driver.alloc(&m_ptr, bytes)) return false;
+        m_size = bytes;
+        return true;
+    }
+
+    void* data() const { return reinterpret_cast<void*>(m_ptr); }
+    CUdeviceptr ptr() const { return m_ptr; }
+
+private:
+    CUdeviceptr m_ptr = 0;
+    size_t m_size = 0;
+};
+
+// Host and device buffers kept for a whole batch or server session and handed
+// out per job, so jobs stop paying an allocation each (and, on the device, a
+// cuMemAlloc/cuMemFree pair). Sizes round up to a power of two and a returned
+// buffer waits in its size class for the next job that fits it, up to
+// kMaxIdleBytes of idle buffers per kind. With pinning enabled host buffers
+// are page-locked, so host-to-device copies from them DMA directly instead of
+// bouncing through the driver's staging memory.
+class BufferPool {
+public:
+    static const size_t kMinBytes = 64 * 1024;
+    static const size_t kMaxIdleBytes = 256 * 1024 * 1024;
+    static const int kHost = -1; // `device` of host buffers
+
+    // A checked-out buffer; goes back to the pool when destroyed
+    class Buffer {
+    public:
+        Buffer() = default;
+        Buffer(Buffer&& other) noexcept { *this = std::move(other); }
+        Buffer& operator=(Buffer&& other) noexcept {
+            if (this != &other) {
+                release();
+                m_ptr = other.m_ptr;
+                m_size = other.m_size;
+                m_device = other.m_device;
+                m_pinned = other.m_pinned;
+                other.m_ptr = 0;
+                other.m_size = 0;
+            }
+            return *this;
+        }
+        ~Buffer() { release(); }
+
+        explicit operator bool() const { return m_ptr != 0; }
+        void* data() const { return reinterpret_cast<void*>(m_ptr); }
+        CUdeviceptr ptr() const { return m_ptr; }
+        size_t size() const { return m_size; }
+        bool pinned() const { return m_pinned; }
+
+        void release() {
+            if (m_ptr) BufferPool::get().give(*this);
+            m_ptr = 0;
+            m_size = 0;
+        }
+
+    private:
+        friend class BufferPool;
+        CUdeviceptr m_ptr = 0;   // host pointer for host buffers
+        size_t m_size = 0;       // size class, at least what was asked for
+        int m_device = kHost;
+        bool m_pinned = false;
+    };
+
+    static BufferPool& get() {
+        static BufferPool pool;
+        return pool;
+    }
+
+    // Page-lock host buffers allocated from now on (only with a CUDA device)
+    void enablePinned(bool pinned) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pinnedEnabled = pinned && CudaDriver::get().available();
+    }
+
+    // A host buffer of at least `bytes`; empty if the allocation failed
+    Buffer host(size_t bytes) { return take(kHost, bytes); }
+
+    // A buffer of at least `bytes` on `device`; empty without the driver
+    Buffer device(int device, size_t bytes) {
+        if (device < 0 || !CudaDriver::get().available()) return Buffer();
+        return take(device, bytes);
+    }
+
+private:
+    BufferPool() { CudaDriver::get(); } // the driver must outlive the pool
+    ~BufferPool() {
+        for (Entry& entry : m_idle) destroy(entry);
+    }
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    struct Entry {
+        CUdeviceptr ptr;
+        size_t size;
+        int device;
+        bool pinned;
+    };
+
+    static size_t sizeClass(size_t bytes) {
+        size_t size = kMinBytes;
+        while (size < bytes) size *= 2;
+        return size;
+    }
+
+    Buffer take(int device, size_t bytes) {
+        Buffer buffer;
+        size_t size = sizeClass(bytes);
+        bool pinned;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (size_t i = 0; i < m_idle.size(); i++) {
+                Entry& entry = m_idle[i];
+                if (entry.device == device && entry.size == size) {
+                    buffer.m_ptr = entry.ptr;
+                    buffer.m_size = size;
+                    buffer.m_device = device;
+                    buffer.m_pinned = entry.pinned;
+                    idleBytes(device) -= size;
+                    m_idle[i] = m_idle.back();
+                    m_idle.pop_back();
+                    return buffer;
+                }
+            }
+            pinned = m_pinnedEnabled;
+        }
+
+        CudaDriver& driver = CudaDriver::get();
+        if (device != kHost) {
+            if (!driver.makeCurrent(device) || !driver.alloc(&buffer.m_ptr, size)) return Buffer();
+        } else {
+            void* ptr = nullptr;
+            if (pinned) {
+                // Portable pinned memory only needs some context current to
+                // allocate. The caller may be a GPU worker bound to its own
+                // device, so use whatever is current and borrow device 0's
+                // only when nothing is, leaving the thread as it was.
+                CUcontext previous = driver.current();
+                bool borrowed = !previous && driver.makeCurrent(0);
+                buffer.m_pinned = (previous || borrowed) && driver.allocHost(&ptr, size);
+                if (borrowed) driver.restore(previous);
+            }
+            if (!buffer.m_pinned) ptr = std::malloc(size);
+            if (!ptr) return Buffer();
+            buffer.m_ptr = reinterpret_cast<CUdeviceptr>(ptr);
+        }
+        buffer.m_size = size;
+        buffer.m_device = device;
+        return buffer;
+    }
+
+    void give(Buffer& buffer) {
+        Entry entry = {buffer.m_ptr, buffer.m_size, buffer.m_device, buffer.m_pinned};
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            size_t& idle = idleBytes(entry.device);
+            if (idle + entry.size <= kMaxIdleBytes) {
+                idle += entry.size;
+                m_idle.push_back(entry);
+                return;
+            }
+        }
+        destroy(entry);
+    }
+
+    static void destroy(const Entry& entry) {
+        CudaDriver& driver = CudaDriver::get();
+        if (entry.device != kHost) {
+            if (driver.makeCurrent(entry.device)) driver.free(entry.ptr);
+        } else if (entry.pinned) {
+            driver.freeHost(reinterpret_cast<void*>(entry.ptr));
+        } else {
+            std::free(reinterpret_cast<void*>(entry.ptr));
+        }
+    }
+
+    size_t& idleBytes(int device) { return device == kHost ? m_idleHost : m_idleDevice; }
+
+    std::mutex m_mutex;
+    std::vector<Entry> m_idle;
+    size_t m_idleHost = 0;
+    size_t m_idleDevice = 0;
+    bool m_pinnedEnabled = false;
+};
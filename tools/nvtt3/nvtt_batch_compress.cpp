@@ -2,12 +2,141 @@
  * nvtt_batch_compress - NVTT3 SDK batch processor for multiple textures
  *
  * Usage: nvtt_batch_compress <batch_file>
+ *        nvtt_batch_compress --server
+ *        nvtt_batch_compress --socket <path>
  *
  * Batch file format (one entry per line):
  *   input.dds|output.dds|max_extent|format
  *
+ * --streams N decodes textures on N CPU threads while one GPU thread per
+ * device (see --devices), each owning that device's Context, resizes, builds
+ * mips and encodes; the CPU engine (--cpu-workers) takes the jobs no GPU can.
+ * This keeps the GPUs busy without running one process (and CUDA context) per
+ * core.
+ *
+ * --pack N collects up to N small textures (<= 512px after resize) of the
+ * same format and compresses all their mips in a single BatchList, so the
+ * long tail of clutter textures doesn't pay one GPU submission each.
+ *
+ * --vram-budget MB caps the memory a mip chain may hold at once. Textures
+ * whose full chain would exceed it are compressed one level at a time, each
+ * level released as soon as the next is built; packs are bounded the same way.
+ *
+ * Server mode reads the same job lines from stdin (--server) or from clients
+ * of a Unix socket (--socket) and answers each with an OK:/FAIL: line, so the
+ * caller can keep feeding jobs without respawning the process. Extra commands:
+ *   SYNC      - reply SYNC:<succeeded>:<failed> once all prior jobs are done
+ *   QUIT      - end the current session (same as EOF)
+ *   SHUTDOWN  - end the session and stop listening (socket mode)
+ *
+ * A job whose input field is "@<bytes>" carries the source DDS inline: exactly
+ * <bytes> raw bytes follow the line and are decoded with loadFromMemory(), so
+ * archived textures never have to be extracted to disk first.
+ *
+ * An optional sixth field "width,height,dx10,srgb" passes a source header the
+ * caller already parsed; otherwise each source is read once and its header
+ * probed from the same buffer that is decoded. An optional seventh field
+ * "normal" marks a tangent-space normal map (the header field may be left
+ * empty): its resized top level and every mip are renormalized after filtering.
+ * An optional eighth field (fastest, normal, production or highest) sets the
+ * job's encoder quality in place of --quality, so a caller can trade quality
+ * for time texture by texture; packs only join jobs of the same quality.
+ *
+ * Jobs that need no resize, whose source is BC1-3 or 8-bit RGBA/BGRA with a
+ * full mip chain, skip the float Surface path: the stored levels are decoded
+ * straight to 8-bit RefImages and encoded with the low-level nvtt_encode()
+ * (through a GPUInputBuffer when CUDA is available).
+ *
+ * Buffers the pipeline allocates itself come from a BufferPool (cuda_driver.h)
+ * kept for the whole run: the direct path's decoded levels, its device copy of
+ * them and the GPU-resident path's copy-back staging. With CUDA the host ones
+ * are page-locked, so each direct-path texture goes up in a single DMA copy.
+ * The Surfaces NVTT allocates internally are not covered.
+ *
+ * --gpu-resident keeps mip chains on the device through encoding: the mips'
+ * GPU buffers feed nvtt_encode() directly, the blocks of a whole texture or
+ * pack accumulate in device memory (SetOutputToGPUMem) and come back with a
+ * single device-to-host copy. Needs CUDA and libcuda.so.1; otherwise, or if a
+ * submission fails, the regular Context path is used.
+ *
+ * --devices N encodes on N GPUs (0 = all visible), each with its own Context
+ * and GPU thread fed by the shared decoders. Each decoded texture goes to the
+ * GPU with the fewest source pixels outstanding, so a few 4K textures don't
+ * pile up on one card while another drains a queue of small ones.
+ *
+ * --cpu-workers N sets the size of the CPU engine, a pool of threads that each
+ * own a Context(false). Without CUDA it does all the encoding (default: one
+ * worker per stream); with CUDA it redoes, in-process, any texture the GPU
+ * failed on before a FAIL: is reported (default 1, 0 disables the retry).
+ *
+ * --timing appends the job's stage timings in milliseconds to each OK: line as
+ * a seventh field, "load=..,upload=..,resize=..,mips=..,encode=..,patch=..,write=..".
+ * Encoding time is split from NVTT's own image-to-buffer records
+ * (Context::enableTiming), which count as upload; a pack's shared submission
+ * is divided among its textures by pixel count.
+ *
+ * --reuse-mips starts a job that shrinks a mipmapped DDS from the deepest stored
+ * level still at least max_extent (when it halves the source exactly) instead of
+ * decoding and filtering the full top level: only that level is decoded, then
+ * resized by less than 2x and its mips rebuilt. When the level is the target
+ * size and the layout allows, the direct path reuses the stored mips below it.
+ *
+ * --copy-mips turns a job into pure I/O when the source is already in the target
+ * format and stores a level of exactly the target size with every mip below
+ * it: a new header is written (patched like every other output) and those
+ * levels are copied byte for byte, with no decode and no encode. The job is
+ * answered from its decode thread and never reaches a GPU or CPU worker.
+ *
+ * bc4 and bc5 jobs take a reduced-channel path: the source is decoded to only
+ * the one or two channels the format encodes (BC4/BC5 sources by our own block
+ * decoder, others through a Surface whose other channels are dropped), then
+ * resized and mipmapped with the same Kaiser filter on the decode thread as
+ * planar floats and encoded like a direct-path texture. The four-channel float
+ * Surface chain is never built or uploaded; a bc5 normal map carries a
+ * reconstructed z through filtering so each level can be renormalized.
+ *
+ * Sources whose alpha is 1 everywhere (a range check on the decoded Surface,
+ * or on the 8-bit levels of the direct path) are encoded with SetIsOpaque on
+ * the nvtt_encode() paths and with AlphaMode_None on the Surface path, which
+ * lets the encoder skip alpha. --auto-bc1 goes further and encodes an opaque
+ * job asked for as bc3 or bc7 as bc1, which is half the size; the OK: line
+ * reports the format actually written. A --copy-mips job is only encoded for
+ * that when its stored blocks are opaque.
+ *
+ * --quality picks the NVTT encoder quality (fastest, normal, production or
+ * highest) for jobs that don't set their own; the default is normal.
+ *
+ * --cpu-only skips CUDA entirely and encodes on the CPU engine, which is how
+ * nvtt_bench compares the two on the same machine.
+ *
+ * Faults stay with the job that caused them where possible: a source whose
+ * header NVTT can't allocate for fails on its own, an exception out of one
+ * job's step fails only that job, and a GPU failure is redone on the CPU
+ * engine. After 3 GPU failures in a row the GPU's Context is recreated
+ * (CUDA:reset:<device>); if it still fails without a single success it is
+ * retired (CUDA:retired:<device>) and the CPU engine takes its jobs. A crash
+ * still ends the process; --resume-from N restarts a batch file at job N,
+ * keeping the numbering, and the Rust driver reruns the jobs a crashed
+ * server had in flight one at a time to find the culprit.
+ *
+ * --io-depth N moves file I/O off the compute threads: N reader threads load
+ * sources into memory ahead of the decoders (so up to N reads are in flight,
+ * which lets the disk reorder them), and one writer thread drains a queue of
+ * up to N patched outputs while the GPU moves on. A job is reported only once
+ * its file is written. Plain threads rather than io_uring, to stay on libc.
+ *
+ * Built with -DRADIUM_ENCODE_LIBRARY (make libradium_encode.so) this file has
+ * no main() and exports the C ABI in radium_encode.h instead: an engine takes
+ * the same options and job lines, and hands results back as structs rather
+ * than OK:/FAIL: lines, for callers that encode in-process.
+ *
+ * Output is assembled in memory, its header patched there and the file
+ * written once a texture has fully succeeded, so a failed job never leaves a
+ * truncated file behind (even when input and output are the same path).
+ * --atomic-write writes to <output>.tmp and renames it into place instead.
+ *
  * Features:
- * - Single CUDA context initialization for entire batch
+ * - Single CUDA context initialization for entire batch or server lifetime
  * - BatchList API for efficient mipmap compression
  * - Streaming progress output for GUI feedback
  */
@@ -15,22 +144,74 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cstdarg>
 #include <string>
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <functional>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "include/nvtt/nvtt.h"
+#include "include/nvtt/nvtt_lowlevel.h"
+#include "cuda_driver.h"
+#include "radium_encode.h"
 
 using namespace nvtt;
 
+// What the pipeline needs from a source DDS header, parsed once per job
+struct DdsProbe {
+    int width = 0;
+    int height = 0;
+    bool dx10 = false;        // has the DX10 extended header
+    uint32_t dxgiFormat = 0;  // DX10 only
+    bool srgb = false;        // DX10 format is one of the *_SRGB formats
+
+    // Layout of the stored pixels, only known when probed from the file itself
+    int mipCount = 0;
+    uint32_t fourCC = 0;
+    uint32_t pixelFlags = 0;
+    uint32_t bitCount = 0;
+    uint32_t rMask = 0, aMask = 0;
+    size_t dataOffset = 0;    // first byte of mip 0
+};
+
 struct TextureJob {
     std::string inputPath;
     std::string outputPath;
     int maxExtent;
     std::string format;
     int srgbHint; // -1=auto (use header), 0=force linear, 1=force srgb
+    bool normalMap = false;   // renormalize mips (job field "normal")
+    std::vector<unsigned char> inputData; // source DDS bytes for in-memory jobs
+    bool hasHeader = false;   // header fields supplied with the job
+    DdsProbe header;
+    int quality = -1;         // Quality from the job's eighth field, -1 = --quality
 };
 
+// Destination for OK:/FAIL:/BATCH_* protocol lines. stderr for batch files and
+// --server; the client connection in --socket mode.
+static FILE* g_report = stderr;
+static std::mutex g_reportMutex;
+
+void report(const char* fmt, ...) {
+    std::lock_guard<std::mutex> lock(g_reportMutex);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(g_report, fmt, args);
+    va_end(args);
+    fflush(g_report);
+}
+
 Format parseFormat(const std::string& fmt) {
     if (fmt.empty() || fmt == "bc7") return Format_BC7;
     if (fmt == "bc4") return Format_BC4;
@@ -53,6 +234,15 @@ const char* formatName(Format fmt) {
     }
 }
 
+bool parseQuality(const std::string& name, Quality* quality) {
+    if (name == "fastest") *quality = Quality_Fastest;
+    else if (name == "normal") *quality = Quality_Normal;
+    else if (name == "production") *quality = Quality_Production;
+    else if (name == "highest") *quality = Quality_Highest;
+    else return false;
+    return true;
+}
+
 int calcMipCount(int w, int h) {
     int count = 1;
     while (w > 1 || h > 1) {
@@ -74,17 +264,16 @@ int blockSizeForFormat(Format fmt) {
 // Patch NVTT3's DDS legacy header to match texconv output.
 // Fixes: missing DDSD_LINEARSIZE flag, zero pitchOrLinearSize,
 // NVTT watermark in dwReserved1, and miscFlags2 alpha mode.
-void patchDdsHeader(const char* path, int width, int height, Format format) {
-    FILE* f = fopen(path, "r+b");
-    if (!f) return;
+// Patched in place on the buffered file, before it's written.
+void patchDdsHeader(std::vector<unsigned char>& dds, int width, int height, Format format) {
+    if (dds.size() < 148) return;
+    unsigned char* h = dds.data();
 
     // 1. Add DDSD_LINEARSIZE (0x80000) to dwFlags at offset 8
-    uint32_t flags = 0;
-    fseek(f, 8, SEEK_SET);
-    fread(&flags, sizeof(uint32_t), 1, f);
+    uint32_t flags;
+    memcpy(&flags, h + 8, sizeof(uint32_t));
     flags |= 0x80000; // DDSD_LINEARSIZE
-    fseek(f, 8, SEEK_SET);
-    fwrite(&flags, sizeof(uint32_t), 1, f);
+    memcpy(h + 8, &flags, sizeof(uint32_t));
 
     // 2. Write correct pitchOrLinearSize at offset 20
     //    For block-compressed: total bytes of top-level mip surface
@@ -96,73 +285,351 @@ void patchDdsHeader(const char* path, int width, int height, Format format) {
     int hBlocks = (height + 3) / 4;
     if (hBlocks < 1) hBlocks = 1;
     uint32_t linearSize = (uint32_t)(wBlocks * hBlocks * bsize);
-    fseek(f, 20, SEEK_SET);
-    fwrite(&linearSize, sizeof(uint32_t), 1, f);
+    memcpy(h + 20, &linearSize, sizeof(uint32_t));
 
     // 3. Set dwDepth to 1 at offset 24 (texconv writes 1 for 2D textures)
     uint32_t one = 1;
-    fseek(f, 24, SEEK_SET);
-    fwrite(&one, sizeof(uint32_t), 1, f);
+    memcpy(h + 24, &one, sizeof(uint32_t));
 
     // 4. Zero out dwReserved1[11] at offsets 32-75 (remove NVTT watermark)
-    uint32_t zeros[11] = {0};
-    fseek(f, 32, SEEK_SET);
-    fwrite(zeros, sizeof(uint32_t), 11, f);
+    memset(h + 32, 0, 11 * sizeof(uint32_t));
 
     // 5. Patch DX10 miscFlags2 to DDS_ALPHA_MODE_UNKNOWN (0) at offset 144
-    uint32_t zero = 0;
-    fseek(f, 144, SEEK_SET);
-    fwrite(&zero, sizeof(uint32_t), 1, f);
+    memset(h + 144, 0, sizeof(uint32_t));
+}
 
-    fclose(f);
+// DXGI format NVTT writes for `format`; only BC1, BC3 and BC7 have sRGB variants
+uint32_t dxgiFormatFor(Format format, bool srgb) {
+    switch (format) {
+        case Format_BC1: return srgb ? 72 : 71;
+        case Format_BC3: return srgb ? 78 : 77;
+        case Format_BC4: return 80;
+        case Format_BC5: return 83;
+        case Format_BC6U: return 95;
+        default: return srgb ? 99 : 98; // BC7
+    }
 }
 
-// Check if source DDS has a DX10 extended header (FourCC == "DX10")
-bool hasDX10Header(const char* path) {
-    FILE* f = fopen(path, "rb");
+// The DX10 header Context::outputHeader writes for a w x h 2D texture with
+// `mipCount` levels, already patched by patchDdsHeader
+std::vector<unsigned char> buildDdsHeader(int width, int height, int mipCount,
+                                          Format format, bool srgb) {
+    std::vector<unsigned char> dds(148, 0);
+    auto put = [&](size_t offset, uint32_t value) { memcpy(&dds[offset], &value, sizeof(value)); };
+    put(0, 0x20534444);    // "DDS "
+    put(4, 124);           // header size
+    put(8, 0x21007);       // caps, height, width, pixel format, mipmap count
+    put(12, (uint32_t)height);
+    put(16, (uint32_t)width);
+    put(28, (uint32_t)mipCount);
+    put(76, 32);           // pixel format size
+    put(80, 0x4);          // DDPF_FOURCC
+    put(84, 0x30315844);   // "DX10"
+    put(108, 0x401008);    // complex, texture, mipmap
+    put(128, dxgiFormatFor(format, srgb));
+    put(132, 3);           // 2D texture
+    put(140, 1);           // array size
+    patchDdsHeader(dds, width, height, format);
+    return dds;
+}
+
+// Write a finished DDS with a single write. With `atomic`, write a sibling
+// temp file and rename it over the output so readers never see a partial file.
+bool writeOutputFile(const std::string& path, const std::vector<unsigned char>& dds, bool atomic) {
+    std::string target = atomic ? path + ".tmp" : path;
+    FILE* f = fopen(target.c_str(), "wb");
     if (!f) return false;
-    unsigned char hdr[88];
-    bool dx10 = false;
-    if (fread(hdr, 1, 88, f) == 88) {
-        dx10 = (hdr[84] == 'D' && hdr[85] == 'X' && hdr[86] == '1' && hdr[87] == '0');
+
+    bool ok = fwrite(dds.data(), 1, dds.size(), f) == dds.size();
+    ok = (fclose(f) == 0) && ok;
+
+    if (atomic) {
+        if (ok) ok = rename(target.c_str(), path.c_str()) == 0;
+        if (!ok) remove(target.c_str());
     }
-    fclose(f);
-    return dx10;
+    return ok;
 }
 
-// Detect if source DDS uses an sRGB DXGI format by reading the DX10 header.
-// sRGB formats: 28 (R8G8B8A8_UNORM_SRGB), 72 (BC1_SRGB), 75 (BC2_SRGB),
-//               78 (BC3_SRGB), 91 (B8G8R8A8_UNORM_SRGB), 99 (BC7_SRGB)
-bool isSourceSrgb(const char* path) {
+// Read the whole of a file into `data`: one open per source, after which
+// the header probe and the decode both work from memory
+bool readFile(const char* path, std::vector<unsigned char>& data) {
     FILE* f = fopen(path, "rb");
     if (!f) return false;
-
-    unsigned char hdr[132];
-    bool srgb = false;
-    if (fread(hdr, 1, 132, f) == 132) {
-        if (hdr[84] == 'D' && hdr[85] == 'X' && hdr[86] == '1' && hdr[87] == '0') {
-            uint32_t dxgi = hdr[128] | (hdr[129] << 8) | (hdr[130] << 16) | (hdr[131] << 24);
-            srgb = (dxgi == 28 || dxgi == 72 || dxgi == 75 || dxgi == 78 || dxgi == 91 || dxgi == 99);
-        }
+    bool ok = fseek(f, 0, SEEK_END) == 0;
+    long size = ok ? ftell(f) : -1;
+    ok = size > 0 && fseek(f, 0, SEEK_SET) == 0;
+    if (ok) {
+        data.resize((size_t)size);
+        ok = fread(data.data(), 1, data.size(), f) == data.size();
     }
     fclose(f);
-    return srgb;
+    return ok;
+}
+
+// Parse the source DDS header into `probe`. Only the first 148 bytes
+// (legacy header + DX10 extension) are looked at.
+bool probeDdsHeader(const unsigned char* data, size_t size, DdsProbe& probe) {
+    if (size < 128 || memcmp(data, "DDS ", 4) != 0) return false;
+
+    uint32_t height, width;
+    memcpy(&height, data + 12, sizeof(uint32_t));
+    memcpy(&width, data + 16, sizeof(uint32_t));
+    probe.width = (int)width;
+    probe.height = (int)height;
+
+    // dwMipMapCount is only meaningful with DDSD_MIPMAPCOUNT set
+    uint32_t flags, mipCount;
+    memcpy(&flags, data + 8, sizeof(uint32_t));
+    memcpy(&mipCount, data + 28, sizeof(uint32_t));
+    probe.mipCount = (flags & 0x20000) && mipCount > 0 ? (int)mipCount : 1;
+
+    memcpy(&probe.pixelFlags, data + 80, sizeof(uint32_t));
+    memcpy(&probe.fourCC, data + 84, sizeof(uint32_t));
+    memcpy(&probe.bitCount, data + 88, sizeof(uint32_t));
+    memcpy(&probe.rMask, data + 92, sizeof(uint32_t));
+    memcpy(&probe.aMask, data + 104, sizeof(uint32_t));
+
+    // DX10 extended header (FourCC == "DX10") carries the DXGI format
+    probe.dx10 = memcmp(data + 84, "DX10", 4) == 0 && size >= 148;
+    probe.dxgiFormat = 0;
+    if (probe.dx10) {
+        memcpy(&probe.dxgiFormat, data + 128, sizeof(uint32_t));
+    }
+    probe.dataOffset = probe.dx10 ? 148 : 128;
+
+    // sRGB formats: 29 (R8G8B8A8_UNORM_SRGB), 72 (BC1_SRGB), 75 (BC2_SRGB),
+    //               78 (BC3_SRGB), 91 (B8G8R8A8_UNORM_SRGB),
+    //               93 (B8G8R8X8_UNORM_SRGB), 99 (BC7_SRGB)
+    uint32_t dxgi = probe.dxgiFormat;
+    probe.srgb = (dxgi == 29 || dxgi == 72 || dxgi == 75 || dxgi == 78 || dxgi == 91 ||
+                  dxgi == 93 || dxgi == 99);
+    return true;
 }
 
 // Determine sRGB for output based on source format and hint from caller.
 // - DX10 sources: use explicit DXGI format (most accurate)
 // - Legacy sources (DXT1/DXT3/DXT5): use srgbHint from texture type classification
 //   (Skyrim treats legacy textures as sRGB for diffuse, linear for normals)
-bool determineSrgb(const char* path, int srgbHint) {
-    if (hasDX10Header(path)) {
+bool determineSrgb(const DdsProbe& probe, int srgbHint) {
+    if (probe.dx10) {
         // DX10 textures have explicit sRGB in DXGI format - trust it
-        return isSourceSrgb(path);
+        return probe.srgb;
     }
     // Legacy format - no sRGB info in header, use hint from Rust texture classifier
     // hint: 1=diffuse/emissive (sRGB), 0=normal/specular/etc (linear), -1=auto(fallback to false)
     return (srgbHint == 1);
 }
 
+// Parse the optional sixth job field, "width,height,dx10,srgb", a header the
+// caller has already parsed. Returns false if it's absent or malformed.
+bool parseHeaderField(const std::string& field, DdsProbe& probe) {
+    int width, height, dx10, srgb;
+    if (sscanf(field.c_str(), "%d,%d,%d,%d", &width, &height, &dx10, &srgb) != 4) return false;
+    if (width <= 0 || height <= 0) return false;
+    probe.width = width;
+    probe.height = height;
+    probe.dx10 = dx10 != 0;
+    probe.srgb = srgb != 0;
+    return true;
+}
+
+// Source pixel layouts the direct (8-bit, no Surface) path can read
+enum SourceLayout {
+    Layout_Unsupported,
+    Layout_BC1,
+    Layout_BC2,
+    Layout_BC3,
+    Layout_BC4,
+    Layout_BC5,
+    Layout_BC7,
+    Layout_RGBA8,
+    Layout_BGRA8,
+    Layout_BGRX8,
+};
+
+SourceLayout sourceLayout(const DdsProbe& probe) {
+    if (probe.dx10) {
+        switch (probe.dxgiFormat) {
+            case 71: case 72: return Layout_BC1;
+            case 74: case 75: return Layout_BC2;
+            case 77: case 78: return Layout_BC3;
+            case 80: case 81: return Layout_BC4;
+            case 83: case 84: return Layout_BC5;
+            case 98: case 99: return Layout_BC7;
+            case 28: case 29: return Layout_RGBA8;
+            case 87: case 91: return Layout_BGRA8;
+            case 88: case 93: return Layout_BGRX8;
+            default: return Layout_Unsupported;
+        }
+    }
+    if (probe.pixelFlags & 0x4) { // DDPF_FOURCC; DXT2/DXT4 are premultiplied
+        if (probe.fourCC == 0x31545844) return Layout_BC1; // "DXT1"
+        if (probe.fourCC == 0x33545844) return Layout_BC2; // "DXT3"
+        if (probe.fourCC == 0x35545844) return Layout_BC3; // "DXT5"
+        if (probe.fourCC == 0x31495441 || probe.fourCC == 0x55344342) return Layout_BC4; // "ATI1", "BC4U"
+        if (probe.fourCC == 0x32495441 || probe.fourCC == 0x55354342) return Layout_BC5; // "ATI2", "BC5U"
+        return Layout_Unsupported;
+    }
+    if ((probe.pixelFlags & 0x40) && probe.bitCount == 32) { // DDPF_RGB
+        bool alpha = (probe.pixelFlags & 0x1) && probe.aMask == 0xff000000;
+        if (probe.rMask == 0x000000ff && alpha) return Layout_RGBA8;
+        if (probe.rMask == 0x00ff0000) return alpha ? Layout_BGRA8 : Layout_BGRX8;
+    }
+    return Layout_Unsupported;
+}
+
+// Bytes one stored w x h level takes in the source
+size_t sourceLevelBytes(SourceLayout layout, int w, int h) {
+    size_t blocks = (size_t)((w + 3) / 4) * (size_t)((h + 3) / 4);
+    switch (layout) {
+        case Layout_BC1:
+        case Layout_BC4: return blocks * 8;
+        case Layout_BC2:
+        case Layout_BC3:
+        case Layout_BC5:
+        case Layout_BC7: return blocks * 16;
+        default:         return (size_t)w * (size_t)h * 4;
+    }
+}
+
+// Offset of stored level `level` from the first byte of mip 0
+size_t sourceLevelOffset(SourceLayout layout, int w, int h, int level) {
+    size_t offset = 0;
+    for (int mip = 0; mip < level; mip++) {
+        offset += sourceLevelBytes(layout, w, h);
+        w = (w > 1) ? w / 2 : 1;
+        h = (h > 1) ? h / 2 : 1;
+    }
+    return offset;
+}
+
+// Deepest stored mip level of a source that is still at least `maxExtent`, so
+// decoding can start there and resize by less than 2x (or not at all).
+// Only levels that halve the source exactly qualify, which keeps the final
+// size the same as a resize from the top level. 0 = decode the top level.
+int reusableMipLevel(const DdsProbe& probe, int maxExtent) {
+    if (sourceLayout(probe) == Layout_Unsupported) return 0;
+    int level = 0;
+    while (level + 1 < probe.mipCount) {
+        int next = level + 1;
+        int w = probe.width >> next, h = probe.height >> next;
+        if (w < 1 || h < 1 || (w << next) != probe.width || (h << next) != probe.height) break;
+        if ((w > h ? w : h) < maxExtent) break;
+        level = next;
+    }
+    return level;
+}
+
+// Decode the color half of a BC1/BC2/BC3 block into 16 RGBA texels.
+// BC1 uses 3-color + transparent mode when color0 <= color1.
+void decodeColorBlock(const unsigned char* block, unsigned char texels[16][4], bool bc1) {
+    uint16_t c[2] = {
+        (uint16_t)(block[0] | (block[1] << 8)),
+        (uint16_t)(block[2] | (block[3] << 8)),
+    };
+    unsigned char palette[4][4];
+    for (int i = 0; i < 2; i++) {
+        int r = (c[i] >> 11) & 31, g = (c[i] >> 5) & 63, b = c[i] & 31;
+        palette[i][0] = (unsigned char)((r << 3) | (r >> 2));
+        palette[i][1] = (unsigned char)((g << 2) | (g >> 4));
+        palette[i][2] = (unsigned char)((b << 3) | (b >> 2));
+        palette[i][3] = 255;
+    }
+    bool fourColor = !bc1 || c[0] > c[1];
+    for (int ch = 0; ch < 3; ch++) {
+        int p0 = palette[0][ch], p1 = palette[1][ch];
+        if (fourColor) {
+            palette[2][ch] = (unsigned char)((2 * p0 + p1 + 1) / 3);
+            palette[3][ch] = (unsigned char)((p0 + 2 * p1 + 1) / 3);
+        } else {
+            palette[2][ch] = (unsigned char)((p0 + p1 + 1) / 2);
+            palette[3][ch] = 0;
+        }
+    }
+    palette[2][3] = 255;
+    palette[3][3] = fourColor ? 255 : 0;
+
+    uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+    for (int i = 0; i < 16; i++) {
+        memcpy(texels[i], palette[(indices >> (2 * i)) & 3], 4);
+    }
+}
+
+// Decode a BC3 (interpolated) alpha block into the alpha of 16 texels
+void decodeAlphaBlock(const unsigned char* block, unsigned char texels[16][4]) {
+    int a0 = block[0], a1 = block[1];
+    unsigned char alpha[8] = {(unsigned char)a0, (unsigned char)a1};
+    if (a0 > a1) {
+        for (int i = 1; i < 7; i++) alpha[i + 1] = (unsigned char)(((7 - i) * a0 + i * a1 + 3) / 7);
+    } else {
+        for (int i = 1; i < 5; i++) alpha[i + 1] = (unsigned char)(((5 - i) * a0 + i * a1 + 2) / 5);
+        alpha[6] = 0;
+        alpha[7] = 255;
+    }
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++) indices |= (uint64_t)block[2 + i] << (8 * i);
+    for (int i = 0; i < 16; i++) {
+        texels[i][3] = alpha[(indices >> (3 * i)) & 7];
+    }
+}
+
+// Decode one block-compressed level to tightly packed RGBA8
+void decodeBlockLevel(const unsigned char* src, SourceLayout layout, int w, int h, unsigned char* rgba) {
+    int blockBytes = (layout == Layout_BC1) ? 8 : 16;
+    unsigned char texels[16][4];
+    for (int by = 0; by < (h + 3) / 4; by++) {
+        for (int bx = 0; bx < (w + 3) / 4; bx++, src += blockBytes) {
+            if (layout == Layout_BC1) {
+                decodeColorBlock(src, texels, true);
+            } else {
+                decodeColorBlock(src + 8, texels, false);
+                if (layout == Layout_BC3) {
+                    decodeAlphaBlock(src, texels);
+                } else {
+                    for (int i = 0; i < 16; i++) { // BC2: explicit 4-bit alpha
+                        int a = (src[i / 2] >> (4 * (i & 1))) & 15;
+                        texels[i][3] = (unsigned char)(a * 17);
+                    }
+                }
+            }
+            for (int i = 0; i < 16; i++) {
+                int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+                if (x < w && y < h) memcpy(rgba + ((size_t)y * w + x) * 4, texels[i], 4);
+            }
+        }
+    }
+}
+
+// Parse one "input|output|max_extent|format|srgb[|header[|kind[|quality]]]" job line.
+// Returns false for lines that don't describe a valid job.
+bool parseJobLine(const std::string& line, TextureJob& job) {
+    std::istringstream iss(line);
+
+    std::getline(iss, job.inputPath, '|');
+    std::getline(iss, job.outputPath, '|');
+
+    std::string maxExtentStr, formatStr, srgbStr, headerStr, kindStr, qualityStr;
+    std::getline(iss, maxExtentStr, '|');
+    std::getline(iss, formatStr, '|');
+    std::getline(iss, srgbStr, '|');
+    std::getline(iss, headerStr, '|');
+    std::getline(iss, kindStr, '|');
+    std::getline(iss, qualityStr, '|');
+
+    job.maxExtent = std::atoi(maxExtentStr.c_str());
+    job.format = formatStr;
+    job.srgbHint = srgbStr.empty() ? -1 : std::atoi(srgbStr.c_str());
+    job.hasHeader = parseHeaderField(headerStr, job.header);
+    job.normalMap = kindStr == "normal";
+    if (!qualityStr.empty()) {
+        Quality quality;
+        if (!parseQuality(qualityStr, &quality)) return false;
+        job.quality = quality;
+    }
+
+    return !job.inputPath.empty() && !job.outputPath.empty() && job.maxExtent > 0;
+}
+
 std::vector<TextureJob> parseBatchFile(const char* batchFile) {
     std::vector<TextureJob> jobs;
     std::ifstream file(batchFile);
@@ -176,171 +643,2096 @@ std::vector<TextureJob> parseBatchFile(const char* batchFile) {
     while (std::getline(file, line)) {
         if (line.empty() || line[0] == '#') continue;
 
-        std::istringstream iss(line);
         TextureJob job;
+        if (parseJobLine(line, job)) {
+            jobs.push_back(job);
+        }
+    }
 
-        std::getline(iss, job.inputPath, '|');
-        std::getline(iss, job.outputPath, '|');
+    return jobs;
+}
 
-        std::string maxExtentStr, formatStr, srgbStr;
-        std::getline(iss, maxExtentStr, '|');
-        std::getline(iss, formatStr, '|');
-        std::getline(iss, srgbStr, '|');
+// Settings shared by every job in a run (from the command line)
+struct PipelineOptions {
+    int streams = 1;          // CPU decode threads
+    int packSize = 1;         // max small textures per GPU submission
+    size_t vramBudget = 0;    // bytes a mip chain may hold at once, 0 = unlimited
+    bool atomicWrite = false; // write outputs via temp file + rename
+    bool gpuResident = false; // encode from device mips into device memory
+    bool timing = false;      // report stage timings on OK: lines
+    int devices = 1;          // GPUs to encode on, 0 = all visible
+    int cpuWorkers = -1;      // CPU engine threads, -1 = default for the mode
+    bool cpuOnly = false;     // never create a CUDA context
+    bool reuseMips = false;   // decode from the stored mip nearest the target
+    bool copyMips = false;    // copy stored levels when the format is unchanged
+    bool autoBc1 = false;     // encode opaque BC3/BC7 jobs as BC1
+    int ioDepth = 0;          // read-ahead threads / write-behind queue, 0 = inline I/O
+    Quality quality = Quality_Normal;
+};
 
-        job.maxExtent = std::atoi(maxExtentStr.c_str());
-        job.format = formatStr;
-        job.srgbHint = srgbStr.empty() ? -1 : std::atoi(srgbStr.c_str());
+// Parse the pipeline option at argv[i], shared by main() and
+// radium_engine_create(). Returns the arguments it used, 0 if argv[i] isn't
+// one, or -1 for a bad value (already reported).
+int parsePipelineOption(int argc, const char* const* argv, int i, PipelineOptions& options) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
 
-        if (!job.inputPath.empty() && !job.outputPath.empty() && job.maxExtent > 0) {
-            jobs.push_back(job);
+    if (strcmp(arg, "--atomic-write") == 0) {
+        options.atomicWrite = true;
+    } else if (strcmp(arg, "--gpu-resident") == 0) {
+        options.gpuResident = true;
+    } else if (strcmp(arg, "--timing") == 0) {
+        options.timing = true;
+    } else if (strcmp(arg, "--reuse-mips") == 0) {
+        options.reuseMips = true;
+    } else if (strcmp(arg, "--copy-mips") == 0) {
+        options.copyMips = true;
+    } else if (strcmp(arg, "--auto-bc1") == 0) {
+        options.autoBc1 = true;
+    } else if (strcmp(arg, "--cpu-only") == 0) {
+        options.cpuOnly = true;
+    } else if (!value) {
+        return 0;
+    } else if (strcmp(arg, "--streams") == 0) {
+        options.streams = std::atoi(value);
+        return 2;
+    } else if (strcmp(arg, "--pack") == 0) {
+        options.packSize = std::atoi(value);
+        return 2;
+    } else if (strcmp(arg, "--vram-budget") == 0) {
+        options.vramBudget = (size_t)std::atol(value) * 1024 * 1024;
+        return 2;
+    } else if (strcmp(arg, "--devices") == 0) {
+        options.devices = std::atoi(value);
+        return 2;
+    } else if (strcmp(arg, "--cpu-workers") == 0) {
+        options.cpuWorkers = std::atoi(value);
+        return 2;
+    } else if (strcmp(arg, "--io-depth") == 0) {
+        options.ioDepth = std::atoi(value);
+        return 2;
+    } else if (strcmp(arg, "--quality") == 0) {
+        if (!parseQuality(value, &options.quality)) {
+            fprintf(stderr, "ERROR:Unknown quality: %s\n", value);
+            return -1;
         }
+        return 2;
+    } else {
+        return 0;
     }
+    return 1;
+}
 
-    return jobs;
+// Clamp parsed options to values the pipeline can run with
+void finalizeOptions(PipelineOptions& options) {
+    if (options.streams < 1) options.streams = 1;
+    if (options.packSize < 1) options.packSize = 1;
+    if (options.devices < 0) options.devices = 1;
+    if (options.ioDepth < 0) options.ioDepth = 0;
+}
+
+// Wall-clock stage timer: lap() returns the milliseconds since the last lap
+class StageTimer {
+public:
+    StageTimer() : m_last(std::chrono::steady_clock::now()) {}
+
+    double lap() {
+        auto now = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(now - m_last).count();
+        m_last = now;
+        return ms;
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_last;
+};
+
+// Where a job's time went, in milliseconds
+struct StageTimes {
+    double load = 0;          // read, probe and decode the source
+    double upload = 0;        // host-to-device: ToGPU and NVTT's image-to-buffer
+    double resize = 0;
+    double mips = 0;          // build the mip chain
+    double encode = 0;        // block compression, blocks back on the host
+    double patch = 0;         // patch the buffered DDS header
+    double write = 0;         // write the output file
+};
+
+// NVTT's image-to-buffer time recorded by `context` since the last call, in
+// milliseconds. Clears the records, which the context would otherwise keep
+// for its whole lifetime. 0 unless timing is enabled on the context.
+double drainUploadTiming(Context& context) {
+    TimingContext* timing = context.getTimingContext();
+    if (!timing) return 0;
+
+    double ms = 0;
+    char description[128];
+    for (int i = 0; i < timing->GetRecordCount(); i++) {
+        double seconds = 0;
+        timing->GetRecord(i, description, sizeof(description), seconds);
+        if (strstr(description, "to buffer")) ms += seconds * 1000.0;
+    }
+    context.enableTiming(false);
+    context.enableTiming(true);
+    return ms;
 }
 
-bool processTexture(const TextureJob& job, Context& context, int index, int total) {
-    // Load input DDS
+// A job decoded on a CPU thread, waiting for the GPU stage
+struct LoadedTexture {
+    TextureJob job;
+    int index;
     Surface surface;
-    if (!surface.load(job.inputPath.c_str())) {
-        fprintf(stderr, "FAIL:%d/%d:%s:Failed to load DDS file\n",
-                index + 1, total, job.inputPath.c_str());
+    bool srgb;
+    StageTimes times;
+    int sourceLevel = 0; // stored mip the decode started from (--reuse-mips)
+    bool copied = false; // written and reported by copyStoredMips
+    bool opaque = false; // every source alpha is 1: encoded with SetIsOpaque
+
+    // Direct path: every mip level as 8-bit texels, back to back in one pooled
+    // host buffer (or planar floats of one or two channels from the
+    // reduced-channel path), described for nvtt_encode() by `directImages`
+    BufferPool::Buffer direct;
+    size_t directBytes = 0;                // used part of `direct`
+    std::vector<RefImage> directImages;    // point into `direct`
+    ValueType directType = UINT8;
+    std::vector<unsigned> directTiles;     // tiles (= output blocks) per level, once encoded
+    int directWidth = 0, directHeight = 0; // size of the first level
+};
+
+// Every alpha of `count` 4-byte texels (alpha last) is 255
+bool alphaOpaque(const unsigned char* texels, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (texels[i * 4 + 3] != 255) return false;
+    }
+    return true;
+}
+
+// Decode the stored mip chain of a format-only job straight to 8-bit tiles,
+// starting at stored level `level`. Returns false (leaving the Surface path to
+// handle the job) unless that level needs no resize, the layout is one we
+// decode ourselves and every level below it is stored.
+bool loadDirect(LoadedTexture& tex, int level) {
+    const TextureJob& job = tex.job;
+    const DdsProbe& probe = job.header;
+    SourceLayout layout = sourceLayout(probe);
+    bool blockCompressed = layout == Layout_BC1 || layout == Layout_BC2 || layout == Layout_BC3;
+    bool uncompressed = layout == Layout_RGBA8 || layout == Layout_BGRA8 || layout == Layout_BGRX8;
+
+    int w = probe.width >> level, h = probe.height >> level;
+    int maxDim = (w > h) ? w : h;
+    int numMipmaps = calcMipCount(w, h);
+    if (!(blockCompressed || uncompressed) || w <= 0 || h <= 0 || maxDim > job.maxExtent ||
+        probe.mipCount < level + numMipmaps) {
         return false;
     }
 
-    int origW = surface.width();
-    int origH = surface.height();
+    // BC levels decode into the pooled buffer, uncompressed ones are copied
+    size_t texelBytes = 0;
+    for (int mip = 0; mip < numMipmaps; mip++) {
+        texelBytes += (size_t)((w >> mip) > 1 ? (w >> mip) : 1) * ((h >> mip) > 1 ? (h >> mip) : 1) * 4;
+    }
+    BufferPool::Buffer levels = BufferPool::get().host(texelBytes);
+    if (!levels) return false;
+    unsigned char* texels = static_cast<unsigned char*>(levels.data());
+
+    std::vector<RefImage> images(numMipmaps);
+    size_t offset = probe.dataOffset +
+        sourceLevelOffset(layout, probe.width, probe.height, level);
+    bool opaque = true; // BGRX alpha reads as One
 
-    // Let NVTT3 auto-detect alpha mode for correct BC7 mode selection.
-    // AlphaMode_None would cause BC7 to use modes 0-3 (no alpha), destroying
-    // alpha data needed for terrain blending. patchDdsHeader() handles the
-    // miscFlags2 header separately for Skyrim compatibility.
+    for (int mip = 0; mip < numMipmaps; mip++) {
+        size_t bytes = sourceLevelBytes(layout, w, h);
+        if (offset + bytes > job.inputData.size()) return false;
 
-    // Move surface to GPU for CUDA-accelerated operations
-    surface.ToGPU();
+        RefImage& image = images[mip];
+        image.width = w;
+        image.height = h;
+        image.data = texels;
+        if (blockCompressed) {
+            decodeBlockLevel(job.inputData.data() + offset, layout, w, h, texels);
+            opaque = opaque && alphaOpaque(texels, (size_t)w * h);
+        } else {
+            memcpy(texels, job.inputData.data() + offset, (size_t)w * h * 4);
+            if (layout != Layout_BGRX8) {
+                opaque = opaque && alphaOpaque(texels, (size_t)w * h);
+            }
+            if (layout != Layout_RGBA8) {
+                image.channel_swizzle[0] = Blue;
+                image.channel_swizzle[2] = Red;
+            }
+            if (layout == Layout_BGRX8) image.channel_swizzle[3] = One;
+        }
 
-    // Resize if needed
-    int maxDim = (origW > origH) ? origW : origH;
-    if (maxDim > job.maxExtent) {
-        surface.resize(job.maxExtent, RoundMode_None, ResizeFilter_Kaiser);
+        texels += (size_t)w * h * 4;
+        offset += bytes;
+        w = (w > 1) ? w / 2 : 1;
+        h = (h > 1) ? h / 2 : 1;
     }
 
-    int newW = surface.width();
-    int newH = surface.height();
-    int numMipmaps = calcMipCount(newW, newH);
+    tex.direct = std::move(levels);
+    tex.directBytes = texelBytes;
+    tex.directImages = std::move(images);
+    tex.directType = UINT8;
+    tex.directWidth = probe.width >> level;
+    tex.directHeight = probe.height >> level;
+    tex.sourceLevel = level;
+    tex.opaque = opaque;
+    return true;
+}
 
-    Format format = parseFormat(job.format);
+// Decode only stored level `level` of the source into `surface`, for the
+// Surface path to resize (by less than 2x) and build mips from
+bool loadSourceLevel(const TextureJob& job, int level, Surface& surface) {
+    const DdsProbe& probe = job.header;
+    SourceLayout layout = sourceLayout(probe);
+    int w = probe.width >> level, h = probe.height >> level;
+    size_t offset = probe.dataOffset +
+        sourceLevelOffset(layout, probe.width, probe.height, level);
+    if (offset + sourceLevelBytes(layout, w, h) > job.inputData.size()) return false;
+    const unsigned char* data = job.inputData.data() + offset;
 
-    // Set up compression options
-    CompressionOptions compressionOptions;
-    compressionOptions.setFormat(format);
-    compressionOptions.setQuality(Quality_Normal);
+    switch (layout) {
+        case Layout_BC1: return surface.setImage2D(Format_BC1, w, h, data);
+        case Layout_BC2: return surface.setImage2D(Format_BC2, w, h, data);
+        case Layout_BC3: return surface.setImage2D(Format_BC3, w, h, data);
+        case Layout_BC4: return surface.setImage2D(Format_BC4, w, h, data);
+        case Layout_BC5: return surface.setImage2D(Format_BC5, w, h, data);
+        case Layout_BC7: return surface.setImage2D(Format_BC7, w, h, data);
+        case Layout_Unsupported: return false;
+        default: break;
+    }
+    if (!surface.setImage(InputFormat_BGRA_8UB, w, h, 1, data)) return false;
+    if (layout == Layout_RGBA8) surface.swizzle(2, 1, 0, 3);
+    if (layout == Layout_BGRX8) surface.swizzle(0, 1, 2, 4);
+    return true;
+}
 
-    // Detect sRGB BEFORE setFileName (which truncates the file when input=output)
-    bool srgb = determineSrgb(job.inputPath.c_str(), job.srgbHint);
+// Channels the reduced-channel path keeps for `format`: BC4 encodes red alone
+// and BC5 red and green. 0 = the format needs all four (the Surface path).
+int encodedChannels(Format format) {
+    switch (format) {
+        case Format_BC4: return 1;
+        case Format_BC5: return 2;
+        default: return 0;
+    }
+}
 
-    // Set up output options
-    OutputOptions outputOptions;
-    outputOptions.setFileName(job.outputPath.c_str());
-    outputOptions.setContainer(Container_DDS10);
+// One level of the reduced-channel path: a few planar float channels
+struct ChannelImage {
+    int width = 0, height = 0, channels = 0;
+    std::vector<float> data; // channel after channel, each row-major
 
-    // Preserve sRGB color space from source texture
-    if (srgb) {
-        outputOptions.setSrgbFlag(true);
+    void reset(int w, int h, int c) {
+        width = w;
+        height = h;
+        channels = c;
+        data.assign((size_t)w * h * c, 0.0f);
     }
+    float* plane(int c) { return data.data() + (size_t)c * width * height; }
+    const float* plane(int c) const { return data.data() + (size_t)c * width * height; }
+};
 
-    // Write header
-    if (!context.outputHeader(surface, numMipmaps, compressionOptions, outputOptions)) {
-        fprintf(stderr, "FAIL:%d/%d:%s:Failed to write DDS header\n",
-                index + 1, total, job.inputPath.c_str());
+// Decode stored level `level` of a BC4/BC5 source into its first `channels`
+// channels. False for a layout (or channel count) this doesn't cover.
+bool decodeChannelLevel(const TextureJob& job, int level, int channels, ChannelImage& image) {
+    const DdsProbe& probe = job.header;
+    SourceLayout layout = sourceLayout(probe);
+    bool snorm = probe.dx10 && (probe.dxgiFormat == 81 || probe.dxgiFormat == 84);
+    int stored = (layout == Layout_BC4) ? 1 : (layout == Layout_BC5) ? 2 : 0;
+    if (snorm || stored < channels) return false;
+
+    int w = probe.width >> level, h = probe.height >> level;
+    size_t offset = probe.dataOffset +
+        sourceLevelOffset(layout, probe.width, probe.height, level);
+    if (w <= 0 || h <= 0 || offset + sourceLevelBytes(layout, w, h) > job.inputData.size()) {
         return false;
     }
 
-    // Use BatchList for all mipmaps of this texture
-    BatchList batch;
-    std::vector<Surface> mipSurfaces;
-    mipSurfaces.reserve(numMipmaps);
-
-    // Generate all mip levels first
-    Surface mipSurface = surface;
-    for (int mip = 0; mip < numMipmaps; mip++) {
-        mipSurfaces.push_back(mipSurface);
-        if (mip < numMipmaps - 1) {
-            mipSurface.buildNextMipmap(MipmapFilter_Kaiser);
+    // Each channel is one BC3-style alpha block, red first
+    const unsigned char* src = job.inputData.data() + offset;
+    image.reset(w, h, channels);
+    unsigned char texels[16][4];
+    for (int by = 0; by < (h + 3) / 4; by++) {
+        for (int bx = 0; bx < (w + 3) / 4; bx++, src += stored * 8) {
+            for (int c = 0; c < channels; c++) {
+                decodeAlphaBlock(src + c * 8, texels);
+                float* plane = image.plane(c);
+                for (int i = 0; i < 16; i++) {
+                    int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+                    if (x < w && y < h) plane[(size_t)y * w + x] = texels[i][3] / 255.0f;
+                }
+            }
         }
     }
+    return true;
+}
 
-    // Add all mips to batch
-    for (int mip = 0; mip < numMipmaps; mip++) {
-        batch.Append(&mipSurfaces[mip], 0, mip, &outputOptions);
+// NVTT's Kaiser filter (width 3, alpha 4, stretch 1), which the Surface path
+// resizes and builds mips with
+double besselI0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 64 && term > sum * 1e-12; k++) {
+        double half = x / (2 * k);
+        term *= half * half;
+        sum += term;
     }
+    return sum;
+}
 
-    // Compress all mips in one GPU call
-    if (!context.compress(batch, compressionOptions)) {
-        fprintf(stderr, "FAIL:%d/%d:%s:Compression failed\n",
-                index + 1, total, job.inputPath.c_str());
-        return false;
+double kaiserWeight(double x) {
+    const double width = 3.0, alpha = 4.0;
+    if (x <= -width || x >= width) return 0;
+    double sinc = (x == 0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+    double t = x / width;
+    return sinc * besselI0(alpha * sqrt(1 - t * t)) / besselI0(alpha);
+}
+
+// Source texel for index `i`, mirrored at the edges like WrapMode_Mirror
+int mirrorIndex(int i, int length) {
+    if (length == 1) return 0;
+    while (i < 0 || i >= length) {
+        if (i < 0) i = -i;
+        if (i >= length) i = 2 * length - i - 2;
     }
+    return i;
+}
 
-    // Patch legacy DDS header to match texconv output
-    patchDdsHeader(job.outputPath.c_str(), newW, newH, format);
+// Normalized Kaiser taps resampling `srcLength` texels to `dstLength`, the
+// same number for every output texel
+struct ResampleTaps {
+    int count = 0;
+    std::vector<int> index;
+    std::vector<float> weight;
+};
 
-    // Report success with details
-    fprintf(stderr, "OK:%d/%d:%s:%dx%d->%dx%d:%s:%d\n",
-            index + 1, total, job.inputPath.c_str(),
-            origW, origH, newW, newH, formatName(format), numMipmaps);
+ResampleTaps resampleTaps(int srcLength, int dstLength) {
+    double scale = (double)dstLength / srcLength;
+    double filterScale = scale < 1 ? scale : 1;
+    double support = 3.0 / filterScale;
 
-    return true;
+    ResampleTaps taps;
+    taps.count = (int)ceil(2 * support) + 1;
+    taps.index.resize((size_t)dstLength * taps.count);
+    taps.weight.resize((size_t)dstLength * taps.count);
+    for (int i = 0; i < dstLength; i++) {
+        double center = (i + 0.5) / scale;
+        int first = (int)floor(center - support);
+        double total = 0;
+        for (int t = 0; t < taps.count; t++) {
+            size_t k = (size_t)i * taps.count + t;
+            double w = kaiserWeight((first + t + 0.5 - center) * filterScale);
+            taps.index[k] = mirrorIndex(first + t, srcLength);
+            taps.weight[k] = (float)w;
+            total += w;
+        }
+        for (int t = 0; t < taps.count; t++) {
+            taps.weight[(size_t)i * taps.count + t] /= (float)total;
+        }
+    }
+    return taps;
 }
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "NVTT3 Batch Compress Tool\n");
-        fprintf(stderr, "Usage: %s <batch_file>\n", argv[0]);
-        fprintf(stderr, "\n");
-        fprintf(stderr, "Batch file format (one per line):\n");
-        fprintf(stderr, "  input.dds|output.dds|max_extent|format\n");
-        fprintf(stderr, "\n");
-        fprintf(stderr, "Formats: bc7 (default), bc4, bc3, bc1, bc5, bc6\n");
-        return 1;
+// Resample every channel of `src` to w x h, rows first, then columns
+ChannelImage resizeChannels(const ChannelImage& src, int w, int h) {
+    ResampleTaps tx = resampleTaps(src.width, w), ty = resampleTaps(src.height, h);
+    ChannelImage rows, dst;
+    rows.reset(w, src.height, src.channels);
+    dst.reset(w, h, src.channels);
+
+    for (int c = 0; c < src.channels; c++) {
+        const float* in = src.plane(c);
+        float* out = rows.plane(c);
+        for (int y = 0; y < src.height; y++) {
+            const float* row = in + (size_t)y * src.width;
+            for (int x = 0; x < w; x++) {
+                const int* index = &tx.index[(size_t)x * tx.count];
+                const float* weight = &tx.weight[(size_t)x * tx.count];
+                float sum = 0;
+                for (int t = 0; t < tx.count; t++) sum += row[index[t]] * weight[t];
+                out[(size_t)y * w + x] = sum;
+            }
+        }
+
+        in = rows.plane(c);
+        out = dst.plane(c);
+        for (int y = 0; y < h; y++) {
+            float* row = out + (size_t)y * w;
+            for (int t = 0; t < ty.count; t++) {
+                size_t k = (size_t)y * ty.count + t;
+                const float* srcRow = in + (size_t)ty.index[k] * w;
+                float weight = ty.weight[k];
+                for (int x = 0; x < w; x++) row[x] += srcRow[x] * weight;
+            }
+        }
     }
+    return dst;
+}
 
-    const char* batchFile = argv[1];
+// Add z = sqrt(1 - x^2 - y^2) to a packed two-channel normal map, so the
+// filtered levels can be renormalized as 3D vectors
+void reconstructNormalZ(ChannelImage& image) {
+    size_t texels = (size_t)image.width * image.height;
+    image.data.resize(texels * 3);
+    image.channels = 3;
+    float* x = image.plane(0);
+    float* y = image.plane(1);
+    float* z = image.plane(2);
+    for (size_t i = 0; i < texels; i++) {
+        float nx = 2 * x[i] - 1, ny = 2 * y[i] - 1;
+        float zz = 1 - nx * nx - ny * ny;
+        z[i] = (zz > 0 ? sqrtf(zz) : 0) * 0.5f + 0.5f;
+    }
+}
 
-    // Parse batch file
-    std::vector<TextureJob> jobs = parseBatchFile(batchFile);
+// Scale packed (x, y, z) normals, shortened by filtering, back to unit length
+void renormalizeNormals(ChannelImage& image) {
+    float* x = image.plane(0);
+    float* y = image.plane(1);
+    float* z = image.plane(2);
+    for (size_t i = 0; i < (size_t)image.width * image.height; i++) {
+        float nx = 2 * x[i] - 1, ny = 2 * y[i] - 1, nz = 2 * z[i] - 1;
+        float length = sqrtf(nx * nx + ny * ny + nz * nz);
+        if (length > 0) {
+            x[i] = nx / length * 0.5f + 0.5f;
+            y[i] = ny / length * 0.5f + 0.5f;
+            z[i] = nz / length * 0.5f + 0.5f;
+        }
+    }
+}
 
-    if (jobs.empty()) {
-        fprintf(stderr, "ERROR:No valid jobs found in batch file\n");
-        return 1;
+// The same for a Surface holding a normal map in its rgb channels.
+// normalizeNormalMap() does nothing unless the Surface is flagged as a normal
+// map, and the flag is cleared again so the DDS header doesn't carry it.
+void renormalizeNormals(Surface& surface) {
+    surface.setNormalMap(true);
+    surface.expandNormals();
+    surface.normalizeNormalMap();
+    surface.packNormals();
+    surface.setNormalMap(false);
+}
+
+// Reduced-channel path for a bc4/bc5 job: decode the source (from stored level
+// `level`) to the channels the format encodes, resize to fit and build the mip
+// chain as planar floats, ready for nvtt_encode() the way loadDirect leaves a
+// texture. Returns false to leave the job to the Surface path.
+bool loadReduced(LoadedTexture& tex, int level) {
+    TextureJob& job = tex.job;
+    int channels = encodedChannels(parseFormat(job.format));
+    if (channels == 0 || job.inputData.empty() || !job.hasHeader) return false;
+
+    ChannelImage image;
+    if (!decodeChannelLevel(job, level, channels, image)) {
+        Surface surface;
+        bool loaded = level > 0 && loadSourceLevel(job, level, surface);
+        if (!loaded) {
+            level = 0;
+            loaded = surface.loadFromMemory(job.inputData.data(),
+                                            (unsigned long long)job.inputData.size());
+        }
+        if (!loaded || surface.isNull()) return false;
+        image.reset(surface.width(), surface.height(), channels);
+        for (int c = 0; c < channels; c++) {
+            memcpy(image.plane(c), surface.channel(c),
+                   (size_t)image.width * image.height * sizeof(float));
+        }
     }
+    bool normals = job.normalMap && channels == 2;
+    if (normals) reconstructNormalZ(image);
 
-    // Report batch start
-    fprintf(stderr, "BATCH_START:%zu\n", jobs.size());
+    // Resize and mips run here on the decode thread, but count as their own
+    // stages like on the Surface path (loadTimed leaves them out of load)
+    StageTimer timer;
+    int maxDim = (image.width > image.height) ? image.width : image.height;
+    if (maxDim > job.maxExtent) {
+        int w = (int)((long long)image.width * job.maxExtent / maxDim);
+        int h = (int)((long long)image.height * job.maxExtent / maxDim);
+        image = resizeChannels(image, w > 0 ? w : 1, h > 0 ? h : 1);
+        if (normals) renormalizeNormals(image);
+    }
+    tex.times.resize += timer.lap();
+
+    int numMipmaps = calcMipCount(image.width, image.height);
+    std::vector<ChannelImage> levels;
+    levels.reserve(numMipmaps);
+    levels.push_back(std::move(image));
+    for (int mip = 1; mip < numMipmaps; mip++) {
+        const ChannelImage& parent = levels.back();
+        int w = (parent.width > 1) ? parent.width / 2 : 1;
+        int h = (parent.height > 1) ? parent.height / 2 : 1;
+        levels.push_back(resizeChannels(parent, w, h));
+        if (normals) renormalizeNormals(levels.back());
+    }
+    tex.times.mips += timer.lap();
 
-    // Create compression context ONCE for entire batch (CUDA init here)
-    Context context(true);
+    // z only steered the renormalization; the encoder gets the first planes
+    size_t bytes = 0;
+    for (const ChannelImage& mip : levels) {
+        bytes += (size_t)mip.width * mip.height * channels * sizeof(float);
+    }
+    BufferPool::Buffer planes = BufferPool::get().host(bytes);
+    if (!planes) return false;
 
-    if (context.isCudaAccelerationEnabled()) {
-        fprintf(stderr, "CUDA:enabled\n");
+    std::vector<RefImage> images(numMipmaps);
+    unsigned char* dst = static_cast<unsigned char*>(planes.data());
+    for (int mip = 0; mip < numMipmaps; mip++) {
+        size_t levelBytes = (size_t)levels[mip].width * levels[mip].height * channels * sizeof(float);
+        memcpy(dst, levels[mip].data.data(), levelBytes);
+        images[mip].data = dst;
+        images[mip].width = levels[mip].width;
+        images[mip].height = levels[mip].height;
+        images[mip].num_channels = channels;
+        images[mip].channel_interleave = false;
+        dst += levelBytes;
+    }
+
+    tex.direct = std::move(planes);
+    tex.directBytes = bytes;
+    tex.directImages = std::move(images);
+    tex.directType = FLOAT32;
+    tex.directWidth = levels[0].width;
+    tex.directHeight = levels[0].height;
+    tex.sourceLevel = level;
+    tex.opaque = true; // no alpha is encoded
+    return true;
+}
+
+// Outcome of one job, handed to an in-process caller (libradium_encode)
+// instead of being printed as its OK:/FAIL: line. Strings are static.
+struct JobResult {
+    int index = 0;
+    bool ok = false;
+    const char* error = nullptr;
+    int origW = 0, origH = 0, newW = 0, newH = 0;
+    Format format = Format_BC7;
+    int mipCount = 0;
+    StageTimes times;
+};
+
+// Set while a libradium_encode engine is alive; protocol lines otherwise
+static std::function<void(const JobResult&)> g_results;
+
+void reportFailure(int index, int total, const std::string& input, const char* error) {
+    if (g_results) {
+        JobResult result;
+        result.index = index;
+        result.error = error;
+        g_results(result);
+        return;
+    }
+    report("FAIL:%d/%d:%s:%s\n", index + 1, total, input.c_str(), error);
+}
+
+// Report a finished texture, with its stage timings when `timing` is set
+void reportSuccess(const LoadedTexture& tex, int total, int origW, int origH,
+                   int newW, int newH, Format format, int mipCount, bool timing) {
+    const StageTimes& times = tex.times;
+    if (g_results) {
+        JobResult result;
+        result.index = tex.index;
+        result.ok = true;
+        result.origW = origW;
+        result.origH = origH;
+        result.newW = newW;
+        result.newH = newH;
+        result.format = format;
+        result.mipCount = mipCount;
+        result.times = times;
+        g_results(result);
+    } else if (timing) {
+        report("OK:%d/%d:%s:%dx%d->%dx%d:%s:%d:"
+               "load=%.3f,upload=%.3f,resize=%.3f,mips=%.3f,encode=%.3f,patch=%.3f,write=%.3f\n",
+                tex.index + 1, total, tex.job.inputPath.c_str(),
+                origW, origH, newW, newH, formatName(format), mipCount,
+                times.load, times.upload, times.resize, times.mips,
+                times.encode, times.patch, times.write);
     } else {
-        fprintf(stderr, "CUDA:disabled\n");
+        report("OK:%d/%d:%s:%dx%d->%dx%d:%s:%d\n",
+                tex.index + 1, total, tex.job.inputPath.c_str(),
+                origW, origH, newW, newH, formatName(format), mipCount);
     }
+}
 
-    // Process all textures
-    int succeeded = 0;
-    int failed = 0;
+// Formats --auto-bc1 replaces with BC1 for opaque sources
+bool hasAlphaBlocks(Format format) {
+    return format == Format_BC3 || format == Format_BC7;
+}
 
-    for (size_t i = 0; i < jobs.size(); i++) {
-        if (processTexture(jobs[i], context, (int)i, (int)jobs.size())) {
-            succeeded++;
-        } else {
-            failed++;
+// Bits [pos, pos + count) of a 128-bit BC7 block, least significant first
+unsigned blockBits(const unsigned char* block, int pos, int count) {
+    unsigned value = 0;
+    for (int i = 0; i < count; i++, pos++) {
+        value |= (unsigned)((block[pos >> 3] >> (pos & 7)) & 1) << i;
+    }
+    return value;
+}
+
+// Whether a BC7 block decodes to alpha 255 everywhere, as far as its mode and
+// alpha endpoints tell: modes 0-3 store no alpha, the others count only when
+// every endpoint of the channel decoded as alpha is at its maximum. Modes 4
+// and 5 may rotate a color channel into alpha.
+bool bc7BlockOpaque(const unsigned char* block) {
+    int mode = 0;
+    while (mode < 8 && !(block[0] & (1 << mode))) mode++;
+    int rotation = (mode == 4 || mode == 5) ? (int)blockBits(block, mode + 1, 2) : 0;
+    switch (mode) {
+        case 0: case 1: case 2: case 3: return true;
+        case 4: return rotation == 0
+            ? blockBits(block, 38, 6) == 63 && blockBits(block, 44, 6) == 63
+            : blockBits(block, 8 + (rotation - 1) * 10, 10) == 0x3ff;
+        case 5: return rotation == 0
+            ? blockBits(block, 50, 16) == 0xffff
+            : blockBits(block, 8 + (rotation - 1) * 14, 14) == 0x3fff;
+        case 6: return blockBits(block, 49, 7) == 127 && blockBits(block, 56, 7) == 127 &&
+                       blockBits(block, 63, 2) == 3;
+        case 7: return blockBits(block, 74, 20) == 0xfffff && blockBits(block, 94, 4) == 15;
+        default: return false; // reserved mode, decodes to zero
+    }
+}
+
+// Whether every block of a stored BC3 or BC7 w x h level decodes to alpha 255.
+// Conservative: a block that might hold less counts as not opaque.
+bool storedLevelOpaque(SourceLayout layout, const unsigned char* blocks, int w, int h) {
+    if (layout != Layout_BC3 && layout != Layout_BC7) return false;
+    size_t count = (size_t)((w + 3) / 4) * (size_t)((h + 3) / 4);
+    unsigned char texels[16][4];
+    for (size_t i = 0; i < count; i++, blocks += 16) {
+        if (layout == Layout_BC7) {
+            if (!bc7BlockOpaque(blocks)) return false;
+            continue;
+        }
+        decodeAlphaBlock(blocks, texels);
+        for (int t = 0; t < 16; t++) {
+            if (texels[t][3] != 255) return false;
         }
     }
+    return true;
+}
 
-    // Report batch complete
-    fprintf(stderr, "BATCH_END:%d:%d\n", succeeded, failed);
+// The stored blocks are already what an encode to `format` would emit: same
+// block format and, for BC4/BC5, unsigned (NVTT writes the UNORM variants)
+bool layoutMatchesFormat(const DdsProbe& probe, Format format) {
+    SourceLayout layout = sourceLayout(probe);
+    bool snorm = probe.dx10 && (probe.dxgiFormat == 81 || probe.dxgiFormat == 84);
+    switch (format) {
+        case Format_BC1: return layout == Layout_BC1;
+        case Format_BC3: return layout == Layout_BC3;
+        case Format_BC4: return layout == Layout_BC4 && !snorm;
+        case Format_BC5: return layout == Layout_BC5 && !snorm;
+        case Format_BC7: return layout == Layout_BC7;
+        default: return false;
+    }
+}
 
-    return (failed > 0) ? 1 : 0;
+// --copy-mips: when the source already stores the job's output, a level of the
+// target size in the target format with its full chain below, write a fresh
+// header and those levels as they are. Returns false when the job needs an
+// encode; otherwise the job is finished, reported OK or FAIL, and `tex.copied`
+// is set if it succeeded. `readMs` is the time spent reading the source, which
+// is all of a copied job's load stage.
+bool copyStoredMips(LoadedTexture& tex, const PipelineOptions& options, int total,
+                    double readMs, bool* ok) {
+    const TextureJob& job = tex.job;
+    const DdsProbe& probe = job.header;
+    Format format = parseFormat(job.format);
+    if (job.inputData.empty() || !layoutMatchesFormat(probe, format)) return false;
+
+    int level = reusableMipLevel(probe, job.maxExtent);
+    int w = probe.width >> level, h = probe.height >> level;
+    int numMipmaps = calcMipCount(w, h);
+    if ((w > h ? w : h) > job.maxExtent || numMipmaps < 2 ||
+        probe.mipCount < level + numMipmaps) {
+        return false;
+    }
+
+    SourceLayout layout = sourceLayout(probe);
+    size_t offset = probe.dataOffset + sourceLevelOffset(layout, probe.width, probe.height, level);
+    size_t bytes = sourceLevelOffset(layout, w, h, numMipmaps);
+    if (offset + bytes > job.inputData.size()) return false;
+
+    // With --auto-bc1 an opaque source is re-encoded as BC1 (see prepareTexture);
+    // the level's blocks tell without a decode
+    if (options.autoBc1 && hasAlphaBlocks(format)) {
+        tex.opaque = storedLevelOpaque(layout, job.inputData.data() + offset, w, h);
+    }
+    if (options.autoBc1 && tex.opaque && hasAlphaBlocks(format)) return false;
+
+    StageTimer timer;
+    tex.times.load += readMs;
+    tex.srgb = determineSrgb(probe, job.srgbHint);
+    std::vector<unsigned char> dds = buildDdsHeader(w, h, numMipmaps, format, tex.srgb);
+    dds.insert(dds.end(), job.inputData.begin() + offset, job.inputData.begin() + offset + bytes);
+    tex.times.patch += timer.lap();
+
+    *ok = writeOutputFile(job.outputPath, dds, options.atomicWrite);
+    tex.times.write += timer.lap();
+    if (!*ok) {
+        reportFailure(tex.index, total, job.inputPath, "Failed to write output file");
+        return true;
+    }
+    tex.copied = true;
+    reportSuccess(tex, total, probe.width, probe.height, w, h, format, numMipmaps, options.timing);
+    return true;
 }
+
+// CPU stage: read and decode a job and detect its color space. `total` is the
+// batch size, or 0 in server mode where the job count isn't known. With
+// `keepSource`, in-memory source bytes stay with the job so it can be decoded
+// again if the GPU fails it.
+// With --reuse-mips, a job that shrinks a mipmapped DDS decodes from the stored
+// level nearest its target instead of the top level; with --copy-mips, one that
+// keeps the source format may be finished right here (see copyStoredMips).
+bool loadTexture(LoadedTexture& tex, int total, const PipelineOptions& options, bool keepSource) {
+    TextureJob& job = tex.job;
+    bool reuseMips = options.reuseMips || options.copyMips;
+    bool reduced = encodedChannels(parseFormat(job.format)) > 0;
+    StageTimer timer;
+
+    // Read the file once and probe and decode from that buffer instead of
+    // opening it three times. With a header from the caller, only jobs that
+    // might take the direct or reduced-channel path (or start at a stored mip)
+    // need the bytes; the rest let Surface::load read.
+    bool fits = job.hasHeader &&
+        job.header.width <= job.maxExtent && job.header.height <= job.maxExtent;
+    if (job.inputData.empty() && (!job.hasHeader || fits || reuseMips || reduced) &&
+        !readFile(job.inputPath.c_str(), job.inputData)) {
+        reportFailure(tex.index, total, job.inputPath, "Failed to load DDS file");
+        return false;
+    }
+    if (!job.inputData.empty() &&
+        probeDdsHeader(job.inputData.data(), job.inputData.size(), job.header)) {
+        job.hasHeader = true;
+    }
+
+    bool copiedOk = false;
+    if (options.copyMips && copyStoredMips(tex, options, total, timer.lap(), &copiedOk)) {
+        std::vector<unsigned char>().swap(job.inputData);
+        return copiedOk;
+    }
+
+    int level = (options.reuseMips && !job.inputData.empty())
+        ? reusableMipLevel(job.header, job.maxExtent) : 0;
+    if (!job.inputData.empty() && (loadDirect(tex, level) || loadReduced(tex, level))) {
+        if (!keepSource) std::vector<unsigned char>().swap(job.inputData);
+        tex.srgb = determineSrgb(job.header, job.srgbHint);
+        return true;
+    }
+
+    bool loaded;
+    if (level > 0 && loadSourceLevel(job, level, tex.surface)) {
+        tex.sourceLevel = level;
+        loaded = true;
+    } else {
+        loaded = job.inputData.empty()
+            ? tex.surface.load(job.inputPath.c_str())
+            : tex.surface.loadFromMemory(job.inputData.data(), (unsigned long long)job.inputData.size());
+    }
+    if (!keepSource) std::vector<unsigned char>().swap(job.inputData); // decoded, drop the copy
+    // A header NVTT can't allocate for "loads" as an empty Surface
+    if (!loaded || tex.surface.isNull()) {
+        reportFailure(tex.index, total, job.inputPath, "Failed to load DDS file");
+        return false;
+    }
+
+    // Let NVTT3 auto-detect alpha mode for correct BC7 mode selection.
+    // AlphaMode_None would cause BC7 to use modes 0-3 (no alpha), destroying
+    // alpha data needed for terrain blending. patchDdsHeader() handles the
+    // miscFlags2 header separately for Skyrim compatibility.
+    // Only a source that is opaque everywhere is encoded as such: the Surface
+    // path's counterpart of SetIsOpaque, carried by every resized level and mip.
+    float alphaMin = 0, alphaMax = 0;
+    tex.surface.range(3, &alphaMin, &alphaMax);
+    tex.opaque = alphaMin >= 1.0f;
+    if (tex.opaque) tex.surface.setAlphaMode(AlphaMode_None);
+
+    tex.srgb = determineSrgb(job.header, job.srgbHint);
+    return true;
+}
+
+// Collects everything NVTT emits for one texture, header included
+struct MemoryOutputHandler : public OutputHandler {
+    std::vector<unsigned char> data;
+
+    void beginImage(int, int, int, int, int, int) override {}
+    bool writeData(const void* bytes, int size) override {
+        const unsigned char* p = static_cast<const unsigned char*>(bytes);
+        data.insert(data.end(), p, p + size);
+        return true;
+    }
+    void endImage() override {}
+};
+
+// A job on its way through the pipeline: decoded on a CPU thread, then
+// resized, given its header and mip chain on the GPU thread, and compressed
+// alone or packed with other small textures. Jobs move between threads by
+// pointer only; nvtt::Surface copies share reference-counted state, so a
+// Surface must never be copied across threads.
+struct PreparedTexture {
+    LoadedTexture tex;
+    Format format;
+    Quality quality;
+    int origW, origH;
+    int newW, newH;
+    int numMipmaps;
+    bool streamMips;          // compress level by level instead of as a chain
+    CompressionOptions compressionOptions;
+    MemoryOutputHandler output;
+    std::unique_ptr<OutputOptions> outputOptions; // routes into `output`
+    std::vector<Surface> mipSurfaces;
+    double pixels = 0;        // source pixels, the load charged to its worker
+    int device = -1;          // CUDA device of its worker, -1 = CPU engine
+    const char* error = nullptr; // reason given on the FAIL: line
+    bool retryable = true;    // a GPU failure the CPU engine may redo
+    bool retry = false;       // handed to the CPU engine, must be decoded again
+    bool writePending = false; // patched, left to the write-behind thread
+};
+
+// Record why a GPU-stage step failed; the pipeline reports it (or retries)
+bool failTexture(PreparedTexture& prep, const char* error, bool retryable = true) {
+    prep.error = error;
+    prep.retryable = retryable;
+    return false;
+}
+
+// Run one step of a job so that an exception out of NVTT or an allocation (a
+// bad_alloc on an absurd header, mostly) fails that job, instead of
+// terminating the process and every other job in flight with it
+template <typename Step>
+bool guarded(PreparedTexture& prep, Step step) {
+    try {
+        return step();
+    } catch (...) {
+        return failTexture(prep, "Unexpected exception");
+    }
+}
+
+// CPU stage, timed: loadTexture (guarded) with its time charged to the load
+// stage, less the resize and mip work the reduced-channel path times itself
+bool loadTimed(PreparedTexture& prep, int total, const PipelineOptions& options, bool keepSource) {
+    StageTimes& times = prep.tex.times;
+    double charged = times.resize + times.mips;
+    StageTimer timer;
+    bool loaded = guarded(prep, [&] {
+        return loadTexture(prep.tex, total, options, keepSource);
+    });
+    times.load += timer.lap() - (times.resize + times.mips - charged);
+    return loaded;
+}
+
+// Textures at or below this size after resizing are eligible for --pack
+static const int kPackMaxExtent = 512;
+
+// GPU failures in a row after which the GPU's Context is recreated
+static const int kGpuFailureLimit = 3;
+
+// Working set of a whole w x h mip chain held at once: NVTT keeps surfaces
+// as 4-channel float, and the chain adds a third on top of the base level
+size_t mipChainBytes(int w, int h) {
+    size_t base = (size_t)w * (size_t)h * 4 * sizeof(float);
+    return base + base / 3;
+}
+
+// Start the output buffer with the DDS header. Starting over discards any
+// partial data, so this is also how a failed packed submission is retried on
+// its own.
+bool writeOutputHeader(PreparedTexture& prep, Context& context) {
+    prep.output.data.clear();
+    prep.outputOptions.reset(new OutputOptions());
+    prep.outputOptions->setOutputHandler(&prep.output);
+    prep.outputOptions->setContainer(Container_DDS10);
+
+    // Preserve sRGB color space from source texture
+    if (prep.tex.srgb) {
+        prep.outputOptions->setSrgbFlag(true);
+    }
+
+    if (prep.tex.direct) {
+        return context.outputHeader(TextureType_2D, prep.newW, prep.newH, 1, prep.numMipmaps,
+                                    false, prep.compressionOptions, *prep.outputOptions);
+    }
+    return context.outputHeader(prep.tex.surface, prep.numMipmaps,
+                                prep.compressionOptions, *prep.outputOptions);
+}
+
+// GPU stage, part 1: resize, write the header and build every mip level.
+// Chains that wouldn't fit the VRAM budget are left for encodePrepared to
+// build and compress one level at a time.
+bool prepareTexture(PreparedTexture& prep, Context& context, const PipelineOptions& options) {
+    const TextureJob& job = prep.tex.job;
+    Surface& surface = prep.tex.surface;
+
+    prep.format = parseFormat(job.format);
+    prep.quality = job.quality >= 0 ? (Quality)job.quality : options.quality;
+    if (options.autoBc1 && prep.tex.opaque && hasAlphaBlocks(prep.format)) {
+        prep.format = Format_BC1;
+    }
+
+    // Set up compression options
+    prep.compressionOptions.setFormat(prep.format);
+    prep.compressionOptions.setQuality(prep.quality);
+
+    if (prep.tex.direct) {
+        prep.origW = job.header.width;
+        prep.origH = job.header.height;
+        prep.newW = prep.tex.directWidth;
+        prep.newH = prep.tex.directHeight;
+        prep.numMipmaps = (int)prep.tex.directImages.size();
+        prep.streamMips = false;
+        if (!writeOutputHeader(prep, context)) {
+            return failTexture(prep, "Failed to write DDS header");
+        }
+        return true;
+    }
+
+    // Report the source's own size even when decoding started at a stored mip
+    bool fromLevel = prep.tex.sourceLevel > 0;
+    prep.origW = fromLevel ? job.header.width : surface.width();
+    prep.origH = fromLevel ? job.header.height : surface.height();
+    StageTimes& times = prep.tex.times;
+    StageTimer timer;
+
+    // Move surface to GPU for CUDA-accelerated operations (CPU engine
+    // contexts keep everything on the host)
+    if (context.isCudaAccelerationEnabled()) {
+        surface.ToGPU();
+    }
+    times.upload += timer.lap();
+
+    // Resize if needed
+    int maxDim = (surface.width() > surface.height()) ? surface.width() : surface.height();
+    if (maxDim > job.maxExtent) {
+        surface.resize(job.maxExtent, RoundMode_None, ResizeFilter_Kaiser);
+        if (job.normalMap) renormalizeNormals(surface);
+    }
+    times.resize += timer.lap();
+
+    prep.newW = surface.width();
+    prep.newH = surface.height();
+    prep.numMipmaps = calcMipCount(prep.newW, prep.newH);
+    prep.streamMips = options.vramBudget > 0 &&
+        mipChainBytes(prep.newW, prep.newH) > options.vramBudget;
+
+    // Write header
+    if (!writeOutputHeader(prep, context)) {
+        return failTexture(prep, "Failed to write DDS header");
+    }
+
+    if (prep.streamMips) return true;
+    timer.lap();
+
+    // Generate all mip levels first
+    prep.mipSurfaces.reserve(prep.numMipmaps);
+    Surface mipSurface = surface;
+    for (int mip = 0; mip < prep.numMipmaps; mip++) {
+        prep.mipSurfaces.push_back(mipSurface);
+        if (mip < prep.numMipmaps - 1) {
+            mipSurface.buildNextMipmap(MipmapFilter_Kaiser);
+            if (job.normalMap) renormalizeNormals(mipSurface);
+        }
+    }
+    times.mips += timer.lap();
+
+    return true;
+}
+
+// Encode the mips of every texture straight from their GPU buffers into
+// `deviceBlocks`, then bring all the blocks back with one copy. All textures
+// must share a format. Returns false, leaving outputs untouched, if any mip
+// isn't on the device or a CUDA/NVTT call fails.
+bool compressResident(const std::vector<PreparedTexture*>& textures, DeviceBuffer& deviceBlocks) {
+    std::vector<RefImage> images;
+    for (PreparedTexture* prep : textures) {
+        for (const Surface& mip : prep->mipSurfaces) {
+            RefImage image;
+            image.data = mip.gpuData();
+            if (!image.data) return false;
+            image.width = mip.width();
+            image.height = mip.height();
+            image.channel_interleave = false; // Surfaces store planar channels
+            images.push_back(image);
+        }
+    }
+
+    std::vector<unsigned> tiles(images.size());
+    GPUInputBuffer input(images.data(), FLOAT32, (int)images.size(), 4, 4,
+                         1.0f, 1.0f, 1.0f, 1.0f, nullptr, tiles.data());
+
+    size_t blockBytes = (size_t)blockSizeForFormat(textures[0]->format);
+    size_t totalTiles = 0;
+    for (unsigned count : tiles) totalTiles += count;
+    if (!deviceBlocks.reserve(totalTiles * blockBytes)) return false;
+
+    bool opaque = true;
+    for (PreparedTexture* prep : textures) opaque = opaque && prep->tex.opaque;
+
+    EncodeSettings settings = EncodeSettings().SetFormat(textures[0]->format)
+                                              .SetQuality(textures[0]->quality)
+                                              .SetIsOpaque(opaque)
+                                              .SetUseGPU(true)
+                                              .SetOutputToGPUMem(true);
+    if (!nvtt_encode(input, deviceBlocks.data(), settings)) return false;
+
+    // Into a pooled, page-locked buffer, so the copy back DMAs directly
+    size_t bytes = totalTiles * blockBytes;
+    BufferPool::Buffer staging = BufferPool::get().host(bytes);
+    if (!staging || !CudaDriver::get().copyToHost(staging.data(), deviceBlocks.ptr(), bytes)) {
+        return false;
+    }
+    const unsigned char* blocks = static_cast<const unsigned char*>(staging.data());
+
+    // Blocks come out image after image, in the order the mips were given
+    size_t offset = 0, image = 0;
+    for (PreparedTexture* prep : textures) {
+        size_t begin = offset;
+        for (size_t mip = 0; mip < prep->mipSurfaces.size(); mip++) {
+            offset += tiles[image++] * blockBytes;
+        }
+        prep->output.data.insert(prep->output.data.end(), blocks + begin, blocks + offset);
+    }
+    return true;
+}
+
+// Compress the mips of every texture in one BatchList / one GPU submission.
+// All textures must share compression options. With `deviceBlocks`, try the
+// GPU-resident path first.
+bool compressPrepared(const std::vector<PreparedTexture*>& textures, Context& context,
+                      DeviceBuffer* deviceBlocks) {
+    StageTimer timer;
+    bool ok = deviceBlocks && compressResident(textures, *deviceBlocks);
+    if (!ok) {
+        BatchList batch;
+        for (PreparedTexture* prep : textures) {
+            for (int mip = 0; mip < prep->numMipmaps; mip++) {
+                batch.Append(&prep->mipSurfaces[mip], 0, mip, prep->outputOptions.get());
+            }
+        }
+        ok = context.compress(batch, textures[0]->compressionOptions);
+    }
+
+    // One submission for all of them: share its time out by pixel count
+    double encode = timer.lap();
+    double upload = drainUploadTiming(context);
+    double pixels = 0;
+    for (PreparedTexture* prep : textures) pixels += (double)prep->newW * prep->newH;
+    for (PreparedTexture* prep : textures) {
+        double share = pixels > 0 ? (double)prep->newW * prep->newH / pixels : 0;
+        prep->tex.times.upload += upload * share;
+        prep->tex.times.encode += (encode - upload) * share;
+    }
+    return ok;
+}
+
+// Write a finished texture's output file and report it
+bool writeTexture(PreparedTexture& prep, const PipelineOptions& options, int total) {
+    StageTimer timer;
+    bool written = writeOutputFile(prep.tex.job.outputPath, prep.output.data, options.atomicWrite);
+    std::vector<unsigned char>().swap(prep.output.data);
+    prep.tex.times.write += timer.lap();
+    if (!written) {
+        return failTexture(prep, "Failed to write output file", false);
+    }
+
+    reportSuccess(prep.tex, total, prep.origW, prep.origH, prep.newW, prep.newH,
+                  prep.format, prep.numMipmaps, options.timing);
+    return true;
+}
+
+// GPU stage, part 2: patch the buffered header, then write the file and
+// report, or with --io-depth leave both to the write-behind thread
+bool finishTexture(PreparedTexture& prep, const PipelineOptions& options, int total) {
+    prep.outputOptions.reset();
+    prep.mipSurfaces.clear();
+
+    // Patch legacy DDS header to match texconv output
+    StageTimer timer;
+    patchDdsHeader(prep.output.data, prep.newW, prep.newH, prep.format);
+    prep.tex.times.patch += timer.lap();
+
+    if (options.ioDepth > 0) {
+        prep.writePending = true;
+        return true;
+    }
+    return writeTexture(prep, options, total);
+}
+
+// Compress each level as soon as it's built, then replace it with the next,
+// so only one level (plus the one being filtered) is ever alive
+bool compressStreamed(PreparedTexture& prep, Context& context) {
+    Surface& level = prep.tex.surface;
+    StageTimes& times = prep.tex.times;
+    StageTimer timer;
+    for (int mip = 0; mip < prep.numMipmaps; mip++) {
+        bool ok = context.compress(level, 0, mip, prep.compressionOptions, *prep.outputOptions);
+        double upload = drainUploadTiming(context);
+        double encode = timer.lap();
+        times.upload += upload;
+        times.encode += encode - upload;
+        if (!ok) return false;
+        if (mip < prep.numMipmaps - 1) {
+            level.buildNextMipmap(MipmapFilter_Kaiser);
+            if (prep.tex.job.normalMap) renormalizeNormals(level);
+            times.mips += timer.lap();
+        }
+    }
+    return true;
+}
+
+// Encode a direct-path texture's whole mip chain with one nvtt_encode() call,
+// straight into the output buffer after its header. On a GPU the levels go up
+// in a single copy from their pooled (page-locked) host buffer into a pooled
+// device buffer; if that isn't possible NVTT uploads them itself.
+bool compressDirect(PreparedTexture& prep, Context& context) {
+    LoadedTexture& tex = prep.tex;
+    const std::vector<RefImage>& images = tex.directImages;
+    int count = (int)images.size();
+    tex.directTiles.assign(count, 0);
+
+    bool useGpu = context.isCudaAccelerationEnabled();
+    EncodeSettings settings = EncodeSettings().SetFormat(prep.format)
+                                              .SetQuality(prep.quality)
+                                              .SetIsOpaque(tex.opaque)
+                                              .SetUseGPU(useGpu);
+    StageTimer timer;
+    std::unique_ptr<CPUInputBuffer> cpuInput;
+    std::unique_ptr<GPUInputBuffer> gpuInput;
+    BufferPool::Buffer deviceLevels;
+    if (useGpu) {
+        deviceLevels = BufferPool::get().device(prep.device, tex.directBytes);
+        if (deviceLevels &&
+            CudaDriver::get().copyToDevice(deviceLevels.ptr(), tex.direct.data(), tex.directBytes)) {
+            std::vector<RefImage> onDevice = images;
+            for (RefImage& image : onDevice) {
+                size_t offset = static_cast<const unsigned char*>(image.data) -
+                                static_cast<const unsigned char*>(tex.direct.data());
+                image.data = static_cast<unsigned char*>(deviceLevels.data()) + offset;
+            }
+            gpuInput.reset(new GPUInputBuffer(onDevice.data(), tex.directType, count, 4, 4,
+                                              1.0f, 1.0f, 1.0f, 1.0f, nullptr, tex.directTiles.data()));
+        } else {
+            cpuInput.reset(new CPUInputBuffer(images.data(), tex.directType, count, 4, 4,
+                                              1.0f, 1.0f, 1.0f, 1.0f, nullptr, tex.directTiles.data()));
+            gpuInput.reset(new GPUInputBuffer(*cpuInput));
+        }
+        tex.times.upload += timer.lap();
+    } else {
+        cpuInput.reset(new CPUInputBuffer(images.data(), tex.directType, count, 4, 4,
+                                          1.0f, 1.0f, 1.0f, 1.0f, nullptr, tex.directTiles.data()));
+    }
+
+    // Levels come out back to back, in the order they were given
+    size_t totalTiles = 0;
+    for (unsigned tiles : tex.directTiles) totalTiles += tiles;
+    size_t headerBytes = prep.output.data.size();
+    prep.output.data.resize(headerBytes + totalTiles * blockSizeForFormat(prep.format));
+    unsigned char* blocks = prep.output.data.data() + headerBytes;
+
+    bool ok = gpuInput ? nvtt_encode(*gpuInput, blocks, settings)
+                       : nvtt_encode(*cpuInput, blocks, settings);
+    tex.times.encode += timer.lap();
+    tex.direct.release();
+    tex.directImages.clear();
+    if (!ok) prep.output.data.resize(headerBytes);
+    return ok;
+}
+
+// Compress one prepared texture on its own
+bool encodePrepared(PreparedTexture& prep, Context& context, DeviceBuffer* deviceBlocks,
+                    const PipelineOptions& options, int total) {
+    std::vector<PreparedTexture*> single(1, &prep);
+
+    // Compress all mips in one GPU call, or level by level if over budget
+    bool compressed = prep.tex.direct ? compressDirect(prep, context)
+                    : prep.streamMips ? compressStreamed(prep, context)
+                                      : compressPrepared(single, context, deviceBlocks);
+    if (!compressed) {
+        return failTexture(prep, "Compression failed");
+    }
+
+    return finishTexture(prep, options, total);
+}
+
+// The Contexts a run encodes with, created once for the whole batch or
+// server lifetime: one per GPU, plus the CPU engine's Context(false)s. A
+// single GPU is left to NVTT's default choice; with several,
+// useCurrentDevice() makes each Context (and every later call) use the
+// device made current on the calling thread.
+class DeviceSet {
+public:
+    explicit DeviceSet(const PipelineOptions& options) {
+        CudaDriver& driver = CudaDriver::get();
+        int requested = options.devices;
+        int visible = (requested != 1 && driver.available()) ? driver.deviceCount() : 0;
+        int count = (requested == 0 || requested > visible) ? visible : requested;
+
+        if (options.cpuOnly) count = 0;
+        if (count > 1) {
+            useCurrentDevice();
+            for (int device = 0; device < count; device++) {
+                if (!driver.makeCurrent(device)) break;
+                m_gpus.emplace_back(new Context(true));
+            }
+            m_multi = m_gpus.size() > 1;
+        }
+        if (m_gpus.empty() && !options.cpuOnly) {
+            std::unique_ptr<Context> context(new Context(true));
+            if (context->isCudaAccelerationEnabled()) m_gpus.push_back(std::move(context));
+        }
+
+        // Without a GPU the CPU engine does everything, so it needs a worker
+        int cpuWorkers = options.cpuWorkers;
+        if (cpuWorkers < 0) cpuWorkers = m_gpus.empty() ? options.streams : 1;
+        if (m_gpus.empty() && cpuWorkers < 1) cpuWorkers = 1;
+        for (int i = 0; i < cpuWorkers; i++) {
+            m_cpus.emplace_back(new Context(false));
+        }
+
+        m_timing = options.timing;
+        if (m_timing) {
+            for (auto& context : m_gpus) context->enableTiming(true);
+            for (auto& context : m_cpus) context->enableTiming(true);
+        }
+        // Staging buffers only pay for page-locking when there's a GPU to copy to
+        BufferPool::get().enablePinned(cudaEnabled());
+    }
+
+    int gpuCount() const { return (int)m_gpus.size(); }
+    int cpuCount() const { return (int)m_cpus.size(); }
+    Context& gpuContext(int device) { return *m_gpus[device]; }
+    Context& cpuContext(int i) { return *m_cpus[i]; }
+    bool cudaEnabled() const { return !m_gpus.empty(); }
+
+    // Make `device` current on the calling thread before using its Context
+    bool bind(int device) const {
+        return !m_multi || CudaDriver::get().makeCurrent(device);
+    }
+
+    // Replace the Context of a GPU that keeps failing, dropping whatever state
+    // the old one was left in. Only from that GPU's thread.
+    Context& resetGpu(int device) {
+        bind(device);
+        m_gpus[device].reset();
+        m_gpus[device].reset(new Context(true));
+        if (m_timing) m_gpus[device]->enableTiming(true);
+        return *m_gpus[device];
+    }
+
+private:
+    std::vector<std::unique_ptr<Context>> m_gpus;
+    std::vector<std::unique_ptr<Context>> m_cpus;
+    bool m_multi = false;
+    bool m_timing = false;
+};
+
+// Bounded blocking queue between pipeline stages
+template <typename T>
+class WorkQueue {
+public:
+    explicit WorkQueue(size_t capacity) : m_capacity(capacity) {}
+
+    // Blocks while the queue is full
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [&] { return m_items.size() < m_capacity; });
+        m_items.push_back(std::move(item));
+        m_notEmpty.notify_one();
+    }
+
+    // Returns false immediately if nothing is queued
+    bool tryPop(T& item) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_items.empty()) return false;
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and empty
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [&] { return !m_items.empty() || m_closed; });
+        if (m_items.empty()) return false;
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_notEmpty.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<T> m_items;
+    size_t m_capacity;
+    bool m_closed = false;
+};
+
+// Decodes on `streams` CPU threads and encodes on one GPU thread that owns
+// the Context. Jobs are numbered in submission order; results are reported
+// in completion order. With packSize > 1, up to packSize small textures that
+// share a format are compressed together in one BatchList, as long as their
+// chains fit the VRAM budget together.
+class EncodePipeline {
+public:
+    EncodePipeline(DeviceSet& devices, const PipelineOptions& options, int total)
+        : m_devices(devices), m_options(options), m_total(total),
+          m_pending((size_t)options.streams * 2),
+          m_reads((size_t)(options.ioDepth > 0 ? options.ioDepth : 1)),
+          m_writes((size_t)(options.ioDepth > 0 ? options.ioDepth : 1)) {
+        for (int device = 0; device < devices.gpuCount(); device++) {
+            m_workers.emplace_back(new Worker(device, devices.gpuContext(device), true,
+                                              (size_t)options.streams));
+        }
+        for (int i = 0; i < devices.cpuCount(); i++) {
+            m_cpuWorkers.emplace_back(new Worker(-1, devices.cpuContext(i), false,
+                                                 (size_t)options.streams));
+        }
+        // Retries decode the job again, so keep its source until the GPU is done
+        m_keepSource = !m_workers.empty() && !m_cpuWorkers.empty();
+        for (int i = 0; i < options.ioDepth; i++) {
+            m_readers.emplace_back(&EncodePipeline::readLoop, this);
+        }
+        if (options.ioDepth > 0) m_writer = std::thread(&EncodePipeline::writeLoop, this);
+        for (int i = 0; i < options.streams; i++) {
+            m_decoders.emplace_back(&EncodePipeline::decodeLoop, this);
+        }
+        for (auto& worker : m_workers) {
+            worker->thread = std::thread(&EncodePipeline::encodeLoop, this, worker.get());
+        }
+        for (auto& worker : m_cpuWorkers) {
+            worker->thread = std::thread(&EncodePipeline::encodeLoop, this, worker.get());
+        }
+    }
+
+    ~EncodePipeline() { finish(); }
+
+    // Queue a job; returns its 1-based number, as on its OK:/FAIL: line
+    int submit(TextureJob job) {
+        std::unique_ptr<PreparedTexture> prep(new PreparedTexture());
+        prep->tex.job = std::move(job);
+        prep->tex.index = nextIndex();
+        int number = prep->tex.index + 1;
+        if (m_readers.empty()) {
+            m_pending.push(std::move(prep));
+        } else {
+            m_reads.push(std::move(prep));
+        }
+        return number;
+    }
+
+    // Number the next job as if `count` jobs had already been done, without
+    // counting them in succeeded()/failed() (--resume-from)
+    void skip(int count) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_submitted += count;
+        m_done += count;
+    }
+
+    // Count a job line that couldn't be parsed so numbering stays in step
+    void reject(const std::string& line) {
+        int index = nextIndex();
+        reportFailure(index, m_total, line, "Invalid job line");
+        complete(false);
+    }
+
+    // Block until every submitted job has been reported
+    void drain() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [&] { return m_done == m_submitted; });
+    }
+
+    // Finish outstanding work and stop all threads. The GPUs go first as
+    // they may still hand failed textures to the CPU engine; the writer last,
+    // as every worker may still queue outputs.
+    void finish() {
+        if (m_finished) return;
+        m_finished = true;
+        m_reads.close();
+        for (auto& t : m_readers) t.join();
+        m_pending.close();
+        for (auto& t : m_decoders) t.join();
+        for (auto& worker : m_workers) worker->decoded.close();
+        for (auto& worker : m_workers) worker->thread.join();
+        for (auto& worker : m_cpuWorkers) worker->decoded.close();
+        for (auto& worker : m_cpuWorkers) worker->thread.join();
+        m_writes.close();
+        if (m_writer.joinable()) m_writer.join();
+    }
+
+    int succeeded() const { return m_succeeded; }
+    int failed() const { return m_failed; }
+
+private:
+    // One GPU, or one CPU engine thread: its Context, the decoded textures
+    // routed to it and its thread
+    struct Worker {
+        Worker(int device, Context& context, bool gpu, size_t capacity)
+            : device(device), context(&context), gpu(gpu), decoded(capacity) {}
+
+        int device;                                 // -1 for the CPU engine
+        Context* context;                           // replaced by recoverGpu()
+        bool gpu;
+        int failures = 0;                           // GPU failures in a row (`thread` only)
+        bool wasReset = false;                      // no success since recoverGpu() reset it
+        bool retired = false;                       // routed nothing more (m_mutex)
+        WorkQueue<std::unique_ptr<PreparedTexture>> decoded;
+        std::unique_ptr<DeviceBuffer> deviceBlocks; // used from `thread` only
+        double pixels = 0;                          // routed, not yet done (m_mutex)
+        std::thread thread;
+    };
+
+    int nextIndex() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_submitted++;
+    }
+
+    void complete(bool ok) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (ok) m_succeeded++; else m_failed++;
+        m_done++;
+        m_idle.notify_all();
+    }
+
+    // Take a texture off its worker's load and report it. A texture a GPU
+    // failed on goes to the CPU engine instead, when there is one.
+    void complete(Worker& worker, std::unique_ptr<PreparedTexture>& prep, bool ok) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            worker.pixels -= prep->pixels;
+        }
+        if (worker.gpu && ok) {
+            worker.failures = 0;
+            worker.wasReset = false;
+        } else if (worker.gpu && prep->retryable) {
+            worker.failures++;
+        }
+        if (!ok && worker.gpu && prep->retryable && !m_cpuWorkers.empty()) {
+            std::unique_ptr<PreparedTexture> retry(new PreparedTexture());
+            retry->tex.job = std::move(prep->tex.job);
+            retry->tex.index = prep->tex.index;
+            retry->tex.times = prep->tex.times; // the GPU attempt counts too
+            retry->pixels = prep->pixels;
+            retry->retry = true;
+            prep.reset();
+            Worker& cpu = route(*retry, m_cpuWorkers);
+            cpu.decoded.push(std::move(retry));
+            return;
+        }
+        if (ok && prep->writePending) {
+            m_writes.push(std::move(prep)); // reported once written
+            return;
+        }
+        if (!ok && prep->error) {
+            reportFailure(prep->tex.index, m_total, prep->tex.job.inputPath, prep->error);
+        }
+        prep.reset(); // release the surfaces before waiting
+        complete(ok);
+    }
+
+    // Pick the worker with the fewest source pixels outstanding and charge it
+    Worker& route(PreparedTexture& prep, std::vector<std::unique_ptr<Worker>>& workers) {
+        const LoadedTexture& tex = prep.tex;
+        if (!prep.retry) {
+            prep.pixels = tex.job.hasHeader
+                ? (double)tex.job.header.width * tex.job.header.height
+                : (double)tex.surface.width() * tex.surface.height();
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Worker* best = leastLoaded(workers);
+        if (!best) best = leastLoaded(m_cpuWorkers); // every GPU retired
+        best->pixels += prep.pixels;
+        prep.device = best->gpu ? best->device : -1;
+        return *best;
+    }
+
+    // Caller holds m_mutex. Null if every worker is retired.
+    static Worker* leastLoaded(std::vector<std::unique_ptr<Worker>>& workers) {
+        Worker* best = nullptr;
+        for (auto& worker : workers) {
+            if (worker->retired) continue;
+            if (!best || worker->pixels < best->pixels) best = worker.get();
+        }
+        return best;
+    }
+
+    // After kGpuFailureLimit GPU failures in a row (each already redone on the
+    // CPU), start the GPU over with a new Context. If it still fails without a
+    // single success, retire it: the decoders route around it and what is
+    // queued for it goes to the CPU engine.
+    void recoverGpu(Worker& worker) {
+        worker.failures = 0;
+        if (!worker.wasReset) {
+            worker.deviceBlocks.reset();
+            worker.context = &m_devices.resetGpu(worker.device);
+            if (m_options.gpuResident && CudaDriver::get().makeCurrent(worker.device)) {
+                worker.deviceBlocks.reset(new DeviceBuffer());
+            }
+            worker.wasReset = true;
+            fprintf(stderr, "CUDA:reset:%d\n", worker.device);
+            return;
+        }
+        if (m_cpuWorkers.empty()) return; // nowhere else to encode
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        worker.retired = true;
+        fprintf(stderr, "CUDA:retired:%d\n", worker.device);
+    }
+
+    // --io-depth: read sources ahead of the decoders, so a decode thread
+    // never waits on the disk. A failed read is left for loadTexture to
+    // retry and report.
+    void readLoop() {
+        std::unique_ptr<PreparedTexture> prep;
+        while (m_reads.pop(prep)) {
+            TextureJob& job = prep->tex.job;
+            StageTimer timer;
+            if (job.inputData.empty()) readFile(job.inputPath.c_str(), job.inputData);
+            prep->tex.times.load += timer.lap();
+            m_pending.push(std::move(prep));
+        }
+    }
+
+    // --io-depth: write patched outputs behind the workers, in the order
+    // they finished, and report each job once its file is on disk
+    void writeLoop() {
+        std::unique_ptr<PreparedTexture> prep;
+        while (m_writes.pop(prep)) {
+            bool ok = writeTexture(*prep, m_options, m_total);
+            if (!ok) {
+                reportFailure(prep->tex.index, m_total, prep->tex.job.inputPath, prep->error);
+            }
+            prep.reset();
+            complete(ok);
+        }
+    }
+
+    void decodeLoop() {
+        std::unique_ptr<PreparedTexture> prep;
+        auto& workers = m_workers.empty() ? m_cpuWorkers : m_workers;
+        while (m_pending.pop(prep)) {
+            bool loaded = loadTimed(*prep, m_total, m_options, m_keepSource);
+            if (loaded && prep->tex.copied) {
+                prep.reset();
+                complete(true);
+            } else if (loaded) {
+                Worker& worker = route(*prep, workers);
+                worker.decoded.push(std::move(prep));
+            } else {
+                if (prep->error) {
+                    reportFailure(prep->tex.index, m_total, prep->tex.job.inputPath, prep->error);
+                }
+                prep.reset();
+                complete(false);
+            }
+        }
+    }
+
+    void encodeLoop(Worker* worker) {
+        std::vector<std::unique_ptr<PreparedTexture>> pack;
+        size_t packBytes = 0;
+        std::unique_ptr<PreparedTexture> prep;
+
+        if (worker->gpu) m_devices.bind(worker->device);
+
+        // Device memory is used from this thread only, in its device's context
+        if (worker->gpu && m_options.gpuResident &&
+            CudaDriver::get().makeCurrent(worker->device)) {
+            worker->deviceBlocks.reset(new DeviceBuffer());
+        }
+
+        for (;;) {
+            // Don't sit on a partial pack while the decoders catch up
+            if (!pack.empty() && !worker->decoded.tryPop(prep)) {
+                flushPack(*worker, pack);
+                packBytes = 0;
+                continue;
+            }
+            if (pack.empty() && worker->gpu && worker->failures >= kGpuFailureLimit) {
+                recoverGpu(*worker);
+            }
+            if (pack.empty() && !worker->decoded.pop(prep)) break;
+
+            // Queued before the GPU was retired: the CPU engine takes it
+            if (worker->retired) {
+                failTexture(*prep, "GPU retired");
+                complete(*worker, prep, false);
+                continue;
+            }
+
+            // A GPU failure handed over: decode it again for this context
+            if (prep->retry) {
+                prep->error = nullptr; // failures are reported by loadTexture
+                bool loaded = loadTimed(*prep, m_total, m_options, false);
+                if (!loaded) {
+                    complete(*worker, prep, false);
+                    continue;
+                }
+            }
+
+            Context& context = *worker->context;
+            if (!guarded(*prep, [&] { return prepareTexture(*prep, context, m_options); })) {
+                complete(*worker, prep, false);
+                continue;
+            }
+
+            bool packable = m_options.packSize > 1 && !prep->streamMips && !prep->tex.direct &&
+                prep->newW <= kPackMaxExtent && prep->newH <= kPackMaxExtent;
+
+            if (!packable) {
+                bool ok = guarded(*prep, [&] {
+                    return encodePrepared(*prep, context, worker->deviceBlocks.get(),
+                                          m_options, m_total);
+                });
+                complete(*worker, prep, ok);
+                continue;
+            }
+
+            size_t bytes = mipChainBytes(prep->newW, prep->newH);
+            bool overBudget = m_options.vramBudget > 0 &&
+                packBytes + bytes > m_options.vramBudget;
+            if (!pack.empty() && (pack[0]->format != prep->format ||
+                                  pack[0]->quality != prep->quality || overBudget)) {
+                flushPack(*worker, pack);
+                packBytes = 0;
+            }
+            pack.push_back(std::move(prep));
+            packBytes += bytes;
+            if ((int)pack.size() >= m_options.packSize) {
+                flushPack(*worker, pack);
+                packBytes = 0;
+            }
+        }
+
+        flushPack(*worker, pack);
+        worker->deviceBlocks.reset();
+    }
+
+    // Compress every packed texture in one submission. If that fails, retry
+    // each on its own so one bad texture doesn't fail the whole pack.
+    void flushPack(Worker& worker, std::vector<std::unique_ptr<PreparedTexture>>& pack) {
+        if (pack.empty()) return;
+
+        Context& context = *worker.context;
+        DeviceBuffer* deviceBlocks = worker.deviceBlocks.get();
+        std::vector<PreparedTexture*> textures;
+        for (auto& prep : pack) textures.push_back(prep.get());
+
+        if (pack.size() > 1 && guarded(*pack[0], [&] {
+                return compressPrepared(textures, context, deviceBlocks);
+            })) {
+            for (auto& prep : pack) {
+                bool ok = finishTexture(*prep, m_options, m_total);
+                complete(worker, prep, ok);
+            }
+        } else {
+            for (auto& prep : pack) {
+                if (pack.size() > 1 && !writeOutputHeader(*prep, context)) {
+                    failTexture(*prep, "Failed to write DDS header");
+                    complete(worker, prep, false);
+                    continue;
+                }
+                bool ok = guarded(*prep, [&] {
+                    return encodePrepared(*prep, context, deviceBlocks, m_options, m_total);
+                });
+                complete(worker, prep, ok);
+            }
+        }
+
+        pack.clear();
+    }
+
+    DeviceSet& m_devices;
+    PipelineOptions m_options;
+    int m_total;
+    WorkQueue<std::unique_ptr<PreparedTexture>> m_pending;
+    WorkQueue<std::unique_ptr<PreparedTexture>> m_reads;  // --io-depth, before m_pending
+    WorkQueue<std::unique_ptr<PreparedTexture>> m_writes; // --io-depth, patched outputs
+    std::vector<std::thread> m_readers;
+    std::thread m_writer;
+    std::vector<std::unique_ptr<Worker>> m_workers;    // GPUs
+    std::vector<std::unique_ptr<Worker>> m_cpuWorkers; // CPU engine
+    std::vector<std::thread> m_decoders;
+    std::mutex m_mutex;
+    std::condition_variable m_idle;
+    int m_submitted = 0;
+    int m_done = 0;
+    int m_succeeded = 0;
+    int m_failed = 0;
+    bool m_keepSource = false;
+    bool m_finished = false;
+};
+
+// Serve job lines from `in` until EOF, QUIT or SHUTDOWN, reporting to g_report.
+// Returns true if the client asked the whole server to stop.
+bool serveSession(FILE* in, DeviceSet& devices, const PipelineOptions& options) {
+    EncodePipeline pipeline(devices, options, 0);
+    bool shutdown = false;
+
+    report("READY:%d\n", options.streams);
+
+    char* buf = nullptr;
+    size_t cap = 0;
+    ssize_t len;
+
+    while ((len = getline(&buf, &cap, in)) != -1) {
+        std::string line(buf, len);
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') continue;
+
+        if (line == "QUIT") break;
+        if (line == "SHUTDOWN") {
+            shutdown = true;
+            break;
+        }
+        if (line == "SYNC") {
+            pipeline.drain();
+            report("SYNC:%d:%d\n", pipeline.succeeded(), pipeline.failed());
+            continue;
+        }
+
+        // "@<bytes>|output|..." - the source DDS follows on the stream as
+        // exactly <bytes> raw bytes instead of being read from a path
+        size_t payloadSize = 0;
+        if (line[0] == '@') {
+            payloadSize = (size_t)std::strtoull(line.c_str() + 1, nullptr, 10);
+        }
+
+        TextureJob job;
+        bool valid = parseJobLine(line, job);
+
+        if (line[0] == '@') {
+            job.inputData.resize(payloadSize);
+            if (payloadSize == 0 ||
+                fread(job.inputData.data(), 1, payloadSize, in) != payloadSize) {
+                pipeline.reject(line);
+                break; // stream is out of sync with the framing
+            }
+            job.inputPath = job.outputPath; // name in OK:/FAIL: lines
+        }
+
+        if (valid) {
+            pipeline.submit(std::move(job));
+        } else {
+            pipeline.reject(line);
+        }
+    }
+
+    free(buf);
+    pipeline.finish();
+    report("BATCH_END:%d:%d\n", pipeline.succeeded(), pipeline.failed());
+    return shutdown;
+}
+
+// Accept clients on a Unix socket one at a time, sharing the same Contexts
+int runSocketServer(const char* socketPath, DeviceSet& devices, const PipelineOptions& options) {
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        fprintf(stderr, "ERROR:Failed to create socket\n");
+        return 1;
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "ERROR:Socket path too long: %s\n", socketPath);
+        close(listenFd);
+        return 1;
+    }
+    strcpy(addr.sun_path, socketPath);
+    unlink(socketPath);
+
+    if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 4) != 0) {
+        fprintf(stderr, "ERROR:Failed to listen on socket: %s\n", socketPath);
+        close(listenFd);
+        return 1;
+    }
+
+    fprintf(stderr, "LISTENING:%s\n", socketPath);
+
+    bool shutdown = false;
+    while (!shutdown) {
+        int clientFd = accept(listenFd, nullptr, nullptr);
+        if (clientFd < 0) continue;
+
+        FILE* in = fdopen(clientFd, "r");
+        FILE* out = fdopen(dup(clientFd), "w");
+        if (!in || !out) {
+            if (in) fclose(in); else close(clientFd);
+            if (out) fclose(out);
+            continue;
+        }
+
+        g_report = out;
+        shutdown = serveSession(in, devices, options);
+        g_report = stderr;
+
+        fclose(out);
+        fclose(in);
+    }
+
+    close(listenFd);
+    unlink(socketPath);
+    return 0;
+}
+
+#ifdef RADIUM_ENCODE_LIBRARY
+
+// libradium_encode.so: the pipeline behind the C ABI in radium_encode.h.
+// Results come in through g_results on the pipeline's threads and wait in the
+// engine until polled.
+struct radium_engine {
+    explicit radium_engine(const PipelineOptions& options)
+        : devices(options), pipeline(devices, options, 0) {}
+
+    DeviceSet devices;
+    EncodePipeline pipeline;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<radium_result> results;
+    int submitted = 0; // accepted jobs (mutex)
+    int succeeded = 0; // results queued so far (mutex)
+    int failed = 0;
+    int returned = 0;  // handed out by poll (mutex)
+};
+
+static std::mutex g_engineMutex;
+static radium_engine* g_engine = nullptr;
+
+static void queueResult(radium_engine* engine, const JobResult& result) {
+    radium_result out;
+    out.job = result.index + 1;
+    out.ok = result.ok;
+    out.error = result.ok ? nullptr : (result.error ? result.error : "Unknown error");
+    out.source_width = result.origW;
+    out.source_height = result.origH;
+    out.width = result.newW;
+    out.height = result.newH;
+    out.mip_count = result.mipCount;
+    out.format = result.ok ? formatName(result.format) : "";
+    const StageTimes& times = result.times;
+    out.stage_ms[RADIUM_STAGE_LOAD] = times.load;
+    out.stage_ms[RADIUM_STAGE_UPLOAD] = times.upload;
+    out.stage_ms[RADIUM_STAGE_RESIZE] = times.resize;
+    out.stage_ms[RADIUM_STAGE_MIPS] = times.mips;
+    out.stage_ms[RADIUM_STAGE_ENCODE] = times.encode;
+    out.stage_ms[RADIUM_STAGE_PATCH] = times.patch;
+    out.stage_ms[RADIUM_STAGE_WRITE] = times.write;
+
+    std::lock_guard<std::mutex> lock(engine->mutex);
+    engine->results.push_back(out);
+    if (out.ok) engine->succeeded++; else engine->failed++;
+    engine->ready.notify_all();
+}
+
+static int submitJob(radium_engine* engine, TextureJob& job) {
+    {
+        std::lock_guard<std::mutex> lock(engine->mutex);
+        engine->submitted++;
+    }
+    return engine->pipeline.submit(std::move(job));
+}
+
+extern "C" {
+
+int radium_abi_version(void) {
+    return RADIUM_ENCODE_ABI_VERSION;
+}
+
+radium_engine* radium_engine_create(int argc, const char* const* argv) {
+    PipelineOptions options;
+    for (int i = 0; i < argc; i++) {
+        int used = parsePipelineOption(argc, argv, i, options);
+        if (used <= 0) {
+            if (used == 0) fprintf(stderr, "ERROR:Unknown engine option: %s\n", argv[i]);
+            return nullptr;
+        }
+        i += used - 1;
+    }
+    finalizeOptions(options);
+
+    std::lock_guard<std::mutex> lock(g_engineMutex);
+    if (g_engine) return nullptr;
+    radium_engine* engine = new radium_engine(options);
+    g_results = [engine](const JobResult& result) { queueResult(engine, result); };
+    g_engine = engine;
+    return engine;
+}
+
+void radium_engine_destroy(radium_engine* engine) {
+    if (!engine) return;
+    engine->pipeline.finish();
+
+    std::lock_guard<std::mutex> lock(g_engineMutex);
+    g_results = nullptr;
+    g_engine = nullptr;
+    delete engine;
+}
+
+int radium_engine_submit(radium_engine* engine, const char* job) {
+    TextureJob parsed;
+    if (!engine || !job || !parseJobLine(job, parsed)) return 0;
+    return submitJob(engine, parsed);
+}
+
+int radium_engine_submit_memory(radium_engine* engine, const char* job,
+                                const void* data, size_t size) {
+    TextureJob parsed;
+    if (!engine || !job || !data || size == 0 || !parseJobLine(job, parsed)) return 0;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    parsed.inputData.assign(bytes, bytes + size);
+    parsed.inputPath = parsed.outputPath; // as for "@<bytes>" server jobs
+    return submitJob(engine, parsed);
+}
+
+int radium_engine_poll(radium_engine* engine, radium_result* results, int capacity, int timeout_ms) {
+    if (!engine || !results || capacity <= 0) return 0;
+
+    std::unique_lock<std::mutex> lock(engine->mutex);
+    auto done = [&] { return !engine->results.empty() || engine->returned == engine->submitted; };
+    if (timeout_ms < 0) {
+        engine->ready.wait(lock, done);
+    } else {
+        engine->ready.wait_for(lock, std::chrono::milliseconds(timeout_ms), done);
+    }
+
+    int count = 0;
+    while (count < capacity && !engine->results.empty()) {
+        results[count++] = engine->results.front();
+        engine->results.pop_front();
+    }
+    engine->returned += count;
+    return count;
+}
+
+void radium_engine_stats(radium_engine* engine, radium_stats* stats) {
+    if (!engine || !stats) return;
+    std::lock_guard<std::mutex> lock(engine->mutex);
+    stats->submitted = engine->submitted;
+    stats->succeeded = engine->succeeded;
+    stats->failed = engine->failed;
+    stats->pending = engine->submitted - engine->returned;
+    stats->gpus = engine->devices.gpuCount();
+}
+
+} // extern "C"
+
+#else
+
+int main(int argc, char* argv[]) {
+    const char* batchFile = nullptr;
+    const char* socketPath = nullptr;
+    bool serverMode = false;
+    int resumeFrom = 1;
+    PipelineOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--server") == 0) {
+            serverMode = true;
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (strcmp(argv[i], "--resume-from") == 0 && i + 1 < argc) {
+            resumeFrom = std::atoi(argv[++i]);
+        } else {
+            int used = parsePipelineOption(argc, argv, i, options);
+            if (used < 0) return 1;
+            if (used == 0) batchFile = argv[i];
+            else i += used - 1;
+        }
+    }
+    finalizeOptions(options);
+
+    if (!batchFile && !serverMode && !socketPath) {
+        fprintf(stderr, "NVTT3 Batch Compress Tool\n");
+        fprintf(stderr, "Usage: %s [options] <batch_file>\n", argv[0]);
+        fprintf(stderr, "       %s [options] --server            (jobs on stdin)\n", argv[0]);
+        fprintf(stderr, "       %s [options] --socket <path>     (jobs on a Unix socket)\n", argv[0]);
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Batch file format (one per line):\n");
+        fprintf(stderr, "  input.dds|output.dds|max_extent|format\n");
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Formats: bc7 (default), bc4, bc3, bc1, bc5, bc6\n");
+        fprintf(stderr, "--streams: CPU decode threads feeding the single GPU context (default 1)\n");
+        fprintf(stderr, "--pack:    max textures <= %d px packed into one GPU submission (default 1)\n", kPackMaxExtent);
+        fprintf(stderr, "--vram-budget: MB a mip chain may hold at once; larger textures are\n");
+        fprintf(stderr, "               compressed level by level (default: unlimited)\n");
+        fprintf(stderr, "--atomic-write: write each output to <output>.tmp, then rename it\n");
+        fprintf(stderr, "--gpu-resident: keep mips and encoded blocks on the GPU, one copy back\n");
+        fprintf(stderr, "                per texture or pack (needs CUDA)\n");
+        fprintf(stderr, "--timing: append per-stage timings (ms) to each OK: line\n");
+        fprintf(stderr, "--devices: GPUs to shard jobs across, 0 = all visible (default 1)\n");
+        fprintf(stderr, "--cpu-workers: CPU encode threads; without CUDA they do all the work\n");
+        fprintf(stderr, "               (default: --streams), else retry GPU failures (default 1)\n");
+        fprintf(stderr, "--reuse-mips: start shrinking jobs from the stored mip nearest the target\n");
+        fprintf(stderr, "--copy-mips: copy the stored levels of jobs that keep the source format\n");
+        fprintf(stderr, "--io-depth: source reads ahead of the decoders and outputs queued for a\n");
+        fprintf(stderr, "            background writer (default 0: read and write inline)\n");
+        fprintf(stderr, "--auto-bc1: encode bc3/bc7 jobs whose source is fully opaque as bc1\n");
+        fprintf(stderr, "--cpu-only: don't use CUDA even when it is available\n");
+        fprintf(stderr, "--resume-from: batch files only, start at job N (numbering unchanged)\n");
+        fprintf(stderr, "--quality: fastest, normal (default), production or highest\n");
+        return 1;
+    }
+
+    if (serverMode || socketPath) {
+        DeviceSet devices(options);
+        fprintf(stderr, "CUDA:%s\n", devices.cudaEnabled() ? "enabled" : "disabled");
+        if (devices.gpuCount() > 1) fprintf(stderr, "CUDA:devices:%d\n", devices.gpuCount());
+
+        if (socketPath) {
+            return runSocketServer(socketPath, devices, options);
+        }
+
+        serveSession(stdin, devices, options);
+        return 0;
+    }
+
+    // Parse batch file
+    std::vector<TextureJob> jobs = parseBatchFile(batchFile);
+
+    if (jobs.empty()) {
+        fprintf(stderr, "ERROR:No valid jobs found in batch file\n");
+        return 1;
+    }
+
+    // Report batch start
+    fprintf(stderr, "BATCH_START:%zu\n", jobs.size());
+
+    // Create compression contexts ONCE for entire batch (CUDA init here)
+    DeviceSet devices(options);
+
+    if (devices.cudaEnabled()) {
+        fprintf(stderr, "CUDA:enabled\n");
+    } else {
+        fprintf(stderr, "CUDA:disabled\n");
+    }
+    if (devices.gpuCount() > 1) fprintf(stderr, "CUDA:devices:%d\n", devices.gpuCount());
+
+    // Process all textures, from --resume-from on
+    EncodePipeline pipeline(devices, options, (int)jobs.size());
+    size_t first = resumeFrom > 1 ? (size_t)resumeFrom - 1 : 0;
+    if (first > jobs.size()) first = jobs.size();
+    pipeline.skip((int)first);
+    for (size_t i = first; i < jobs.size(); i++) {
+        pipeline.submit(jobs[i]);
+    }
+    pipeline.finish();
+
+    int succeeded = pipeline.succeeded();
+    int failed = pipeline.failed();
+
+    // Report batch complete
+    fprintf(stderr, "BATCH_END:%d:%d\n", succeeded, failed);
+
+    return (failed > 0) ? 1 : 0;
+}
+
+#endif // RADIUM_ENCODE_LIBRARY
@@ -0,0 +1,199 @@
+/*
+ * nvtt_batch_test - checks of nvtt_batch_compress's own decoders and filters
+ *
+ * Usage: nvtt_batch_test   (or: make test)
+ *
+ * Builds the pipeline source without main() (as libradium_encode.so does) and
+ * runs the hand-written parts NVTT doesn't cover against known values: the
+ * BC4/BC5 block decoder and the normal renormalization of the reduced-channel
+ * path, and the stored-block opacity check behind --copy-mips with --auto-bc1.
+ * Needs no GPU; with one it also checks that pinned host buffers leave the
+ * calling thread's CUDA context alone. Prints one line per failed check and
+ * exits non-zero if there was any.
+ */
+
+#define RADIUM_ENCODE_LIBRARY
+#include "nvtt_batch_compress.cpp"
+
+static int g_failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            g_failures++;                                                  \
+        }                                                                  \
+    } while (0)
+
+// A DX10 DDS of one w x h level in DXGI format `dxgi`, followed by `blocks`
+static std::vector<unsigned char> makeDds(int w, int h, uint32_t dxgi,
+                                          const std::vector<unsigned char>& blocks) {
+    std::vector<unsigned char> dds(148, 0);
+    auto put = [&](size_t offset, uint32_t value) { memcpy(&dds[offset], &value, 4); };
+    put(0, 0x20534444);  // "DDS "
+    put(4, 124);
+    put(8, 0x1007);      // CAPS | HEIGHT | WIDTH | PIXELFORMAT
+    put(12, (uint32_t)h);
+    put(16, (uint32_t)w);
+    put(28, 1);          // mip count
+    put(76, 32);
+    put(80, 0x4);        // DDPF_FOURCC
+    put(84, 0x30315844); // "DX10"
+    put(128, dxgi);
+    put(132, 3);         // TEXTURE2D
+    put(140, 1);         // array size
+    dds.insert(dds.end(), blocks.begin(), blocks.end());
+    return dds;
+}
+
+// A BC3-style alpha block with endpoints a0, a1 and a 3-bit index per texel
+static std::vector<unsigned char> alphaBlock(int a0, int a1, const int indices[16]) {
+    std::vector<unsigned char> block = {(unsigned char)a0, (unsigned char)a1, 0, 0, 0, 0, 0, 0};
+    uint64_t bits = 0;
+    for (int i = 0; i < 16; i++) bits |= (uint64_t)(indices[i] & 7) << (3 * i);
+    for (int i = 0; i < 6; i++) block[2 + i] = (unsigned char)(bits >> (8 * i));
+    return block;
+}
+
+static TextureJob channelJob(const std::vector<unsigned char>& dds) {
+    TextureJob job;
+    job.maxExtent = 4;
+    job.srgbHint = 0;
+    job.inputData = dds;
+    job.hasHeader = probeDdsHeader(job.inputData.data(), job.inputData.size(), job.header);
+    return job;
+}
+
+static bool near(float a, float b) {
+    return fabsf(a - b) < 1e-4f;
+}
+
+static void testDecodeChannelLevel() {
+    // a0 > a1: eight-value palette; a0 <= a1: six values plus 0 and 255
+    const int red[16] = {0, 1, 2, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    const int green[16] = {6, 7, 2, 5, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+    std::vector<unsigned char> r = alphaBlock(255, 0, red);
+    std::vector<unsigned char> g = alphaBlock(0, 255, green);
+
+    ChannelImage image;
+    TextureJob bc4 = channelJob(makeDds(4, 4, 80, r));
+    CHECK(bc4.hasHeader);
+    CHECK(decodeChannelLevel(bc4, 0, 1, image));
+    CHECK(image.width == 4 && image.height == 4 && image.channels == 1);
+    CHECK(near(image.plane(0)[0], 1.0f));
+    CHECK(near(image.plane(0)[1], 0.0f));
+    CHECK(near(image.plane(0)[2], 219 / 255.0f)); // (6 * 255 + 3) / 7
+    CHECK(near(image.plane(0)[3], 36 / 255.0f));  // (255 + 3) / 7
+
+    std::vector<unsigned char> rg = r;
+    rg.insert(rg.end(), g.begin(), g.end());
+    TextureJob bc5 = channelJob(makeDds(4, 4, 83, rg));
+    CHECK(decodeChannelLevel(bc5, 0, 2, image));
+    CHECK(image.channels == 2);
+    CHECK(near(image.plane(0)[2], 219 / 255.0f));
+    CHECK(near(image.plane(1)[0], 0.0f));
+    CHECK(near(image.plane(1)[1], 1.0f));
+    CHECK(near(image.plane(1)[2], 51 / 255.0f));  // (255 + 2) / 5
+    CHECK(near(image.plane(1)[3], 204 / 255.0f)); // (4 * 255 + 2) / 5
+    CHECK(near(image.plane(1)[4], 1.0f));
+
+    // SNORM blocks, two channels from BC4 and truncated data are left to NVTT
+    CHECK(!decodeChannelLevel(channelJob(makeDds(4, 4, 81, r)), 0, 1, image));
+    CHECK(!decodeChannelLevel(bc4, 0, 2, image));
+    std::vector<unsigned char> truncated = makeDds(8, 8, 80, r);
+    CHECK(!decodeChannelLevel(channelJob(truncated), 0, 1, image));
+}
+
+static void testStoredLevelOpaque() {
+    unsigned char block[16] = {};
+    block[0] = 0x02; // mode 1: no alpha
+    CHECK(bc7BlockOpaque(block));
+
+    // Mode 6: opaque only with both alpha endpoints and p-bits at their maximum
+    memset(block, 0, sizeof(block));
+    block[0] = 0x40;
+    CHECK(!bc7BlockOpaque(block));
+    for (int pos = 49; pos < 65; pos++) block[pos >> 3] |= (unsigned char)(1 << (pos & 7));
+    CHECK(bc7BlockOpaque(block));
+
+    // Mode 5 rotating red into alpha: the red endpoints decide
+    memset(block, 0, sizeof(block));
+    block[0] = 0x20 | (1 << 6);
+    CHECK(!bc7BlockOpaque(block));
+    for (int pos = 8; pos < 22; pos++) block[pos >> 3] |= (unsigned char)(1 << (pos & 7));
+    CHECK(bc7BlockOpaque(block));
+
+    // BC3 levels go by their decoded alpha
+    const int first[16] = {};
+    std::vector<unsigned char> bc3 = alphaBlock(255, 0, first);
+    bc3.resize(16, 0);
+    CHECK(storedLevelOpaque(Layout_BC3, bc3.data(), 4, 4));
+    bc3[2] = 1; // texel 0 takes a1 = 0
+    CHECK(!storedLevelOpaque(Layout_BC3, bc3.data(), 4, 4));
+}
+
+static void testRenormalizeNormals() {
+    // (0.3, 0, 0.4) is a unit normal shortened to half length by filtering
+    ChannelImage image;
+    image.reset(2, 1, 3);
+    image.plane(0)[0] = 0.65f;
+    image.plane(1)[0] = 0.5f;
+    image.plane(2)[0] = 0.7f;
+    image.plane(0)[1] = 0.5f; // zero length: left alone
+    image.plane(1)[1] = 0.5f;
+    image.plane(2)[1] = 0.5f;
+    renormalizeNormals(image);
+
+    float nx = 2 * image.plane(0)[0] - 1, ny = 2 * image.plane(1)[0] - 1, nz = 2 * image.plane(2)[0] - 1;
+    CHECK(near(nx * nx + ny * ny + nz * nz, 1.0f));
+    CHECK(near(nx, 0.6f) && near(ny, 0.0f) && near(nz, 0.8f));
+    CHECK(near(image.plane(0)[1], 0.5f) && near(image.plane(2)[1], 0.5f));
+
+    // reconstructNormalZ gives unit vectors before any filtering
+    ChannelImage packed;
+    packed.reset(1, 1, 2);
+    packed.plane(0)[0] = 0.8f;
+    packed.plane(1)[0] = 0.5f;
+    reconstructNormalZ(packed);
+    CHECK(packed.channels == 3);
+    CHECK(near(2 * packed.plane(2)[0] - 1, 0.8f));
+}
+
+static void testPinnedHostKeepsContext() {
+    CudaDriver& driver = CudaDriver::get();
+    int devices = driver.deviceCount();
+    if (devices == 0) return;
+    BufferPool& pool = BufferPool::get();
+    pool.enablePinned(true);
+
+    // A GPU worker bound to its device stays bound across a fresh allocation
+    CHECK(driver.makeCurrent(devices - 1));
+    CUcontext bound = driver.current();
+    {
+        BufferPool::Buffer buffer = pool.host(3 * BufferPool::kMinBytes);
+        CHECK(buffer && buffer.pinned());
+    }
+    CHECK(driver.current() == bound);
+
+    // A thread without a context is left without one
+    CHECK(driver.restore(nullptr));
+    {
+        BufferPool::Buffer buffer = pool.host(5 * BufferPool::kMinBytes);
+        CHECK(buffer && buffer.pinned());
+    }
+    CHECK(driver.current() == nullptr);
+    pool.enablePinned(false);
+}
+
+int main() {
+    testDecodeChannelLevel();
+    testStoredLevelOpaque();
+    testRenormalizeNormals();
+    testPinnedHostKeepsContext();
+    if (g_failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("nvtt_batch_test: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,510 @@
+/*
+ * nvtt_bench - reproducible benchmark sweep of the NVTT3 batch engine
+ *
+ * Usage: nvtt_bench_harness [options]   (or: make nvtt_bench)
+ *
+ * Runs nvtt_batch_compress once per configuration over a fixed corpus and
+ * appends one JSON object per run to the results file (JSON lines), so runs
+ * on different machines or builds can be diffed and plotted directly.
+ *
+ * Corpus: every .dds/.png/.tga/.bmp in --images (the Compressonator sample
+ * images by default), plus synthetic 32-bit BGRA surfaces at each of --sizes
+ * written once to the work directory. The synthetic content is generated from
+ * a fixed integer hash, so every machine encodes the same pixels. Each source
+ * is queued twice: at its own size (mips only) and resized to half extent.
+ *
+ * Sweep: --formats x --qualities x --engines (gpu, cpu) x --modes, where
+ * "single" is one decode stream and no packing and "batched" is --streams N
+ * --pack 32, the way the Rust side drives the server. GPU runs are recorded
+ * as skipped when the engine reports CUDA:disabled.
+ *
+ * Each run record holds wall time, throughput (source megapixels and
+ * textures per second), the summed --timing stages, peak RSS of the engine
+ * (wait4) and its peak VRAM, sampled from nvidia-smi every 100 ms (null when
+ * nvidia-smi isn't available).
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+struct BenchOptions {
+    std::string engine = "./nvtt_batch_compress";
+    std::string images = "../compressonatorcli-4.5.52-Linux/images";
+    std::string work = "bench_work";
+    std::string out = "bench_results.jsonl";
+    std::vector<std::string> formats = {"bc1", "bc3", "bc4", "bc5", "bc7"};
+    std::vector<std::string> qualities = {"fastest", "normal", "production", "highest"};
+    std::vector<std::string> engines = {"gpu", "cpu"};
+    std::vector<std::string> modes = {"single", "batched"};
+    std::vector<int> sizes = {1024, 2048, 4096, 8192};
+    int streams = 0; // batched mode decode streams, 0 = hardware threads (max 8)
+};
+
+struct CorpusEntry {
+    std::string path;
+    int extent; // larger side of the source
+};
+
+// Totals parsed from the engine's protocol lines for one run
+struct RunResult {
+    bool started = false;
+    bool cuda = false;
+    int ok = 0;
+    int failed = 0;
+    double sourcePixels = 0;
+    double stages[7] = {};
+    double seconds = 0;
+    long peakRssKb = 0;
+    long peakVramMb = -1;
+    int exitCode = -1;
+};
+
+static const char* kStages[7] = {"load", "upload", "resize", "mips", "encode", "patch", "write"};
+
+std::vector<std::string> splitList(const char* arg) {
+    std::vector<std::string> items;
+    std::string item;
+    for (const char* p = arg;; p++) {
+        if (*p == ',' || *p == '\0') {
+            if (!item.empty()) items.push_back(item);
+            item.clear();
+            if (*p == '\0') break;
+        } else {
+            item += *p;
+        }
+    }
+    return items;
+}
+
+bool hasExtension(const std::string& name, const char* ext) {
+    size_t n = strlen(ext);
+    if (name.size() <= n) return false;
+    return strcasecmp(name.c_str() + name.size() - n, ext) == 0;
+}
+
+// Larger side of a DDS/PNG/BMP/TGA image from its header, 0 if unknown
+int imageExtent(const std::string& path) {
+    unsigned char h[32] = {};
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return 0;
+    size_t n = fread(h, 1, sizeof(h), f);
+    fclose(f);
+    if (n < sizeof(h)) return 0;
+
+    auto le16 = [&](int o) { return h[o] | h[o + 1] << 8; };
+    auto le32 = [&](int o) { return (int)(h[o] | h[o + 1] << 8 | h[o + 2] << 16 | (unsigned)h[o + 3] << 24); };
+    auto be32 = [&](int o) { return (int)((unsigned)h[o] << 24 | h[o + 1] << 16 | h[o + 2] << 8 | h[o + 3]); };
+
+    int w = 0, ht = 0;
+    if (memcmp(h, "DDS ", 4) == 0) {
+        ht = le32(12);
+        w = le32(16);
+    } else if (memcmp(h, "\x89PNG", 4) == 0) {
+        w = be32(16);
+        ht = be32(20);
+    } else if (memcmp(h, "BM", 2) == 0) {
+        w = le32(18);
+        ht = abs(le32(22));
+    } else if (hasExtension(path, ".tga")) {
+        w = le16(12);
+        ht = le16(14);
+    }
+    return std::max(w, ht);
+}
+
+// Deterministic per-pixel noise, so the corpus is the same on every machine
+uint32_t hashPixel(uint32_t x, uint32_t y) {
+    uint32_t h = x * 0x8da6b343u ^ y * 0xd8163841u;
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+// Write a size x size uncompressed BGRA8 DDS without mips: smooth gradients
+// (the easy part for BC encoders), hashed noise in blue and a radial alpha
+bool writeSynthetic(const std::string& path, int size) {
+    struct stat st;
+    size_t bytes = 128 + (size_t)size * size * 4;
+    if (stat(path.c_str(), &st) == 0 && (size_t)st.st_size == bytes) return true;
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+
+    uint32_t header[32] = {};
+    header[0] = 0x20534444;             // "DDS "
+    header[1] = 124;                    // header size
+    header[2] = 0x1 | 0x2 | 0x4 | 0x8 | 0x1000; // caps, height, width, pitch, pixelformat
+    header[3] = size;                   // height
+    header[4] = size;                   // width
+    header[5] = size * 4;               // pitch
+    header[19] = 32;                    // pixel format size
+    header[20] = 0x40 | 0x1;            // DDPF_RGB | DDPF_ALPHAPIXELS
+    header[22] = 32;                    // bits per pixel
+    header[23] = 0x00ff0000;            // R mask
+    header[24] = 0x0000ff00;            // G mask
+    header[25] = 0x000000ff;            // B mask
+    header[26] = 0xff000000;            // A mask
+    header[27] = 0x1000;                // DDSCAPS_TEXTURE
+    bool ok = fwrite(header, sizeof(header), 1, f) == 1;
+
+    std::vector<unsigned char> row((size_t)size * 4);
+    double center = size * 0.5;
+    for (int y = 0; ok && y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            unsigned char* p = &row[(size_t)x * 4];
+            double dx = x - center, dy = y - center;
+            double r = std::min(1.0, (dx * dx + dy * dy) / (center * center));
+            p[0] = (unsigned char)(hashPixel(x, y) >> 24);      // B
+            p[1] = (unsigned char)(y * 255 / (size - 1));        // G
+            p[2] = (unsigned char)(x * 255 / (size - 1));        // R
+            p[3] = (unsigned char)(255 - r * 255);               // A
+        }
+        ok = fwrite(row.data(), row.size(), 1, f) == 1;
+    }
+    return fclose(f) == 0 && ok;
+}
+
+std::vector<CorpusEntry> buildCorpus(const BenchOptions& options) {
+    std::vector<CorpusEntry> corpus;
+
+    std::vector<std::string> images;
+    if (DIR* dir = opendir(options.images.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (hasExtension(name, ".dds") || hasExtension(name, ".png") ||
+                hasExtension(name, ".tga") || hasExtension(name, ".bmp")) {
+                images.push_back(options.images + "/" + name);
+            }
+        }
+        closedir(dir);
+    } else {
+        fprintf(stderr, "WARNING:Cannot open image directory %s\n", options.images.c_str());
+    }
+    std::sort(images.begin(), images.end());
+    for (const std::string& path : images) {
+        int extent = imageExtent(path);
+        if (extent > 0) corpus.push_back({path, extent});
+    }
+
+    for (int size : options.sizes) {
+        std::string path = options.work + "/synthetic_" + std::to_string(size) + ".dds";
+        if (!writeSynthetic(path, size)) {
+            fprintf(stderr, "WARNING:Failed to write %s\n", path.c_str());
+            continue;
+        }
+        corpus.push_back({path, size});
+    }
+    return corpus;
+}
+
+bool nvidiaSmiAvailable() {
+    return system("nvidia-smi -L >/dev/null 2>&1") == 0;
+}
+
+// Memory nvidia-smi attributes to `pid`, in MB (-1 if not listed)
+long sampleVram(pid_t pid) {
+    FILE* p = popen("nvidia-smi --query-compute-apps=pid,used_memory "
+                    "--format=csv,noheader,nounits 2>/dev/null", "r");
+    if (!p) return -1;
+    long used = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), p)) {
+        long appPid = 0, mb = 0;
+        if (sscanf(line, "%ld, %ld", &appPid, &mb) == 2 && appPid == pid) {
+            used = std::max(used, mb);
+        }
+    }
+    pclose(p);
+    return used;
+}
+
+// Fold one OK:i/n:path:WxH->WxH:FMT:mips[:timing] line into `result`
+void parseOk(const char* line, RunResult& result) {
+    result.ok++;
+
+    // The path may contain ':', so locate the dimensions by their arrow
+    const char* arrow = strstr(line, "->");
+    if (!arrow) return;
+    const char* dims = arrow;
+    while (dims > line && dims[-1] != ':') dims--;
+    int w = 0, h = 0;
+    if (sscanf(dims, "%dx%d", &w, &h) == 2) result.sourcePixels += (double)w * h;
+
+    const char* timing = strstr(arrow, ":load=");
+    if (!timing) return;
+    for (int i = 0; i < 7; i++) {
+        std::string key = std::string(kStages[i]) + "=";
+        const char* field = strstr(timing, key.c_str());
+        if (field) result.stages[i] += atof(field + key.size());
+    }
+}
+
+// Run the engine on `batchFile`, collecting its protocol output and peak usage
+RunResult runEngine(const BenchOptions& options, const std::vector<std::string>& args,
+                    const std::string& batchFile, bool sampleGpu) {
+    RunResult result;
+
+    int pipeFds[2];
+    if (pipe(pipeFds) != 0) return result;
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        return result;
+    }
+    if (pid == 0) {
+        dup2(pipeFds[1], STDERR_FILENO);
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0) dup2(devNull, STDOUT_FILENO);
+
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(options.engine.c_str()));
+        for (const std::string& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+        argv.push_back(const_cast<char*>(batchFile.c_str()));
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    close(pipeFds[1]);
+
+    std::atomic<bool> running(true);
+    std::atomic<long> peakVram(-1);
+    std::thread sampler;
+    if (sampleGpu) {
+        sampler = std::thread([&] {
+            while (running) {
+                long mb = sampleVram(pid);
+                if (mb > peakVram) peakVram = mb;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        });
+    }
+
+    FILE* in = fdopen(pipeFds[0], "r");
+    std::vector<char> line(1 << 16);
+    while (in && fgets(line.data(), (int)line.size(), in)) {
+        const char* text = line.data();
+        if (strncmp(text, "BATCH_START:", 12) == 0) result.started = true;
+        else if (strncmp(text, "CUDA:enabled", 12) == 0) result.cuda = true;
+        else if (strncmp(text, "OK:", 3) == 0) parseOk(text, result);
+        else if (strncmp(text, "FAIL:", 5) == 0) result.failed++;
+    }
+    if (in) fclose(in);
+
+    int status = 0;
+    struct rusage usage = {};
+    wait4(pid, &status, 0, &usage);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    running = false;
+    if (sampler.joinable()) sampler.join();
+
+    result.exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    result.peakRssKb = usage.ru_maxrss;
+    result.peakVramMb = peakVram;
+    return result;
+}
+
+std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        if ((unsigned char)c < 0x20) continue;
+        out += c;
+    }
+    return out + "\"";
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (strcmp(arg, "--engine") == 0 && hasValue) {
+            options.engine = argv[++i];
+        } else if (strcmp(arg, "--images") == 0 && hasValue) {
+            options.images = argv[++i];
+        } else if (strcmp(arg, "--work") == 0 && hasValue) {
+            options.work = argv[++i];
+        } else if (strcmp(arg, "--out") == 0 && hasValue) {
+            options.out = argv[++i];
+        } else if (strcmp(arg, "--formats") == 0 && hasValue) {
+            options.formats = splitList(argv[++i]);
+        } else if (strcmp(arg, "--qualities") == 0 && hasValue) {
+            options.qualities = splitList(argv[++i]);
+        } else if (strcmp(arg, "--engines") == 0 && hasValue) {
+            options.engines = splitList(argv[++i]);
+        } else if (strcmp(arg, "--modes") == 0 && hasValue) {
+            options.modes = splitList(argv[++i]);
+        } else if (strcmp(arg, "--sizes") == 0 && hasValue) {
+            options.sizes.clear();
+            for (const std::string& size : splitList(argv[++i])) {
+                if (atoi(size.c_str()) > 0) options.sizes.push_back(atoi(size.c_str()));
+            }
+        } else if (strcmp(arg, "--streams") == 0 && hasValue) {
+            options.streams = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "NVTT3 Batch Engine Benchmark\n");
+            fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+            fprintf(stderr, "\n");
+            fprintf(stderr, "--engine:    nvtt_batch_compress to run (default ./nvtt_batch_compress)\n");
+            fprintf(stderr, "--images:    directory of sample images added to the corpus\n");
+            fprintf(stderr, "--work:      directory for synthetic sources and outputs (default bench_work)\n");
+            fprintf(stderr, "--out:       results file, one JSON object per run (default bench_results.jsonl)\n");
+            fprintf(stderr, "--formats:   comma list (default bc1,bc3,bc4,bc5,bc7)\n");
+            fprintf(stderr, "--qualities: comma list (default fastest,normal,production,highest)\n");
+            fprintf(stderr, "--engines:   comma list of gpu, cpu (default both)\n");
+            fprintf(stderr, "--modes:     comma list of single, batched (default both)\n");
+            fprintf(stderr, "--sizes:     synthetic surface sizes (default 1024,2048,4096,8192)\n");
+            fprintf(stderr, "--streams:   decode streams in batched mode (default: hardware threads, max 8)\n");
+            return 1;
+        }
+    }
+    if (options.streams < 1) {
+        options.streams = std::max(1, std::min(8, (int)std::thread::hardware_concurrency()));
+    }
+
+    mkdir(options.work.c_str(), 0755);
+    std::string outDir = options.work + "/out";
+    mkdir(outDir.c_str(), 0755);
+
+    std::vector<CorpusEntry> corpus = buildCorpus(options);
+    if (corpus.empty()) {
+        fprintf(stderr, "ERROR:Empty corpus\n");
+        return 1;
+    }
+
+    FILE* results = fopen(options.out.c_str(), "a");
+    if (!results) {
+        fprintf(stderr, "ERROR:Cannot open %s\n", options.out.c_str());
+        return 1;
+    }
+
+    fprintf(results, "{\"record\":\"corpus\",\"engine\":%s,\"host_threads\":%u,\"sources\":[",
+            jsonString(options.engine).c_str(), std::thread::hardware_concurrency());
+    for (size_t i = 0; i < corpus.size(); i++) {
+        fprintf(results, "%s%s", i ? "," : "", jsonString(corpus[i].path).c_str());
+    }
+    fprintf(results, "]}\n");
+    fflush(results);
+
+    bool sampleGpu = nvidiaSmiAvailable();
+    bool gpuMissing = false;
+    int runs = 0;
+
+    for (const std::string& engine : options.engines) {
+        for (const std::string& mode : options.modes) {
+            for (const std::string& format : options.formats) {
+                for (const std::string& quality : options.qualities) {
+                    bool batched = mode == "batched";
+                    int streams = batched ? options.streams : 1;
+                    int pack = batched ? 32 : 1;
+
+                    fprintf(results, "{\"record\":\"run\",\"engine\":%s,\"mode\":%s,"
+                            "\"format\":%s,\"quality\":%s,\"streams\":%d,\"pack\":%d,",
+                            jsonString(engine).c_str(), jsonString(mode).c_str(),
+                            jsonString(format).c_str(), jsonString(quality).c_str(),
+                            streams, pack);
+
+                    if (engine == "gpu" && gpuMissing) {
+                        fprintf(results, "\"status\":\"skipped\",\"reason\":\"CUDA unavailable\"}\n");
+                        fflush(results);
+                        continue;
+                    }
+
+                    // Full size and half extent for every source
+                    std::string batchFile = options.work + "/jobs.txt";
+                    FILE* jobs = fopen(batchFile.c_str(), "w");
+                    if (!jobs) {
+                        fprintf(results, "\"status\":\"error\",\"reason\":\"cannot write jobs\"}\n");
+                        continue;
+                    }
+                    int jobCount = 0;
+                    for (const CorpusEntry& entry : corpus) {
+                        for (int extent : {entry.extent, std::max(1, entry.extent / 2)}) {
+                            fprintf(jobs, "%s|%s/%d.dds|%d|%s|0\n", entry.path.c_str(),
+                                    outDir.c_str(), jobCount, extent, format.c_str());
+                            jobCount++;
+                        }
+                    }
+                    fclose(jobs);
+
+                    std::vector<std::string> args = {
+                        "--streams", std::to_string(streams),
+                        "--pack", std::to_string(pack),
+                        "--quality", quality,
+                        "--timing",
+                    };
+                    if (batched) {
+                        args.push_back("--vram-budget");
+                        args.push_back("1024");
+                    }
+                    if (engine == "cpu") args.push_back("--cpu-only");
+
+                    fprintf(stderr, "BENCH:%s/%s/%s/%s\n", engine.c_str(), mode.c_str(),
+                            format.c_str(), quality.c_str());
+                    RunResult result = runEngine(options, args, batchFile, sampleGpu && engine == "gpu");
+                    runs++;
+
+                    if (!result.started) {
+                        fprintf(results, "\"status\":\"error\",\"reason\":\"engine did not start\","
+                                "\"exit_code\":%d}\n", result.exitCode);
+                        fflush(results);
+                        continue;
+                    }
+                    if (engine == "gpu" && !result.cuda) {
+                        // The run above fell back to the CPU engine; don't pass it off as GPU
+                        gpuMissing = true;
+                        fprintf(results, "\"status\":\"skipped\",\"reason\":\"CUDA unavailable\"}\n");
+                        fflush(results);
+                        continue;
+                    }
+
+                    double mpix = result.sourcePixels / 1e6;
+                    fprintf(results, "\"status\":\"ok\",\"cuda\":%s,\"jobs\":%d,\"succeeded\":%d,"
+                            "\"failed\":%d,\"seconds\":%.3f,\"source_mpix\":%.3f,"
+                            "\"mpix_per_s\":%.3f,\"textures_per_s\":%.3f,\"peak_rss_mb\":%.1f,",
+                            result.cuda ? "true" : "false", jobCount, result.ok, result.failed,
+                            result.seconds, mpix,
+                            result.seconds > 0 ? mpix / result.seconds : 0.0,
+                            result.seconds > 0 ? result.ok / result.seconds : 0.0,
+                            result.peakRssKb / 1024.0);
+                    if (result.peakVramMb >= 0) {
+                        fprintf(results, "\"peak_vram_mb\":%ld,", result.peakVramMb);
+                    } else {
+                        fprintf(results, "\"peak_vram_mb\":null,");
+                    }
+                    fprintf(results, "\"stages_ms\":{");
+                    for (int i = 0; i < 7; i++) {
+                        fprintf(results, "%s\"%s\":%.1f", i ? "," : "", kStages[i], result.stages[i]);
+                    }
+                    fprintf(results, "}}\n");
+                    fflush(results);
+                }
+            }
+        }
+    }
+
+    fclose(results);
+    fprintf(stderr, "BENCH_END:%d runs:%s\n", runs, options.out.c_str());
+    return 0;
+}
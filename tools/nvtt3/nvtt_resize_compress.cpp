@@ -115,44 +115,28 @@ void patchDdsHeader(const char* path, int width, int height, Format format) {
     fclose(f);
 }
 
-// Detect if source DDS uses an sRGB DXGI format by reading the DX10 header.
-// Check if source DDS has a DX10 extended header (FourCC == "DX10")
-bool hasDX10Header(const char* path) {
-    FILE* f = fopen(path, "rb");
-    if (!f) return false;
-    unsigned char hdr[88];
-    bool dx10 = false;
-    if (fread(hdr, 1, 88, f) == 88) {
-        dx10 = (hdr[84] == 'D' && hdr[85] == 'X' && hdr[86] == '1' && hdr[87] == '0');
-    }
-    fclose(f);
-    return dx10;
-}
-
-// sRGB formats: 28 (R8G8B8A8_UNORM_SRGB), 72 (BC1_SRGB), 75 (BC2_SRGB),
-//               78 (BC3_SRGB), 91 (B8G8R8A8_UNORM_SRGB), 99 (BC7_SRGB)
-bool isSourceSrgb(const char* path) {
+// Determine sRGB for output based on source format and hint from caller.
+// DX10 sources carry it in the DXGI format; legacy sources use the hint.
+// The header is read once for both checks.
+// sRGB formats: 29 (R8G8B8A8_UNORM_SRGB), 72 (BC1_SRGB), 75 (BC2_SRGB),
+//               78 (BC3_SRGB), 91 (B8G8R8A8_UNORM_SRGB),
+//               93 (B8G8R8X8_UNORM_SRGB), 99 (BC7_SRGB)
+bool determineSrgb(const char* path, int srgbHint) {
     FILE* f = fopen(path, "rb");
-    if (!f) return false;
+    if (!f) return (srgbHint == 1);
 
     unsigned char hdr[132];
-    bool srgb = false;
-    if (fread(hdr, 1, 132, f) == 132) {
-        if (hdr[84] == 'D' && hdr[85] == 'X' && hdr[86] == '1' && hdr[87] == '0') {
-            uint32_t dxgi = hdr[128] | (hdr[129] << 8) | (hdr[130] << 16) | (hdr[131] << 24);
-            srgb = (dxgi == 28 || dxgi == 72 || dxgi == 75 || dxgi == 78 || dxgi == 91 || dxgi == 99);
-        }
-    }
+    size_t got = fread(hdr, 1, sizeof(hdr), f);
     fclose(f);
-    return srgb;
-}
 
-// Determine sRGB for output based on source format and hint from caller.
-bool determineSrgb(const char* path, int srgbHint) {
-    if (hasDX10Header(path)) {
-        return isSourceSrgb(path);
+    bool dx10 = got >= 88 && memcmp(hdr + 84, "DX10", 4) == 0;
+    if (!dx10) {
+        return (srgbHint == 1);
     }
-    return (srgbHint == 1);
+    if (got < 132) return false;
+    uint32_t dxgi = hdr[128] | (hdr[129] << 8) | (hdr[130] << 16) | (hdr[131] << 24);
+    return (dxgi == 29 || dxgi == 72 || dxgi == 75 || dxgi == 78 || dxgi == 91 ||
+            dxgi == 93 || dxgi == 99);
 }
 
 int main(int argc, char* argv[]) {
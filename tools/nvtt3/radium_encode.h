@@ -0,0 +1,105 @@
+/*
+ * radium_encode.h - C ABI of libradium_encode.so, the nvtt_batch_compress
+ * pipeline as an in-process engine
+ *
+ * The library is nvtt_batch_compress.cpp built without main() (make
+ * libradium_encode.so). An engine owns what a --server process would: the
+ * CUDA/CPU Contexts, decode threads and GPU workers. Jobs go in as the same
+ * pipe-separated lines the server reads, completions come back as structs,
+ * so the caller neither spawns a process nor parses OK:/FAIL: text.
+ *
+ *   radium_engine* engine = radium_engine_create(argc, argv);  // server flags
+ *   int job = radium_engine_submit(engine, "in.dds|out.dds|1024|bc7|0");
+ *   radium_result results[16];
+ *   int n = radium_engine_poll(engine, results, 16, -1);
+ *   radium_engine_destroy(engine);
+ *
+ * Every function is thread-safe. One engine may exist per process at a time,
+ * as the CUDA contexts and buffer pool are process-wide.
+ */
+
+#ifndef RADIUM_ENCODE_H
+#define RADIUM_ENCODE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define RADIUM_ENCODE_API __attribute__((visibility("default")))
+#else
+#define RADIUM_ENCODE_API
+#endif
+
+/* Bumped whenever a struct or signature below changes */
+#define RADIUM_ENCODE_ABI_VERSION 1
+
+typedef struct radium_engine radium_engine;
+
+/* Stages of radium_result.stage_ms, as in --timing */
+enum {
+    RADIUM_STAGE_LOAD,
+    RADIUM_STAGE_UPLOAD,
+    RADIUM_STAGE_RESIZE,
+    RADIUM_STAGE_MIPS,
+    RADIUM_STAGE_ENCODE,
+    RADIUM_STAGE_PATCH,
+    RADIUM_STAGE_WRITE,
+    RADIUM_STAGE_COUNT
+};
+
+/* One finished job. The strings are static and never freed. */
+typedef struct radium_result {
+    int job;                /* number returned by radium_engine_submit*() */
+    int ok;                 /* output written */
+    const char* error;      /* why it failed, NULL when ok */
+    int source_width;
+    int source_height;
+    int width;              /* of the written output */
+    int height;
+    int mip_count;
+    const char* format;     /* format written, e.g. "BC7" (see --auto-bc1) */
+    double stage_ms[RADIUM_STAGE_COUNT]; /* upload is only split out with --timing */
+} radium_result;
+
+typedef struct radium_stats {
+    int submitted;
+    int succeeded;
+    int failed;
+    int pending;            /* submitted, not yet returned by poll */
+    int gpus;               /* CUDA devices in use, 0 = CPU engine only */
+} radium_stats;
+
+RADIUM_ENCODE_API int radium_abi_version(void);
+
+/* Start an engine with nvtt_batch_compress options (--streams, --pack, ...;
+ * not --server/--socket). NULL on a bad option or if an engine exists. */
+RADIUM_ENCODE_API radium_engine* radium_engine_create(int argc, const char* const* argv);
+
+/* Finish every submitted job, then stop the engine */
+RADIUM_ENCODE_API void radium_engine_destroy(radium_engine* engine);
+
+/* Queue a job line "input|output|max_extent|format|srgb[|header[|kind[|quality]]]".
+ * Returns its number (1, 2, ...), or 0 if the line is invalid. */
+RADIUM_ENCODE_API int radium_engine_submit(radium_engine* engine, const char* job);
+
+/* Same, with the source DDS in memory (copied before returning); the job's
+ * input field is ignored, as for "@<bytes>" server jobs */
+RADIUM_ENCODE_API int radium_engine_submit_memory(radium_engine* engine, const char* job,
+                                                  const void* data, size_t size);
+
+/* Move up to `capacity` finished jobs into `results`, waiting up to
+ * `timeout_ms` for the first (-1 = until one finishes). Returns how many;
+ * 0 right away when nothing is pending. */
+RADIUM_ENCODE_API int radium_engine_poll(radium_engine* engine, radium_result* results,
+                                         int capacity, int timeout_ms);
+
+RADIUM_ENCODE_API void radium_engine_stats(radium_engine* engine, radium_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RADIUM_ENCODE_H */